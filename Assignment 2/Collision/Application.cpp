@@ -1,7 +1,11 @@
 #include "Application.h"
 #include "HeightMap.h"
 #include "PhysicsWorld.h"
-#include <future>
+#include "Frustum.h"
+#include "JobSystem.h"
+#include "MeshGenerators.h"
+#include <chrono>
+#include <vector>
 
 Application* Application::s_pApp = NULL;
 
@@ -12,6 +16,19 @@ const int CAMERA_TOP = 0;
 const int CAMERA_ROTATE = 1;
 const int CAMERA_MAX = 2;
 static CommonMesh* s_SphereMesh = nullptr;
+
+// pOut[i] = pPrevious[i] + (pCurrent[i] - pPrevious[i]) * alpha, a whole sphere at a time
+static void InterpolateBounds(const XMFLOAT4* pPrevious, const XMFLOAT4* pCurrent, int count, float alpha, XMFLOAT4* pOut)
+{
+	const XMVECTOR vAlpha = XMVectorReplicate(alpha);
+
+	for (int i = 0; i < count; ++i)
+	{
+		const XMVECTOR previous = XMLoadFloat4(&pPrevious[i]);
+		XMStoreFloat4(&pOut[i], XMVectorMultiplyAdd(XMVectorSubtract(XMLoadFloat4(&pCurrent[i]), previous), vAlpha, previous));
+	}
+}
+
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
@@ -19,9 +36,12 @@ bool Application::HandleStart()
 {
 	s_pApp = this;
 
+	m_pJobSystem = new JobSystem;
+
 	m_frameCount = 0.0f;
 
 	m_bWireframe = true;
+	m_bSortDraws = true;
 	//m_pHeightMap = new HeightMap("Resources/heightmap.bmp", 2.0f, 0.75f);
 
 	m_heightMapPtrs[0] = new HeightMap("Resources/heightmap_a.bmp", 2.0f, 0.75f);
@@ -29,7 +49,15 @@ bool Application::HandleStart()
 	m_heightMapPtrs[2] = new HeightMap("Resources/heightmap_c.bmp", 2.0f, 0.75f);
 	m_heightMapPtrs[3] = new HeightMap("Resources/heightmap_d.bmp", 2.0f, 0.75f);
 
-	m_pCurrentHeightmap = m_heightMapPtrs[0];
+	m_heightMapIndex = 0;
+	m_pCurrentHeightmap = m_heightMapPtrs[m_heightMapIndex];
+
+#if TESTING_ENABLED
+	for (auto pHeightMap : m_heightMapPtrs)
+	{
+		pHeightMap->RunDiagnostics();
+	}
+#endif
 
 	mSpherePos = XMFLOAT3(-14.0, 20.0f, -14.0f);
 	mSphereVel = XMFLOAT3(0.0f, 0.0f, 0.0f);
@@ -71,7 +99,26 @@ bool Application::HandleStart()
 			m_dynamicBodyPtrs[i]->setActivityFlag(false);
 		}
 	}
-	m_pPhysicsWorld = new PhysicsWorld(m_dynamicBodyPtrs);
+	m_pPhysicsWorld = new PhysicsWorld(m_dynamicBodyPtrs, m_pJobSystem);
+
+	m_bBodyWasPublished.fill(false);
+
+	// The render thread has something to draw before the physics thread's first tick
+	publishSnapshot();
+
+	m_pSphereInstanceBuffer = CreateDynamicVertexBuffer(GetDevice(), sizeof(Instance_Pos3fScale1f) * SPHERE_COUNT, nullptr);
+	if (!m_pSphereInstanceBuffer)
+	{
+		return false;
+	}
+
+#if TESTING_ENABLED
+	RunRenderDiagnostics();
+	RunMatrixDiagnostics();
+	RunMeshDiagnostics();
+	RunFrustumDiagnostics();
+	RunPhysicsDiagnostics();
+#endif
 
 	return true;
 }
@@ -81,6 +128,8 @@ bool Application::HandleStart()
 
 void Application::HandleStop()
 {
+	Release(m_pSphereInstanceBuffer);
+
 	for (auto& pDynamicBody : m_dynamicBodyPtrs)
 	{
 		SAFE_FREE(pDynamicBody);
@@ -90,6 +139,8 @@ void Application::HandleStop()
 	{
 		SAFE_FREE(pHeightMap);
 	}
+
+	SAFE_FREE(m_pJobSystem);
 	this->CommonApp::HandleStop();
 }
 
@@ -98,7 +149,10 @@ void Application::HandleStop()
 
 void Application::ReloadShaders()
 {
-	if (m_pCurrentHeightmap->ReloadShader() == false)
+	// The heightmap being drawn, which the physics thread's current one may have moved on from
+	HeightMap* pHeightMap = m_heightMapPtrs[m_snapshots.GetReadBuffer().heightMapIndex];
+
+	if (pHeightMap->ReloadShader() == false)
 		this->SetWindowTitle("Reload Failed - see Visual Studio output window. Press F5 to try again.");
 	else
 		this->SetWindowTitle("Collision: Zoom / Rotate Q, A / O, P, Camera C, Drop Sphere R, N and T, Wire W");
@@ -106,21 +160,25 @@ void Application::ReloadShaders()
 
 void Application::HandleUpdate()
 {
-	m_pPhysicsWorld->tick();
-	m_pCurrentHeightmap->Tick();
+	// Called once a frame on the main thread. The camera and render state are changed here directly, 
+	// anything touching the bodies or heightmaps is queued for the physics thread
+
+	// The camera used to move a step per physics tick, keep it the same speed
+	const float inputScale = m_appBaseDT / PhysicsDT;
+
 	if (m_cameraState == CAMERA_ROTATE)
 	{
 		if (this->IsKeyPressed('Q') && m_cameraZ > 38.0f)
-			m_cameraZ -= 1.0f;
+			m_cameraZ -= 1.0f * inputScale;
 
 		if (this->IsKeyPressed('A'))
-			m_cameraZ += 1.0f;
+			m_cameraZ += 1.0f * inputScale;
 
 		if (this->IsKeyPressed('O'))
-			m_rotationAngle -= .01f;
+			m_rotationAngle -= .01f * inputScale;
 
 		if (this->IsKeyPressed('P'))
-			m_rotationAngle += .01f;
+			m_rotationAngle += .01f * inputScale;
 	}
 
 	static bool dbC = false;
@@ -174,12 +232,14 @@ void Application::HandleUpdate()
 	{
 		if (dbR == false)
 		{
-			static int dx = 0;
-			static int dy = 0;
-			mSpherePos = XMFLOAT3((float)((rand() % 14 - 7.0f) - 0.5), 20.0f, (float)((rand() % 14 - 7.0f) - 0.5));
-			mSphereVel = XMFLOAT3(0.0f, 0.2f, 0.0f);
-			m_dynamicBodyPtrs[0]->setVelocity(mSphereVel);
-			m_dynamicBodyPtrs[0]->setPosition(mSpherePos);
+			queuePhysicsCommand([this]()
+			{
+				mSpherePos = XMFLOAT3((float)((rand() % 14 - 7.0f) - 0.5), 20.0f, (float)((rand() % 14 - 7.0f) - 0.5));
+				mSphereVel = XMFLOAT3(0.0f, 0.2f, 0.0f);
+				m_dynamicBodyPtrs[0]->setVelocity(mSphereVel);
+				m_dynamicBodyPtrs[0]->setPosition(mSpherePos);
+				m_dynamicBodyPtrs[0]->wake();
+			});
 			dbR = true;
 		}
 	}
@@ -193,11 +253,13 @@ void Application::HandleUpdate()
 	{
 		if (dbT == false)
 		{
-			static int dx = 0;
-			static int dy = 0;
-			mSpherePos = XMFLOAT3(mSpherePos.x, 20.0f, mSpherePos.z);
-			m_dynamicBodyPtrs[0]->setVelocity(XMFLOAT3(0.0f, 0.2f, 0.0f));
-			m_dynamicBodyPtrs[0]->setPosition(mSpherePos);
+			queuePhysicsCommand([this]()
+			{
+				mSpherePos = XMFLOAT3(mSpherePos.x, 20.0f, mSpherePos.z);
+				m_dynamicBodyPtrs[0]->setVelocity(XMFLOAT3(0.0f, 0.2f, 0.0f));
+				m_dynamicBodyPtrs[0]->setPosition(mSpherePos);
+				m_dynamicBodyPtrs[0]->wake();
+			});
 
 			dbT = true;
 		}
@@ -216,26 +278,30 @@ void Application::HandleUpdate()
 	{
 		if (dbN == false)
 		{
-			if (++seg == 2)
+			queuePhysicsCommand([this]()
 			{
-				seg = 0;
-				if (++dx == 15)
+				if (++seg == 2)
 				{
-					if (++dy == 15) dy = 0;
-					dx = 0;
+					seg = 0;
+					if (++dx == 15)
+					{
+						if (++dy == 15) dy = 0;
+						dx = 0;
+					}
 				}
-			}
 
-			if (seg == 0)
-				mSpherePos = XMFLOAT3(((dx - 7.0f) * 2) - 0.5f, 20.0f, ((dy - 7.0f) * 2) - 0.5f);
-			else
-				mSpherePos = XMFLOAT3(((dx - 7.0f) * 2) + 0.5f, 20.0f, ((dy - 7.0f) * 2) + 0.5f);
+				if (seg == 0)
+					mSpherePos = XMFLOAT3(((dx - 7.0f) * 2) - 0.5f, 20.0f, ((dy - 7.0f) * 2) - 0.5f);
+				else
+					mSpherePos = XMFLOAT3(((dx - 7.0f) * 2) + 0.5f, 20.0f, ((dy - 7.0f) * 2) + 0.5f);
 
-			mSphereVel = XMFLOAT3(0.0f, 0.2f, 0.0f);
-			mGravityAcc = XMFLOAT3(0.0f, G_VALUE, 0.0f);
-			mSphereCollided = true;
-			m_dynamicBodyPtrs[0]->setPosition(mSpherePos);
-			m_dynamicBodyPtrs[0]->setVelocity(XMFLOAT3(0, 0, 0));
+				mSphereVel = XMFLOAT3(0.0f, 0.2f, 0.0f);
+				mGravityAcc = XMFLOAT3(0.0f, G_VALUE, 0.0f);
+				mSphereCollided = true;
+				m_dynamicBodyPtrs[0]->setPosition(mSpherePos);
+				m_dynamicBodyPtrs[0]->setVelocity(XMFLOAT3(0, 0, 0));
+				m_dynamicBodyPtrs[0]->wake();
+			});
 			dbN = true;
 		}
 	}
@@ -246,44 +312,11 @@ void Application::HandleUpdate()
 	//m_dynamicBodyPtrs[0]->setPosition(XMVectorSet(0, 20, 0, 0));
 	//m_dynamicBodyPtrs[0]->setVelocity(XMFLOAT3(0, 0, 0));
 
-	// Update Sphere
-	XMVECTOR vSColPos, vSColNorm;
-
-	if (!mSphereCollided)
-	{
-		XMVECTOR vSPos = XMLoadFloat3(&mSpherePos);
-		XMVECTOR vSVel = XMLoadFloat3(&mSphereVel);
-		XMVECTOR vSAcc = XMLoadFloat3(&mGravityAcc);
-
-		vSVel += vSAcc * m_deltaTime; // The new velocity gets passed through to the collision so it can base its predictions on our speed NEXT FRAME
-		vSPos += vSVel * m_deltaTime; // Really important that we add LAST FRAME'S velocity as this was how fast the collision is expecting the ball to move
-
-
-		XMStoreFloat3(&mSphereVel, vSVel);
-		XMStoreFloat3(&mSpherePos, vSPos);
-
-		mSphereSpeed = XMVectorGetX(XMVector3Length(vSVel));
-
-		mSphereCollided = m_pCurrentHeightmap->RayCollision(vSPos, vSVel, mSphereSpeed, vSColPos, vSColNorm);
-
-		if (mSphereCollided)
-		{
-			mSphereVel = XMFLOAT3(0.0f, 0.0f, 0.0f);
-			XMStoreFloat3(&mSpherePos, vSColPos);
-		}
-	}
-
 #pragma region Question 2 Debug Tools
 
-	if (IsKeyPressed(' '))
-	{ // slow the simulation down by sleeping when keyboard is pressed 
-		m_deltaTime = (PhysicsDT / 10.0f);
-	}
-	else
-	{
-		m_deltaTime = PhysicsDT;
+	// slow the simulation down while space is held
+	m_bSlowMotion.store(IsKeyPressed(' ') != 0, std::memory_order_relaxed);
 
-	}
 	static bool dbU = false, dbI = false, dbD = false;
 	static XMFLOAT3 float3Array[FACE_NORM_VERTICES_COUNT];
 	static int indexInVecArray = 0;
@@ -295,17 +328,21 @@ void Application::HandleUpdate()
 		{
 			dbU = true;
 
-			indexInVecArray = 3;
-			m_pCurrentHeightmap->GetFaceVerticesByIndex(faceIndex, float3Array);
-			mSpherePos = XMFLOAT3(float3Array[indexInVecArray].x, 20.0f, float3Array[indexInVecArray].z);
-			mSphereVel = XMFLOAT3(0.0f, 0.2f, 0.0f);
-			m_dynamicBodyPtrs[0]->setVelocity(mSphereVel);
-			m_dynamicBodyPtrs[0]->setPosition(mSpherePos);
-
-			if (faceIndex++ >= m_pCurrentHeightmap->GetFaceCount())
+			queuePhysicsCommand([this]()
 			{
-				faceIndex = 0;
-			}
+				indexInVecArray = 3;
+				m_pCurrentHeightmap->GetFaceVerticesByIndex(faceIndex, float3Array);
+				mSpherePos = XMFLOAT3(float3Array[indexInVecArray].x, 20.0f, float3Array[indexInVecArray].z);
+				mSphereVel = XMFLOAT3(0.0f, 0.2f, 0.0f);
+				m_dynamicBodyPtrs[0]->setVelocity(mSphereVel);
+				m_dynamicBodyPtrs[0]->setPosition(mSpherePos);
+				m_dynamicBodyPtrs[0]->wake();
+
+				if (faceIndex++ >= m_pCurrentHeightmap->GetFaceCount())
+				{
+					faceIndex = 0;
+				}
+			});
 		}
 	}
 	else
@@ -319,17 +356,21 @@ void Application::HandleUpdate()
 		{
 			dbI = true;
 
-			indexInVecArray = 3;
-			m_pCurrentHeightmap->GetFaceVerticesByIndex(faceIndex, float3Array);
-			mSpherePos = XMFLOAT3(float3Array[indexInVecArray].x, 20.0f, float3Array[indexInVecArray].z);
-			mSphereVel = XMFLOAT3(0.0f, 0.2f, 0.0f);
-			m_dynamicBodyPtrs[0]->setVelocity(mSphereVel);
-			m_dynamicBodyPtrs[0]->setPosition(mSpherePos);
-
-			if (--faceIndex < 0)
+			queuePhysicsCommand([this]()
 			{
-				faceIndex = m_pCurrentHeightmap->GetFaceCount() - 1;
-			}
+				indexInVecArray = 3;
+				m_pCurrentHeightmap->GetFaceVerticesByIndex(faceIndex, float3Array);
+				mSpherePos = XMFLOAT3(float3Array[indexInVecArray].x, 20.0f, float3Array[indexInVecArray].z);
+				mSphereVel = XMFLOAT3(0.0f, 0.2f, 0.0f);
+				m_dynamicBodyPtrs[0]->setVelocity(mSphereVel);
+				m_dynamicBodyPtrs[0]->setPosition(mSpherePos);
+				m_dynamicBodyPtrs[0]->wake();
+
+				if (--faceIndex < 0)
+				{
+					faceIndex = m_pCurrentHeightmap->GetFaceCount() - 1;
+				}
+			});
 		}
 	}
 	else
@@ -343,15 +384,19 @@ void Application::HandleUpdate()
 		{
 			dbD = true;
 
-			mSpherePos = XMFLOAT3(float3Array[indexInVecArray].x, 20.0f, float3Array[indexInVecArray].z);
-			mSphereVel = XMFLOAT3(0.0f, 0.2f, 0.0f);
-			mGravityAcc = XMFLOAT3(0.0f, G_VALUE, 0.0f);
-			m_dynamicBodyPtrs[0]->setVelocity(mSphereVel);
-			m_dynamicBodyPtrs[0]->setPosition(mSpherePos);
-			if (++indexInVecArray >= FACE_NORM_VERTICES_COUNT)
+			queuePhysicsCommand([this]()
 			{
-				indexInVecArray = 0;
-			}
+				mSpherePos = XMFLOAT3(float3Array[indexInVecArray].x, 20.0f, float3Array[indexInVecArray].z);
+				mSphereVel = XMFLOAT3(0.0f, 0.2f, 0.0f);
+				mGravityAcc = XMFLOAT3(0.0f, G_VALUE, 0.0f);
+				m_dynamicBodyPtrs[0]->setVelocity(mSphereVel);
+				m_dynamicBodyPtrs[0]->setPosition(mSpherePos);
+				m_dynamicBodyPtrs[0]->wake();
+				if (++indexInVecArray >= FACE_NORM_VERTICES_COUNT)
+				{
+					indexInVecArray = 0;
+				}
+			});
 		}
 
 	}
@@ -362,22 +407,25 @@ void Application::HandleUpdate()
 
 	if (IsKeyPressed('F'))
 	{
-		mSphereVel = XMFLOAT3(0.0f, 0.2f, 0.0f);
+		queuePhysicsCommand([this]()
+		{
+			mSphereVel = XMFLOAT3(0.0f, 0.2f, 0.0f);
 
-		m_dynamicBodyPtrs[0]->setVelocity(mSphereVel);
-		m_dynamicBodyPtrs[1]->setVelocity(mSphereVel);
+			m_dynamicBodyPtrs[0]->setVelocity(mSphereVel);
+			m_dynamicBodyPtrs[1]->setVelocity(mSphereVel);
 
-		XMFLOAT3 returnedVerts[FACE_NORM_VERTICES_COUNT]{ XMFLOAT3(0.0f, 0.0f, 0.0f) };
-		constexpr int idxA = (7 * 30);
-		constexpr int idxB = idxA + 29;
+			XMFLOAT3 returnedVerts[FACE_NORM_VERTICES_COUNT]{ XMFLOAT3(0.0f, 0.0f, 0.0f) };
+			constexpr int idxA = (7 * 30);
+			constexpr int idxB = idxA + 29;
 
-		m_pCurrentHeightmap->GetFaceVerticesByIndex(idxA, returnedVerts);
-		m_dynamicBodyPtrs[0]->setPosition(XMFLOAT3(returnedVerts[3].x, 20.0f, returnedVerts[3].z));
-		m_dynamicBodyPtrs[0]->setActivityFlag(true);
+			m_pCurrentHeightmap->GetFaceVerticesByIndex(idxA, returnedVerts);
+			m_dynamicBodyPtrs[0]->setPosition(XMFLOAT3(returnedVerts[3].x, 20.0f, returnedVerts[3].z));
+			m_dynamicBodyPtrs[0]->setActivityFlag(true);
 
-		m_pCurrentHeightmap->GetFaceVerticesByIndex(idxB, returnedVerts);
-		m_dynamicBodyPtrs[1]->setPosition(XMFLOAT3(returnedVerts[3].x, 20.0f, returnedVerts[3].z));
-		m_dynamicBodyPtrs[1]->setActivityFlag(true);
+			m_pCurrentHeightmap->GetFaceVerticesByIndex(idxB, returnedVerts);
+			m_dynamicBodyPtrs[1]->setPosition(XMFLOAT3(returnedVerts[3].x, 20.0f, returnedVerts[3].z));
+			m_dynamicBodyPtrs[1]->setActivityFlag(true);
+		});
 
 
 	}
@@ -387,15 +435,18 @@ void Application::HandleUpdate()
 	{
 		if (!dbUp)
 		{
-			DynamicBody* pBody = getNextAvailableBody();
-			if (pBody != nullptr)
+			queuePhysicsCommand([this]()
 			{
-				mSpherePos = XMFLOAT3((float)((rand() % 14 - 7.0f) - 0.5), 20.0f, (float)((rand() % 14 - 7.0f) - 0.5));
-				mSphereVel = XMFLOAT3(0.0f, 0.2f, 0.0f);
-				pBody->setVelocity(mSphereVel);
-				pBody->setPosition(mSpherePos);
-				pBody->setActivityFlag(true);
-			}
+				DynamicBody* pBody = getNextAvailableBody();
+				if (pBody != nullptr)
+				{
+					mSpherePos = XMFLOAT3((float)((rand() % 14 - 7.0f) - 0.5), 20.0f, (float)((rand() % 14 - 7.0f) - 0.5));
+					mSphereVel = XMFLOAT3(0.0f, 0.2f, 0.0f);
+					pBody->setVelocity(mSphereVel);
+					pBody->setPosition(mSpherePos);
+					pBody->setActivityFlag(true);
+				}
+			});
 			dbUp = true;
 		}
 	}
@@ -412,17 +463,21 @@ void Application::HandleUpdate()
 		if (!dbH)
 		{
 			dbH = true;
-			if (!disableBase)
-			{
-				const int hiddenCount = m_pCurrentHeightmap->EnableAll();
-				dprintf("Hidden count: %d\n", hiddenCount);
-			}
-			else
+			queuePhysicsCommand([this]()
 			{
-				const int hiddenCount = m_pCurrentHeightmap->DisableBelowLevel(Y_DISABLE_VALUE);
-				dprintf("Hidden count: %d\n", hiddenCount);
-			}
-			disableBase = !disableBase;
+				if (!disableBase)
+				{
+					const int hiddenCount = m_pCurrentHeightmap->EnableAll();
+					dprintf("Hidden count: %d\n", hiddenCount);
+				}
+				else
+				{
+					const int hiddenCount = m_pCurrentHeightmap->DisableBelowLevel(Y_DISABLE_VALUE);
+					dprintf("Hidden count: %d\n", hiddenCount);
+				}
+				disableBase = !disableBase;
+				wakeActiveBodies();
+			});
 		}
 	}
 	else
@@ -436,13 +491,16 @@ void Application::HandleUpdate()
 #pragma region Change Heightmap Controls (TAP TAB)
 
 	static bool bIsTabDown = false;
-	static int heightMapIndex = 0; // current heightmap
 	if (IsKeyPressed(VK_TAB))
 	{
 		if (!bIsTabDown)
 		{
-			heightMapIndex + 1 < MAX_HEIGHTMAPS_COUNT ? ++heightMapIndex : heightMapIndex = 0;
-			m_pCurrentHeightmap = m_heightMapPtrs[heightMapIndex];
+			queuePhysicsCommand([this]()
+			{
+				m_heightMapIndex + 1 < MAX_HEIGHTMAPS_COUNT ? ++m_heightMapIndex : m_heightMapIndex = 0;
+				m_pCurrentHeightmap = m_heightMapPtrs[m_heightMapIndex];
+				wakeActiveBodies();
+			});
 			bIsTabDown = true;
 		}
 	}
@@ -453,6 +511,136 @@ void Application::HandleUpdate()
 
 #pragma endregion
 
+#if TESTING_ENABLED
+	// How the physics thread is keeping up, every few seconds
+	static float timingReportTime = 0.0f;
+	timingReportTime += m_appBaseDT;
+	if (timingReportTime >= 5.0f)
+	{
+		timingReportTime = 0.0f;
+
+		const PhysicsTimingStats stats = GetPhysicsTimingStats();
+		dprintf("Physics: %u ticks, %u dropped, %.3f ms avg tick, up to %u ticks per wake, running at %.2fx real time\n",
+			stats.numTicks, stats.numDroppedTicks, stats.averageTickTime * 1000.0f, stats.maxTicksPerWake, stats.simulationRate);
+	}
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void Application::HandlePhysicsUpdate()
+{
+	runPhysicsCommands();
+
+	m_deltaTime = m_bSlowMotion.load(std::memory_order_relaxed) ? (PhysicsDT / 10.0f) : PhysicsDT;
+
+	m_pPhysicsWorld->tick();
+
+	// Update Sphere
+	XMVECTOR vSColPos, vSColNorm;
+
+	if (!mSphereCollided)
+	{
+		XMVECTOR vSPos = XMLoadFloat3(&mSpherePos);
+		XMVECTOR vSVel = XMLoadFloat3(&mSphereVel);
+		XMVECTOR vSAcc = XMLoadFloat3(&mGravityAcc);
+
+		vSVel += vSAcc * m_deltaTime; // The new velocity gets passed through to the collision so it can base its predictions on our speed NEXT FRAME
+		vSPos += vSVel * m_deltaTime; // Really important that we add LAST FRAME'S velocity as this was how fast the collision is expecting the ball to move
+
+
+		XMStoreFloat3(&mSphereVel, vSVel);
+		XMStoreFloat3(&mSpherePos, vSPos);
+
+		mSphereSpeed = XMVectorGetX(XMVector3Length(vSVel));
+
+		mSphereCollided = m_pCurrentHeightmap->RayCollision(vSPos, vSVel, mSphereSpeed, vSColPos, vSColNorm);
+
+		if (mSphereCollided)
+		{
+			mSphereVel = XMFLOAT3(0.0f, 0.0f, 0.0f);
+			XMStoreFloat3(&mSpherePos, vSColPos);
+		}
+	}
+
+	publishSnapshot();
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void Application::queuePhysicsCommand(std::function<void()> command)
+{
+	std::lock_guard<std::mutex> lock(m_physicsCommandMutex);
+	m_physicsCommands.push_back(std::move(command));
+}
+
+void Application::runPhysicsCommands()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_physicsCommandMutex);
+		m_runningPhysicsCommands.swap(m_physicsCommands);
+	}
+
+	for (auto& command : m_runningPhysicsCommands)
+	{
+		command();
+	}
+	m_runningPhysicsCommands.clear();
+}
+
+void Application::publishSnapshot()
+{
+	PhysicsSnapshot& snapshot = m_snapshots.GetWriteBuffer();
+
+	// The active bodies' bounding spheres go into one contiguous array, so the render thread can cull them a batch at a time
+	int bodyCount = 0;
+	for (auto& pDynamicBody : m_dynamicBodyPtrs)
+	{
+		if (!pDynamicBody->isActive())
+		{
+			continue;
+		}
+
+		assert(pDynamicBody->getCommonMesh() == s_SphereMesh);
+		const ColliderBase* pCollider = pDynamicBody->getColliderBase();
+
+		XMFLOAT4& bounds = snapshot.bodyBounds[bodyCount];
+		XMStoreFloat3((XMFLOAT3*)&bounds, pDynamicBody->getPosition());
+		bounds.w = pCollider->colliderType == Sphere ? static_cast<const SphereCollider*>(pCollider)->radius : 1.0f;
+
+		// A body that has only just become active starts from where it is, rather than sliding in from wherever it was last seen
+		const int bodyIndex = (int)(&pDynamicBody - &m_dynamicBodyPtrs[0]);
+		snapshot.previousBodyBounds[bodyCount] = m_bBodyWasPublished[bodyIndex] ? m_lastBodyBounds[bodyIndex] : bounds;
+		m_lastBodyBounds[bodyIndex] = bounds;
+
+		++bodyCount;
+	}
+	snapshot.bodyCount = bodyCount;
+
+	for (int bodyIndex = 0; bodyIndex < SPHERE_COUNT; ++bodyIndex)
+	{
+		m_bBodyWasPublished[bodyIndex] = m_dynamicBodyPtrs[bodyIndex]->isActive();
+	}
+
+	// The buffers go round all three snapshots, so the face flags are copied whole every time. 
+	// Heightmaps can differ in size, so the arrays are only resized on changing between them
+	const BitArray& collidedFaces = m_pCurrentHeightmap->GetCollidedFaces();
+	const BitArray& disabledFaces = m_pCurrentHeightmap->GetDisabledFaces();
+	if (snapshot.collidedFaces.size() != collidedFaces.size())
+	{
+		snapshot.collidedFaces.resize(collidedFaces.size());
+		snapshot.disabledFaces.resize(disabledFaces.size());
+	}
+	snapshot.collidedFaces.copyFrom(collidedFaces);
+	snapshot.disabledFaces.copyFrom(disabledFaces);
+	snapshot.heightMapIndex = m_heightMapIndex;
+
+	snapshot.tickCount = ++m_physicsTickCount;
+	snapshot.publishTime = std::chrono::steady_clock::now();
+
+	m_snapshots.Publish();
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -488,39 +676,403 @@ void Application::HandleRender()
 
 	this->Clear(XMFLOAT4(0.05f, 0.05f, 0.5f, 1.f));
 
-	this->SetWorldMatrix(m_dynamicBodyPtrs[0]->getWorldMatrix());
+	// The latest tick the physics thread finished, if it's finished one since the last frame. 
+	// Everything drawn below comes from this rather than the bodies and heightmaps themselves
+	const PhysicsSnapshot& snapshot = m_snapshots.Acquire();
+	HeightMap* pHeightMap = m_heightMapPtrs[snapshot.heightMapIndex];
+	pHeightMap->Tick(snapshot.collidedFaces, snapshot.disabledFaces);
+
+	if (m_bSortDraws)
+	{
+		BeginDrawQueue();
+	}
+
+	// Terrain chunks and bodies outside the view never reach the draw queue
+	const Frustum frustum(XMMatrixMultiply(matView, matProj));
+
 	SetDepthStencilState(false, true);
-	m_pCurrentHeightmap->Draw(m_frameCount);
+	pHeightMap->Draw(m_frameCount, frustum, vCamera);
 
 #pragma region DynamicBodyTesting
 
-	for (auto& pDynamicBody : m_dynamicBodyPtrs)
+	// Physics ticks at its own rate, so the bodies are drawn part way from the tick before the 
+	// snapshot's to the snapshot's own, by how long ago it was published. That puts them a tick 
+	// behind, but moving smoothly whatever the two rates are
+	const float alpha = min(std::chrono::duration<float>(std::chrono::steady_clock::now() - snapshot.publishTime).count() / PhysicsDT, 1.0f);
+	InterpolateBounds(snapshot.previousBodyBounds.data(), snapshot.bodyBounds.data(), snapshot.bodyCount, alpha, m_interpolatedBodyBounds.data());
+
+	// Every body shares s_SphereMesh, so the visible ones are packed into the instance buffer 
+	// and drawn with a single instanced call rather than a draw and constant upload each
+	const int visibleCount = CullSpheres(frustum, m_interpolatedBodyBounds.data(), snapshot.bodyCount, m_visibleBodies.data());
+	if (visibleCount > 0)
 	{
-		if (!pDynamicBody->isActive())
+		RenderCommandBuffer* pCommands = GetRenderCommands();
+		const size_t instanceOffset = pCommands->UpdateBuffer(m_pSphereInstanceBuffer, 0, sizeof(Instance_Pos3fScale1f) * visibleCount, true);
+		Instance_Pos3fScale1f* pInstances = static_cast<Instance_Pos3fScale1f*>(pCommands->GetData(instanceOffset));
+
+		for (int visible = 0; visible < visibleCount; ++visible)
 		{
-			continue;
+			const XMFLOAT4& bounds = m_interpolatedBodyBounds[m_visibleBodies[visible]];
+
+			Instance_Pos3fScale1f& instance = pInstances[visible];
+			instance.pos = D3DXVECTOR3(bounds.x, bounds.y, bounds.z);
+			instance.scale = bounds.w;
 		}
 
-		SetWorldMatrix(pDynamicBody->getWorldMatrix());
-		//SetDepthStencilState(false, false);
-		if (pDynamicBody->getCommonMesh())
+		SetWorldMatrix(XMMatrixIdentity());
+		SetDepthStencilState(true, true);
+		s_SphereMesh->DrawInstanced(GetUntexturedLitInstancedShader(), m_pSphereInstanceBuffer, sizeof(Instance_Pos3fScale1f), visibleCount);
+	}
+
+#pragma endregion
+
+	if (m_bSortDraws)
+	{
+		EndDrawQueue();
+	}
+
+	m_frameCount++;
+}
+
+#if TESTING_ENABLED
+void Application::RunRenderDiagnostics()
+{
+	const int frameRepeats = 1000;
+
+	// Anything recorded during start up still has to reach the device
+	SubmitRenderCommands();
+
+	const float frameCount = m_frameCount;
+	const bool bSortDraws = m_bSortDraws;
+
+	// Once with the draws recorded as they're made, once through the draw queue,
+	// to compare the state changes that don't change anything
+	for (int sortDraws = 0; sortDraws < 2; ++sortDraws)
+	{
+		NullRenderBackend nullBackend;
+		SetRenderBackend(&nullBackend);
+		m_bSortDraws = sortDraws != 0;
+
+		size_t frameBytes = 0;
+		unsigned frameCommands = 0;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int repeat = 0; repeat < frameRepeats; ++repeat)
 		{
-			//pDynamicBody->getCommonMesh()->Draw();
+			HandleRender();
+			frameBytes = GetRenderCommands()->GetSizeBytes();
+			frameCommands = GetRenderCommands()->GetNumCommands();
+			SubmitRenderCommands();
 		}
+		const double frameUs = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count() / frameRepeats;
+
+		SetRenderBackend(nullptr);
+		m_frameCount = frameCount;
+
+		const RenderCommandStats& stats = nullBackend.GetStats();
+		dprintf("Application (%s): frame recorded and replayed in %.2f us, %u commands in %u bytes, %u draws (%u instances), %.1f KB uploaded, %u errors\n",
+			m_bSortDraws ? "sorted" : "unsorted", frameUs, frameCommands, (unsigned)frameBytes, stats.numDraws / frameRepeats, stats.numInstances / frameRepeats,
+			stats.numUploadBytes / (1024.0 * frameRepeats), stats.numErrors);
+		dprintf("Application (%s): per frame, %u state changes of which %u redundant, %u redundant shader changes\n",
+			m_bSortDraws ? "sorted" : "unsorted",
+			(stats.numCommands[RenderCommand_SetBlendState] + stats.numCommands[RenderCommand_SetDepthStencilState] + stats.numCommands[RenderCommand_SetRasterizerState]) / frameRepeats,
+			stats.numRedundantStateChanges / frameRepeats, stats.numRedundantShaderChanges / frameRepeats);
+		assert(stats.numErrors == 0);
+	}
 
-		SetWorldMatrix(pDynamicBody->getWorldMatrix());
-		SetDepthStencilState(true, true);
-		if (pDynamicBody->getCommonMesh())
+	m_bSortDraws = bSortDraws;
+}
+
+void Application::RunMatrixDiagnostics()
+{
+	const int matrixCount = 100000;
+
+	XMFLOAT4X4 viewProjection;
+	XMStoreFloat4x4(&viewProjection, XMMatrixMultiply(XMMatrixLookAtLH(XMVectorSet(0.0f, 50.0f, 50.0f, 0.0f), XMVectorZero(), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)),
+		XMMatrixPerspectiveFovLH(float(D3DX_PI / 7), 2, 1.5f, 5000.0f)));
+
+	// Mostly translations, like the bodies, with some rotated + uniformly scaled and some
+	// non-uniformly scaled ones that have to take the general inverse
+	std::vector<XMFLOAT4X4> worlds(matrixCount);
+	for (int i = 0; i < matrixCount; ++i)
+	{
+		XMMATRIX world = XMMatrixTranslation(float(i % 97) - 48.0f, float(i % 13), float(i % 89) - 44.0f);
+		if (i % 4 == 1)
 		{
-			pDynamicBody->getCommonMesh()->Draw();
+			world = XMMatrixMultiply(XMMatrixMultiply(XMMatrixScaling(2.5f, 2.5f, 2.5f), XMMatrixRotationY(i * 0.01f)), world);
 		}
+		else if (i % 4 == 2)
+		{
+			world = XMMatrixMultiply(XMMatrixScaling(1.0f, 2.0f, 3.0f), world);
+		}
+		XMStoreFloat4x4(&worlds[i], world);
 	}
 
-#pragma endregion
+	std::vector<XMFLOAT4X4> d3dxWVPs(matrixCount), d3dxInvXposeWs(matrixCount);
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < matrixCount; ++i)
+	{
+		// As CommonApp did for every draw
+		const D3DXMATRIX& world = *(const D3DXMATRIX*)&worlds[i];
+		D3DXMATRIX wvp, invXposeW;
+		D3DXMatrixMultiply(&wvp, &world, (const D3DXMATRIX*)&viewProjection);
+		if (D3DXMatrixInverse(&invXposeW, NULL, &world))
+			D3DXMatrixTranspose(&invXposeW, &invXposeW);
+		else
+			invXposeW = world;
+		d3dxWVPs[i] = *(XMFLOAT4X4*)&wvp;
+		d3dxInvXposeWs[i] = *(XMFLOAT4X4*)&invXposeW;
+	}
+	const double d3dxMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 
-	m_frameCount++;
+	std::vector<XMFLOAT4X4> wvps(matrixCount), invXposeWs(matrixCount);
+	start = std::chrono::high_resolution_clock::now();
+	ComputeWorldMatrices(viewProjection, &worlds[0], matrixCount, &wvps[0], &invXposeWs[0]);
+	const double batchMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	float maxError = 0.0f;
+	for (int i = 0; i < matrixCount; ++i)
+	{
+		for (int row = 0; row < 4; ++row)
+		{
+			for (int col = 0; col < 4; ++col)
+			{
+				maxError = max(maxError, fabsf(wvps[i].m[row][col] - d3dxWVPs[i].m[row][col]) / max(1.0f, fabsf(d3dxWVPs[i].m[row][col])));
+				maxError = max(maxError, fabsf(invXposeWs[i].m[row][col] - d3dxInvXposeWs[i].m[row][col]) / max(1.0f, fabsf(d3dxInvXposeWs[i].m[row][col])));
+			}
+		}
+	}
+
+	dprintf("Application: %d world matrices, D3DX per draw %.2f ms, batched %.2f ms, max relative error %g\n", matrixCount, d3dxMs, batchMs, maxError);
+	assert(maxError < 1e-4f);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void Application::RunMeshDiagnostics()
+{
+	const int lodCount = 4;
+	const int generateRepeats = 1000;
+
+	size_t totalErrors = 0;
+	for (int lod = 0; lod < lodCount; ++lod)
+	{
+		// Same detail and minimums as CommonMesh uses for each shape
+		const unsigned cylinderSlices = GetLodDetail(16, lod, 3), cylinderStacks = GetLodDetail(4, lod, 1);
+		const unsigned sphereSlices = GetLodDetail(16, lod, 3), sphereStacks = GetLodDetail(16, lod, 2);
+		const unsigned torusSides = GetLodDetail(16, lod, 3), torusRings = GetLodDetail(32, lod, 3);
+
+		struct Shape
+		{
+			const char *pName;
+			std::function<bool(GeneratedMesh *)> generate;
+			size_t numVertices, numTriangles;
+		};
+		const Shape shapes[] =
+		{
+			{ "box", [](GeneratedMesh *pMesh) { return GenerateBoxMesh(pMesh, 1.0f, 2.0f, 3.0f); }, 24, 12 },
+			{ "cylinder", [=](GeneratedMesh *pMesh) { return GenerateCylinderMesh(pMesh, 1.0f, 0.5f, 2.0f, cylinderSlices, cylinderStacks); },
+				(cylinderStacks + 1) * cylinderSlices + 2 * (1 + cylinderSlices), 2 * cylinderSlices * cylinderStacks + 2 * cylinderSlices },
+			{ "sphere", [=](GeneratedMesh *pMesh) { return GenerateSphereMesh(pMesh, 1.0f, sphereSlices, sphereStacks); },
+				2 + (sphereStacks - 1) * sphereSlices, 2 * sphereSlices * (sphereStacks - 1) },
+			{ "torus", [=](GeneratedMesh *pMesh) { return GenerateTorusMesh(pMesh, 0.25f, 1.0f, torusSides, torusRings); },
+				torusSides * torusRings, 2 * torusSides * torusRings },
+		};
+
+		for (const Shape &shape : shapes)
+		{
+			GeneratedMesh mesh;
+			size_t numErrors = shape.generate(&mesh) ? CountGeneratedMeshErrors(mesh, shape.numVertices, shape.numTriangles) : 1;
+
+			auto start = std::chrono::high_resolution_clock::now();
+			for (int i = 0; i < generateRepeats; ++i)
+			{
+				shape.generate(&mesh);
+			}
+			const double generateUs = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count() / generateRepeats;
+
+			dprintf("Application: %s lod %d, %zu vertices, %zu triangles, %.2f us per generate, %zu errors\n",
+				shape.pName, lod, mesh.vertices.size(), mesh.indices.size() / 3, generateUs, numErrors);
+			totalErrors += numErrors;
+		}
+	}
+
+	assert(totalErrors == 0);
 }
 
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void Application::RunPhysicsDiagnostics()
+{
+	const int tickCount = 300;
+	const int settledTickCount = 60;
+	const int maxThreadCount = max(1, (int)std::thread::hardware_concurrency());
+
+	// The bodies are put back as they were afterwards
+	XMFLOAT3 savedPositions[SPHERE_COUNT];
+	XMFLOAT3 savedVelocities[SPHERE_COUNT];
+	bool savedActivity[SPHERE_COUNT];
+	for (int i = 0; i < SPHERE_COUNT; ++i)
+	{
+		XMStoreFloat3(&savedPositions[i], m_dynamicBodyPtrs[i]->getPosition());
+		XMStoreFloat3(&savedVelocities[i], m_dynamicBodyPtrs[i]->getVelocity());
+		savedActivity[i] = m_dynamicBodyPtrs[i]->isActive();
+	}
+
+	const float savedDeltaTime = m_deltaTime;
+	m_deltaTime = PhysicsDT;
+
+	// The passes split over threads only touch one body per item, so every thread count must end up 
+	// with exactly the positions the single threaded run did
+	XMFLOAT3 referencePositions[SPHERE_COUNT];
+	double singleThreadMs = 0.0;
+	int mismatchCount = 0;
+
+	for (int threadCount = 1; threadCount <= maxThreadCount; ++threadCount)
+	{
+		// Every body dropped onto the middle of the map from a grid, so they land on the terrain and each other
+		for (int i = 0; i < SPHERE_COUNT; ++i)
+		{
+			m_dynamicBodyPtrs[i]->setPosition(XMFLOAT3((i % 10 - 4.5f) * 2.5f, 15.0f + (i / 10) * 2.5f, ((i / 10) % 10 - 4.5f) * 2.5f));
+			m_dynamicBodyPtrs[i]->setVelocity(XMFLOAT3(0.0f, 0.0f, 0.0f));
+			m_dynamicBodyPtrs[i]->setActivityFlag(true);
+		}
+
+		JobSystem jobSystem(threadCount - 1);
+		PhysicsWorld physicsWorld(m_dynamicBodyPtrs, &jobSystem);
+
+		// Every pair that begins either ends or is still in the world's pair cache at the end
+		int beganCount = 0;
+		int endedCount = 0;
+		physicsWorld.setContactCallback([&beganCount, &endedCount](const ContactEvent& contactEvent)
+		{
+			beganCount += contactEvent.type == ContactBegin;
+			endedCount += contactEvent.type == ContactEnd;
+		});
+
+		const auto start = std::chrono::high_resolution_clock::now();
+		for (int tick = 0; tick < tickCount; ++tick)
+		{
+			physicsWorld.tick();
+		}
+		const double tickMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / tickCount;
+
+		// By now most of the bodies should have settled and gone to sleep, and cost next to nothing
+		const auto settledStart = std::chrono::high_resolution_clock::now();
+		for (int tick = 0; tick < settledTickCount; ++tick)
+		{
+			physicsWorld.tick();
+		}
+		const double settledTickMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - settledStart).count() / settledTickCount;
+
+		int sleepingCount = 0;
+		for (int i = 0; i < SPHERE_COUNT; ++i)
+		{
+			sleepingCount += m_dynamicBodyPtrs[i]->isSleeping();
+
+			XMFLOAT3 position;
+			XMStoreFloat3(&position, m_dynamicBodyPtrs[i]->getPosition());
+			if (threadCount == 1)
+			{
+				referencePositions[i] = position;
+			}
+			else if (memcmp(&position, &referencePositions[i], sizeof(XMFLOAT3)) != 0)
+			{
+				++mismatchCount;
+			}
+		}
+
+		if (threadCount == 1)
+		{
+			singleThreadMs = tickMs;
+		}
+
+		dprintf("Physics: %d bodies on %d threads, %.3f ms per tick, %.2fx the single threaded speed, then %.3f ms per tick with %d asleep\n",
+			SPHERE_COUNT, threadCount, tickMs, singleThreadMs / tickMs, settledTickMs, sleepingCount);
+		dprintf("Physics: %d contacts began, %d ended, %d still cached\n", beganCount, endedCount, physicsWorld.getContactPairCount());
+		assert(beganCount - endedCount == physicsWorld.getContactPairCount());
+	}
+
+	dprintf("Physics: %d mismatches against the single threaded positions\n", mismatchCount);
+	assert(mismatchCount == 0);
+
+	// The terrain contact pass on its own, with far more bodies than the world holds. Spheres sit on random
+	// faces, some touching and some not, and the contacts and face flags must match the single threaded run
+	const int querySphereCount = 100000;
+	const int faceCount = m_pCurrentHeightmap->GetFaceCount();
+	std::vector<XMFLOAT3> queryPositions(querySphereCount);
+	srand(1);
+	for (auto& position : queryPositions)
+	{
+		XMFLOAT3 faceVertices[FACE_NORM_VERTICES_COUNT];
+		m_pCurrentHeightmap->GetFaceVerticesByIndex((rand() * (RAND_MAX + 1) + rand()) % faceCount, faceVertices);
+		position = XMFLOAT3(faceVertices[3].x, faceVertices[3].y + (float)rand() / RAND_MAX * 2.0f - 0.5f, faceVertices[3].z);
+	}
+
+	std::vector<int> contactCounts(querySphereCount);
+	std::vector<int> referenceContactCounts;
+	BitArray referenceCollidedFaces;
+	referenceCollidedFaces.resize(faceCount);
+	double singleThreadQueryMs = 0.0;
+	int queryMismatchCount = 0;
+
+	for (int threadCount = 1; threadCount <= maxThreadCount; ++threadCount)
+	{
+		JobSystem jobSystem(threadCount - 1);
+		m_pCurrentHeightmap->ClearCollidedFaces();
+
+		const auto start = std::chrono::high_resolution_clock::now();
+		jobSystem.parallelFor(0, querySphereCount, PHYSICS_BODIES_PER_JOB, [&](int first, int end)
+		{
+			HeightMapManifold manifold;
+			for (int i = first; i < end; ++i)
+			{
+				m_pCurrentHeightmap->SphereCollision(XMLoadFloat3(&queryPositions[i]), 1.0f, manifold);
+				contactCounts[i] = manifold.contactCount;
+			}
+		});
+		const double queryMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		const BitArray& collidedFaces = m_pCurrentHeightmap->GetCollidedFaces();
+		if (threadCount == 1)
+		{
+			singleThreadQueryMs = queryMs;
+			referenceContactCounts = contactCounts;
+			referenceCollidedFaces.copyFrom(collidedFaces);
+		}
+		else
+		{
+			for (int i = 0; i < querySphereCount; ++i)
+			{
+				queryMismatchCount += contactCounts[i] != referenceContactCounts[i];
+			}
+
+			for (int w = 0; w < collidedFaces.getWordCount(); ++w)
+			{
+				queryMismatchCount += collidedFaces.getWord(w) != referenceCollidedFaces.getWord(w);
+			}
+		}
+
+		dprintf("Physics: terrain contacts for %d spheres on %d threads, %.3f ms, %.2fx the single threaded speed, %d faces hit\n",
+			querySphereCount, threadCount, queryMs, singleThreadQueryMs / queryMs, collidedFaces.count());
+	}
+
+	dprintf("Physics: %d terrain contact mismatches against the single threaded pass\n", queryMismatchCount);
+	assert(queryMismatchCount == 0);
+
+	for (int i = 0; i < SPHERE_COUNT; ++i)
+	{
+		m_dynamicBodyPtrs[i]->setPosition(savedPositions[i]);
+		m_dynamicBodyPtrs[i]->setVelocity(savedVelocities[i]);
+		m_dynamicBodyPtrs[i]->setActivityFlag(savedActivity[i]);
+	}
+	m_deltaTime = savedDeltaTime;
+	m_pCurrentHeightmap->ClearCollidedFaces();
+}
+#endif
+
 DynamicBody* Application::getNextAvailableBody()
 {
 	auto findResult = std::find_if(std::begin(m_dynamicBodyPtrs), std::end(m_dynamicBodyPtrs), [=](DynamicBody* pDynamicBody) -> bool
@@ -538,6 +1090,20 @@ DynamicBody* Application::getNextAvailableBody()
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
+void Application::wakeActiveBodies()
+{
+	for (auto& pDynamicBody : m_dynamicBodyPtrs)
+	{
+		if (pDynamicBody->isActive())
+		{
+			pDynamicBody->wake();
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
 int WINAPI WinMain(HINSTANCE, HINSTANCE, LPSTR, int)
 {
 	Application application;
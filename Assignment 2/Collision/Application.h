@@ -14,10 +14,18 @@
 #include "CommonMesh.h"
 #include "Macro.h"
 #include "DynamicBody.h"
+#include "BitArray.h"
+#include "TripleBuffer.h"
 
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <vector>
 
 class HeightMap;
+class JobSystem;
 
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
@@ -40,6 +48,26 @@ class HeightMap;
 
 class PhysicsWorld;
 
+// Everything the render thread needs from the simulation, copied out at the end of each physics tick
+struct PhysicsSnapshot
+{
+	// Bounding sphere (position in xyz, radius in w) of each active body after this tick and the 
+	// one before, in the same order, for the render thread to interpolate between
+	std::array<XMFLOAT4, SPHERE_COUNT> previousBodyBounds;
+	std::array<XMFLOAT4, SPHERE_COUNT> bodyBounds;
+	int bodyCount = 0;
+
+	// The heightmap being collided with, and its face colouring flags
+	int heightMapIndex = 0;
+	BitArray collidedFaces;
+	BitArray disabledFaces;
+
+	unsigned tickCount = 0;
+	// When the tick finished. How far the render thread is through the tick after, as a fraction 
+	// of PhysicsDT, is how far it draws the bodies from previousBodyBounds to bodyBounds
+	std::chrono::steady_clock::time_point publishTime;
+};
+
 class Application :
 	public CommonApp
 {
@@ -50,18 +78,42 @@ public:
 	static const float CollisionThreshold;
 	static const float CollisionPercentage;
 
+	// The heightmap the physics thread collides with. Physics thread only
 	HeightMap* GetHeightmap() { return m_pCurrentHeightmap; }
 
+	JobSystem* GetJobSystem() { return m_pJobSystem; }
+
 protected:
 
 	bool HandleStart();
 	void HandleStop();
 	void HandleUpdate();
+	void HandlePhysicsUpdate();
 	void HandleRender();
 
 private:
 
 	DynamicBody * getNextAvailableBody();
+	// Wakes every active body, for commands that change the terrain out from under sleeping ones
+	void wakeActiveBodies();
+
+	// Runs command at the start of the next physics tick. Bodies and heightmaps belong to the 
+	// physics thread, so input handling changes them through here rather than directly
+	void queuePhysicsCommand(std::function<void()> command);
+	void runPhysicsCommands();
+	// Copies the bodies and the current heightmap's face flags into a snapshot for the render thread
+	void publishSnapshot();
+
+#if TESTING_ENABLED
+	// Times recording whole frames with the commands going to a null backend, which also checks them
+	void RunRenderDiagnostics();
+	// Compares CommonApp::ComputeWorldMatrices against the D3DX per-draw calculation it replaced
+	void RunMatrixDiagnostics();
+	// Checks and times the procedural meshes at each level of detail
+	void RunMeshDiagnostics();
+	// Times the physics tick with every body active, on one thread and then on more up to the hardware's
+	void RunPhysicsDiagnostics();
+#endif
 
 	float m_frameCount;
 
@@ -72,15 +124,45 @@ private:
 
 	bool m_bWireframe;
 
+	// Draws go through CommonApp's draw queue, sorted by pipeline state
+	bool m_bSortDraws;
+
 	int m_cameraState;
 
 	HeightMap* m_heightMapPtrs[MAX_HEIGHTMAPS_COUNT] = { nullptr, nullptr, nullptr, nullptr };
 	HeightMap* m_pCurrentHeightmap = nullptr;
+	int m_heightMapIndex = 0;
 
 	PhysicsWorld* m_pPhysicsWorld;
 
+	// Shared by the physics tick and heightmap generation
+	JobSystem* m_pJobSystem = nullptr;
+
 	DynamicBody* m_dynamicBodyPtrs[SPHERE_COUNT];
 
+	// One Instance_Pos3fScale1f per active body, refilled every frame
+	ID3D11Buffer* m_pSphereInstanceBuffer = nullptr;
+
+	// Written by the physics thread, read by the render thread, neither waiting for the other
+	TripleBuffer<PhysicsSnapshot> m_snapshots;
+	unsigned m_physicsTickCount = 0;
+	// Each body's bounds as last published, by body index, for the next snapshot's previousBodyBounds
+	std::array<XMFLOAT4, SPHERE_COUNT> m_lastBodyBounds;
+	std::array<bool, SPHERE_COUNT> m_bBodyWasPublished;
+
+	std::mutex m_physicsCommandMutex;
+	std::vector<std::function<void()>> m_physicsCommands;
+	// Swapped with m_physicsCommands each tick, so the commands run without the lock held
+	std::vector<std::function<void()>> m_runningPhysicsCommands;
+
+	// Space held, read by the physics thread to pick m_deltaTime
+	std::atomic<bool> m_bSlowMotion{ false };
+
+	// The snapshot's bodies where they are at the time of the frame being drawn
+	std::array<XMFLOAT4, SPHERE_COUNT> m_interpolatedBodyBounds;
+	// Indices into m_interpolatedBodyBounds of the bodies that passed the frustum cull
+	std::array<int, SPHERE_COUNT> m_visibleBodies;
+
 	XMFLOAT3 mSpherePos;
 	XMFLOAT3 mSphereVel;
 	float mSphereSpeed;
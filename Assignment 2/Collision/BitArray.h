@@ -0,0 +1,110 @@
+#ifndef BIT_ARRAY_H
+#define BIT_ARRAY_H
+
+#include "Macro.h"
+
+#include <assert.h>
+#include <intrin.h>
+#include <stdint.h>
+#include <string.h>
+
+// Fixed size array of packed bits. Stored as 32 bit words so whole
+// arrays can be cleared, filled or counted a word at a time
+class BitArray
+{
+public:
+
+	BitArray() {}
+	~BitArray() { SAFE_FREE_ARR(m_pWords); }
+
+	// Discards the current contents, all bits start cleared
+	void resize(int bitCount)
+	{
+		assert(bitCount >= 0);
+		SAFE_FREE_ARR(m_pWords);
+
+		m_bitCount = bitCount;
+		m_wordCount = (bitCount + 31) / 32;
+		m_pWords = new uint32_t[m_wordCount];
+		clearAll();
+	}
+
+	bool test(int index) const
+	{
+		assert(index >= 0 && index < m_bitCount);
+		return (m_pWords[index >> 5] & (1u << (index & 31))) != 0;
+	}
+
+	void set(int index)
+	{
+		assert(index >= 0 && index < m_bitCount);
+		m_pWords[index >> 5] |= 1u << (index & 31);
+	}
+
+	// As set, but safe while other threads are setting bits in the same word
+	void setAtomic(int index)
+	{
+		assert(index >= 0 && index < m_bitCount);
+		_InterlockedOr(reinterpret_cast<volatile long*>(&m_pWords[index >> 5]), (long)(1u << (index & 31)));
+	}
+
+	void reset(int index)
+	{
+		assert(index >= 0 && index < m_bitCount);
+		m_pWords[index >> 5] &= ~(1u << (index & 31));
+	}
+
+	void clearAll()
+	{
+		memset(m_pWords, 0, m_wordCount * sizeof(uint32_t));
+	}
+
+	void setAll()
+	{
+		memset(m_pWords, 0xFF, m_wordCount * sizeof(uint32_t));
+
+		// Keep the bits past the end of the array clear so count() stays exact
+		if (m_bitCount & 31)
+		{
+			m_pWords[m_wordCount - 1] = (1u << (m_bitCount & 31)) - 1;
+		}
+	}
+
+	// Both arrays must be the same size
+	void copyFrom(const BitArray& other)
+	{
+		assert(other.m_bitCount == m_bitCount);
+		memcpy(m_pWords, other.m_pWords, m_wordCount * sizeof(uint32_t));
+	}
+
+	// Number of set bits
+	int count() const
+	{
+		int total = 0;
+		for (int w = 0; w < m_wordCount; ++w)
+		{
+			uint32_t v = m_pWords[w];
+			v = v - ((v >> 1) & 0x55555555u);
+			v = (v & 0x33333333u) + ((v >> 2) & 0x33333333u);
+			total += (int)((((v + (v >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24);
+		}
+		return total;
+	}
+
+	int size() const { return m_bitCount; }
+
+	uint32_t getWord(int wordIndex) const { return m_pWords[wordIndex]; }
+	void setWord(int wordIndex, uint32_t word) { m_pWords[wordIndex] = word; }
+	int getWordCount() const { return m_wordCount; }
+
+private:
+
+	BitArray(const BitArray&);
+	BitArray& operator=(const BitArray&);
+
+	uint32_t* m_pWords = nullptr;
+	int m_bitCount = 0;
+	int m_wordCount = 0;
+};
+
+#endif
@@ -0,0 +1,126 @@
+#include "ContactPairCache.h"
+
+#include <assert.h>
+
+ContactPairCache::ContactPairCache(int initialCapacity)
+{
+	int capacity = 8;
+	while (capacity < initialCapacity)
+	{
+		capacity *= 2;
+	}
+
+	allocateSlots(capacity);
+}
+
+ContactPairCache::~ContactPairCache()
+{
+	delete[] m_pSlots;
+}
+
+uint64_t ContactPairCache::makeKey(int bodyIndexA, int bodyIndexB)
+{
+	assert(bodyIndexA >= 0 && bodyIndexB >= 0);
+	if (bodyIndexA > bodyIndexB)
+	{
+		const int temp = bodyIndexA;
+		bodyIndexA = bodyIndexB;
+		bodyIndexB = temp;
+	}
+
+	return ((uint64_t)bodyIndexA << 32) | (uint32_t)bodyIndexB;
+}
+
+ContactPair* ContactPairCache::find(uint64_t key)
+{
+	assert(key != EMPTY_KEY);
+	for (int slot = getHomeSlot(key);; slot = (slot + 1) & (m_capacity - 1))
+	{
+		if (m_pSlots[slot].key == key)
+		{
+			return &m_pSlots[slot];
+		}
+
+		if (m_pSlots[slot].key == EMPTY_KEY)
+		{
+			return nullptr;
+		}
+	}
+}
+
+ContactPair& ContactPairCache::findOrAdd(uint64_t key, bool& bAdded)
+{
+	ContactPair* pPair = find(key);
+	if (pPair)
+	{
+		bAdded = false;
+		return *pPair;
+	}
+
+	if ((m_count + 1) * 4 > m_capacity * 3)
+	{
+		resize(m_capacity * 2);
+	}
+
+	ContactPair pair;
+	pair.key = key;
+	pair.accumulatedImpulse = 0.0f;
+	pair.age = 0;
+	pair.lastTouchedTick = -1;
+
+	bAdded = true;
+	return insertNew(pair);
+}
+
+void ContactPairCache::allocateSlots(int capacity)
+{
+	m_capacity = capacity;
+	m_pSlots = new ContactPair[m_capacity];
+	for (int slot = 0; slot < m_capacity; ++slot)
+	{
+		m_pSlots[slot].key = EMPTY_KEY;
+	}
+	m_count = 0;
+
+	m_hashShift = 64;
+	while ((1 << (64 - m_hashShift)) < m_capacity)
+	{
+		--m_hashShift;
+	}
+}
+
+int ContactPairCache::getHomeSlot(uint64_t key) const
+{
+	// Fibonacci hashing, taking the top bits so both body indices mix into the slot
+	return (int)((key * 0x9E3779B97F4A7C15ull) >> m_hashShift);
+}
+
+ContactPair& ContactPairCache::insertNew(const ContactPair& pair)
+{
+	int slot = getHomeSlot(pair.key);
+	while (m_pSlots[slot].key != EMPTY_KEY)
+	{
+		slot = (slot + 1) & (m_capacity - 1);
+	}
+
+	m_pSlots[slot] = pair;
+	++m_count;
+	return m_pSlots[slot];
+}
+
+void ContactPairCache::resize(int capacity)
+{
+	ContactPair* pOldSlots = m_pSlots;
+	const int oldCapacity = m_capacity;
+
+	allocateSlots(capacity);
+	for (int slot = 0; slot < oldCapacity; ++slot)
+	{
+		if (pOldSlots[slot].key != EMPTY_KEY)
+		{
+			insertNew(pOldSlots[slot]);
+		}
+	}
+
+	delete[] pOldSlots;
+}
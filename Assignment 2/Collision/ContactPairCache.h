@@ -0,0 +1,82 @@
+#ifndef CONTACT_PAIR_CACHE_H
+#define CONTACT_PAIR_CACHE_H
+
+#include <stdint.h>
+
+// What the physics world remembers about a pair of bodies while they're touching
+struct ContactPair
+{
+	uint64_t key;
+	// Total impulse along the contact normal at the end of the last tick it was solved
+	float accumulatedImpulse;
+	// Ticks the pair has been touching for, zero on the tick it began
+	int age;
+	// Tick the pair was last found touching on
+	int lastTouchedTick;
+};
+
+// Open-addressing hash table of contact pairs, keyed by the two body indices packed into 64 bits with 
+// the lower first. Linear probing, and the table doubles before it's three quarters full. Entries are 
+// only ever removed all together, by retain, which rebuilds the table from the ones kept, so there are
+// no tombstones to step over
+class ContactPairCache
+{
+public:
+
+	explicit ContactPairCache(int initialCapacity = 64);
+	~ContactPairCache();
+
+	static uint64_t makeKey(int bodyIndexA, int bodyIndexB);
+	static int getBodyIndexA(uint64_t key) { return (int)(key >> 32); }
+	static int getBodyIndexB(uint64_t key) { return (int)(uint32_t)key; }
+
+	// Null if the pair isn't in the table. Pointers last until the next findOrAdd or retain
+	ContactPair* find(uint64_t key);
+	// Adds the pair with no impulse and an age of zero if it isn't there already
+	ContactPair& findOrAdd(uint64_t key, bool& bAdded);
+
+	// Keeps the pairs keep returns true for and drops the rest
+	template<class Predicate>
+	void retain(Predicate keep);
+
+	int size() const { return m_count; }
+
+private:
+
+	static const uint64_t EMPTY_KEY = ~0ull;
+
+	// Replaces the slots with capacity empty ones, without freeing the old
+	void allocateSlots(int capacity);
+	int getHomeSlot(uint64_t key) const;
+	// Puts an entry known not to be in the table into the first free slot from its home
+	ContactPair& insertNew(const ContactPair& pair);
+	void resize(int capacity);
+
+	ContactPair* m_pSlots = nullptr;
+	int m_capacity = 0;// always a power of two
+	int m_hashShift = 64;// 64 less log2 of the capacity
+	int m_count = 0;
+
+	ContactPairCache(const ContactPairCache&);
+	ContactPairCache& operator=(const ContactPairCache&);
+};
+
+template<class Predicate>
+void ContactPairCache::retain(Predicate keep)
+{
+	ContactPair* pOldSlots = m_pSlots;
+	const int oldCapacity = m_capacity;
+
+	allocateSlots(oldCapacity);
+	for (int slot = 0; slot < oldCapacity; ++slot)
+	{
+		if (pOldSlots[slot].key != EMPTY_KEY && keep(pOldSlots[slot]))
+		{
+			insertNew(pOldSlots[slot]);
+		}
+	}
+
+	delete[] pOldSlots;
+}
+
+#endif
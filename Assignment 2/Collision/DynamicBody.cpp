@@ -15,10 +15,8 @@ DynamicBody::DynamicBody(CommonMesh* pCommonMesh, ColliderBase* pCollider)
 	assert(pCollider);
 	setVelocity(XMFLOAT3(0, 0, 0));
 	setPosition(XMFLOAT3(0, 0, 0));
-	m_pHeightMapCollision = new CollisionPOD;
-
-	memset(m_pHeightMapCollision, 0, sizeof(CollisionPOD));
-	m_pHeightMapCollision->pBodyA = this;
+	m_pHeightMapManifold = new HeightMapManifold;
+	m_pHeightMapManifold->pBody = this;
 
 	m_worldMatrix = XMMatrixTranslation(XMVectorGetX(m_position), XMVectorGetY(m_position), XMVectorGetZ(m_position));
 }
@@ -26,7 +24,7 @@ DynamicBody::DynamicBody(CommonMesh* pCommonMesh, ColliderBase* pCollider)
 DynamicBody::~DynamicBody()
 {
 	SAFE_FREE(m_pBaseCollider);
-	SAFE_FREE(m_pHeightMapCollision);
+	SAFE_FREE(m_pHeightMapManifold);
 }
 
 void DynamicBody::updateDynamicBody(float dt)
@@ -35,7 +33,6 @@ void DynamicBody::updateDynamicBody(float dt)
 	{
 		return;
 	}
-	checkHeightMapCollision();
 
 	//m_velocity += dt * XMVectorSet(0.0f, G_VALUE, 0.0f, 0.0f);
 	m_velocity += (dt / 2.0f) * XMVectorSet(0.0f, G_VALUE, 0.0f, 0.0f); // step acceleration and apply this change to the velocity 
@@ -67,6 +64,11 @@ void DynamicBody::setVelocity(const DirectX::XMFLOAT3 & vel)
 
 void DynamicBody::applyImpulse(const XMFLOAT3 & impulse)
 {
+	if (m_bIsSleeping)
+	{
+		wake();
+	}
+
 	XMVECTOR impulseVec = XMVectorSet(impulse.x, impulse.y, impulse.z, 0.0f);
 	XMVECTOR vel = getVelocity();
 	vel += (m_invMass * impulseVec);
@@ -88,6 +90,33 @@ void DynamicBody::setMass(float mass)
 	}
 }
 
+void DynamicBody::sleep()
+{
+	m_bIsSleeping = true;
+	m_velocity = XMVectorZero();
+
+	// The contacts found before sleeping will be out of date by the time it wakes
+	m_bDidHeightmapCollide = false;
+}
+
+void DynamicBody::wake()
+{
+	m_bIsSleeping = false;
+	m_stillTicks = 0;
+}
+
+void DynamicBody::updateStillTicks(float sleepEnergy)
+{
+	if (0.5f * m_mass * XMVectorGetX(XMVector3LengthSq(m_velocity)) < sleepEnergy)
+	{
+		++m_stillTicks;
+	}
+	else
+	{
+		m_stillTicks = 0;
+	}
+}
+
 void DynamicBody::checkHeightMapCollision()
 {
 	float e = 0.4f;
@@ -119,25 +148,14 @@ void DynamicBody::checkHeightMapCollision()
 	}
 	case Sphere:
 	{
-		XMVECTOR colPos;
-		XMVECTOR colNormal;
 		float radius = static_cast<SphereCollider*>(m_pBaseCollider)->radius;
-		float penetration;
-		m_bDidHeightmapCollide = pCurrentHeightmap->SphereCollision(m_position, radius, colNormal, penetration);
-
-		if (m_bDidHeightmapCollide)
-		{
-			m_pHeightMapCollision->normal = colNormal;
-			m_pHeightMapCollision->penetration = penetration;
-
-			return;
-		}
+		m_bDidHeightmapCollide = pCurrentHeightmap->SphereCollision(m_position, radius, *m_pHeightMapManifold);
 		break;
 	}
 	}
 }
 
-const CollisionPOD * const DynamicBody::getHeightmapCollisionData() const
+const HeightMapManifold * const DynamicBody::getHeightmapCollisionData() const
 {
-	return m_pHeightMapCollision;
+	return m_pHeightMapManifold;
 }
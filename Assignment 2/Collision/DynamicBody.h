@@ -9,7 +9,7 @@
 class CommonMesh;
 class HeightMap;
 
-struct CollisionPOD;
+struct HeightMapManifold;
 
 enum ColliderTypes3D
 {
@@ -45,7 +45,7 @@ struct SphereCollider : public ColliderBase
 // and provide a pointer to them when queried
 // also provides a stack of all bodies which need to be drawn
 // ignoring ones not currently active
-// spheres at rest for a certain duration will despawn 
+// spheres at rest for a certain duration are put to sleep
 // (DynamicBody is responsible for freeing the collider)
 class DX_ALIGNED DynamicBody
 {
@@ -57,6 +57,7 @@ public:
 	OP_NEW;
 	OP_DEL;
 
+	// Steps the body on by dt. The heightmap contacts are found separately, by checkHeightMapCollision
 	void updateDynamicBody(float dt);
 
 	void setPosition(const DirectX::XMVECTOR& pos);
@@ -75,7 +76,8 @@ public:
 	CommonMesh* const getCommonMesh() { return m_pCommonMesh; }
 	ColliderBase* const getColliderBase() { return m_pBaseCollider; }
 
-	void setActivityFlag(bool bIsActive) { m_bIsActive = bIsActive; }
+	// Activating or deactivating a body also wakes it
+	void setActivityFlag(bool bIsActive) { m_bIsActive = bIsActive; wake(); }
 
 	bool isActive() const { return m_bIsActive; }
 
@@ -87,10 +89,24 @@ public:
 
 	void checkHeightMapCollision();
 
-	const CollisionPOD* const getHeightmapCollisionData() const;
+	const HeightMapManifold* const getHeightmapCollisionData() const;
 
 	bool didCollideWithHeightmap() const { return m_bDidHeightmapCollide; }
 
+	// Sleeping bodies are left where they are by the physics world until an awake body touches 
+	// them, an impulse is applied or they're woken here
+	bool isSleeping() const { return m_bIsSleeping; }
+	void sleep();
+	void wake();
+
+	// Counts the ticks in a row the body has ended with less kinetic energy than sleepEnergy, reset on waking
+	void updateStillTicks(float sleepEnergy);
+	int getStillTicks() const { return m_stillTicks; }
+
+	// Slot in the physics world's body array, for per body scratch data kept by the world
+	void setBodyIndex(int bodyIndex) { m_bodyIndex = bodyIndex; }
+	int getBodyIndex() const { return m_bodyIndex; }
+
 private:
 
 	DirectX::XMVECTOR m_velocity;
@@ -101,7 +117,7 @@ private:
 	CommonMesh* m_pCommonMesh;
 	HeightMap* m_pHeightMap;
 	ColliderBase* m_pBaseCollider;
-	CollisionPOD* m_pHeightMapCollision;
+	HeightMapManifold* m_pHeightMapManifold;
 
 	bool m_bIsActive;
 
@@ -109,6 +125,11 @@ private:
 	float m_invMass = 1.0f / m_mass;
 
 	bool m_bDidHeightmapCollide = false;
+
+	int m_bodyIndex = -1;
+
+	bool m_bIsSleeping = false;
+	int m_stillTicks = 0;
 };
 
 #endif // !DYNAMIC_BODY_H
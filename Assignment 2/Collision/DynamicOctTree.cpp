@@ -45,7 +45,7 @@ void insert_into_dynamic_tree(DTreeNode * pNode, DynamicBody * pDynamicBody, int
 	//to mititgate converting data structures memcpy the struct into a float
 	//to allow index based iteration
 	memcpy_s(objPos, sizeof(objPos), &pDynamicBody->getPosition(), sizeof(XMFLOAT3));
-	memcpy_s(objPos, sizeof(objPos), &pDynamicBody->getPosition(), sizeof(XMFLOAT3));
+	memcpy_s(nodePos, sizeof(nodePos), &pNode->centre, sizeof(XMFLOAT3));
 
 	const float radius = static_cast<SphereCollider* const>(pDynamicBody->getColliderBase())->radius;
 
@@ -126,6 +126,56 @@ void test_all_collisions(DTreeNode * pNode, std::stack<CollisionPOD>& collisionR
 	depth--;
 }
 
+void test_collisions_with_tree(DTreeNode * pNode, DynamicBody * pDynamicBody, std::stack<CollisionPOD>& collisionResults)
+{
+	if (!pNode)
+	{
+		return;
+	}
+
+	for (DTreeObject* pObj = pNode->pObjList; pObj; pObj = pObj->pNextObj)
+	{
+		if (pObj->pDynBody == pDynamicBody)
+		{
+			continue;
+		}
+
+		CollisionPOD pod;
+		pod.pBodyA = pObj->pDynBody;
+		pod.pBodyB = pDynamicBody;
+		if (SpherevsSpherePaired(pod))
+		{
+			collisionResults.push(pod);
+		}
+	}
+
+	XMFLOAT3 objPos;
+	XMStoreFloat3(&objPos, pDynamicBody->getPosition());
+	const float radius = static_cast<SphereCollider* const>(pDynamicBody->getColliderBase())->radius;
+	const float delta[3] = { objPos.x - pNode->centre.x, objPos.y - pNode->centre.y, objPos.z - pNode->centre.z };
+
+	for (int i = 0; i < 8; ++i)
+	{
+		if (!pNode->pChildren[i])
+		{
+			continue;
+		}
+
+		// A child only holds bodies clear of the node's planes on its side of each, so the body can only
+		// touch them if it reaches past the planes that side of it
+		bool bReachable = true;
+		for (int axis = 0; axis < 3 && bReachable; ++axis)
+		{
+			bReachable = (i & (1 << axis)) ? delta[axis] > -radius : delta[axis] < radius;
+		}
+
+		if (bReachable)
+		{
+			test_collisions_with_tree(pNode->pChildren[i], pDynamicBody, collisionResults);
+		}
+	}
+}
+
 void cleanup_dynamic_tree(DTreeNode* pNode)
 {
 	if (!pNode)
@@ -29,6 +29,9 @@ void insert_into_dynamic_tree(DTreeNode* pNode, DynamicBody* pDynamicBody, int m
 //test all collisions and produce a stack of collision pairs
 void test_all_collisions(DTreeNode* pNode, std::stack<CollisionPOD>& collisionResults);
 
+//test one body, which needn't be in the tree, against every body in it
+void test_collisions_with_tree(DTreeNode* pNode, DynamicBody* pDynamicBody, std::stack<CollisionPOD>& collisionResults);
+
 //clean up dynami tree nodes
 void cleanup_dynamic_tree(DTreeNode* pNode);
 
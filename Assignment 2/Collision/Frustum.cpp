@@ -0,0 +1,215 @@
+#include "Frustum.h"
+#include "Application.h"
+#include <chrono>
+#include <vector>
+
+Frustum::Frustum(const XMMATRIX& viewProjection)
+{
+	// Gribb/Hartmann: with row vectors, clip space coordinate i is the dot product with column i,
+	// and each plane is a sum or difference of columns. D3D clips z to [0, w], so near is column 2 alone
+	const XMMATRIX columns = XMMatrixTranspose(viewProjection);
+
+	const XMVECTOR unnormalised[FRUSTUM_PLANE_COUNT] = {
+		XMVectorAdd(columns.r[3], columns.r[0]),		// left
+		XMVectorSubtract(columns.r[3], columns.r[0]),	// right
+		XMVectorAdd(columns.r[3], columns.r[1]),		// bottom
+		XMVectorSubtract(columns.r[3], columns.r[1]),	// top
+		columns.r[2],									// near
+		XMVectorSubtract(columns.r[3], columns.r[2]),	// far
+	};
+
+	for (int i = 0; i < FRUSTUM_PLANE_COUNT; ++i)
+	{
+		const XMVECTOR plane = XMVectorDivide(unnormalised[i], XMVector3Length(unnormalised[i]));
+		XMStoreFloat4(&planes[i], plane);
+
+		planeX[i] = XMVectorSplatX(plane);
+		planeY[i] = XMVectorSplatY(plane);
+		planeZ[i] = XMVectorSplatZ(plane);
+		planeW[i] = XMVectorSplatW(plane);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+// Bit n set if sphere n of the four is at least partly inside
+static int CullSphereMask(const Frustum& frustum, const XMFLOAT4* pSpheres)
+{
+	// Four AoS spheres transposed to x, y, z and radius rows
+	const XMMATRIX soa = XMMatrixTranspose(XMMATRIX(XMLoadFloat4(&pSpheres[0]), XMLoadFloat4(&pSpheres[1]), XMLoadFloat4(&pSpheres[2]), XMLoadFloat4(&pSpheres[3])));
+	const XMVECTOR negRadius = XMVectorNegate(soa.r[3]);
+
+	XMVECTOR inside = XMVectorTrueInt();
+	for (int i = 0; i < FRUSTUM_PLANE_COUNT; ++i)
+	{
+		XMVECTOR dist = XMVectorMultiplyAdd(frustum.planeX[i], soa.r[0], frustum.planeW[i]);
+		dist = XMVectorMultiplyAdd(frustum.planeY[i], soa.r[1], dist);
+		dist = XMVectorMultiplyAdd(frustum.planeZ[i], soa.r[2], dist);
+
+		inside = XMVectorAndInt(inside, XMVectorGreaterOrEqual(dist, negRadius));
+	}
+
+	return _mm_movemask_ps(inside);
+}
+
+// Bit n set if box n of the four is at least partly inside
+static int CullBoxMask(const Frustum& frustum, const XMFLOAT4* pCentres, const XMFLOAT4* pExtents)
+{
+	const XMMATRIX centres = XMMatrixTranspose(XMMATRIX(XMLoadFloat4(&pCentres[0]), XMLoadFloat4(&pCentres[1]), XMLoadFloat4(&pCentres[2]), XMLoadFloat4(&pCentres[3])));
+	const XMMATRIX extents = XMMatrixTranspose(XMMATRIX(XMLoadFloat4(&pExtents[0]), XMLoadFloat4(&pExtents[1]), XMLoadFloat4(&pExtents[2]), XMLoadFloat4(&pExtents[3])));
+
+	XMVECTOR inside = XMVectorTrueInt();
+	for (int i = 0; i < FRUSTUM_PLANE_COUNT; ++i)
+	{
+		XMVECTOR dist = XMVectorMultiplyAdd(frustum.planeX[i], centres.r[0], frustum.planeW[i]);
+		dist = XMVectorMultiplyAdd(frustum.planeY[i], centres.r[1], dist);
+		dist = XMVectorMultiplyAdd(frustum.planeZ[i], centres.r[2], dist);
+
+		// Projected radius of the box onto the plane normal
+		XMVECTOR radius = XMVectorMultiply(XMVectorAbs(frustum.planeX[i]), extents.r[0]);
+		radius = XMVectorMultiplyAdd(XMVectorAbs(frustum.planeY[i]), extents.r[1], radius);
+		radius = XMVectorMultiplyAdd(XMVectorAbs(frustum.planeZ[i]), extents.r[2], radius);
+
+		inside = XMVectorAndInt(inside, XMVectorGreaterOrEqual(dist, XMVectorNegate(radius)));
+	}
+
+	return _mm_movemask_ps(inside);
+}
+
+// Appends base + n for each bit n set in mask, without branching on the bits
+static int CompactIndices(int mask, int laneCount, int base, int* pVisibleIndices)
+{
+	int visibleCount = 0;
+	for (int lane = 0; lane < laneCount; ++lane)
+	{
+		pVisibleIndices[visibleCount] = base + lane;
+		visibleCount += (mask >> lane) & 1;
+	}
+	return visibleCount;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+int CullSpheres(const Frustum& frustum, const XMFLOAT4* pSpheres, int count, int* pVisibleIndices)
+{
+	int visibleCount = 0;
+	int first = 0;
+
+	for (; first + FRUSTUM_SPHERE_BATCH <= count; first += FRUSTUM_SPHERE_BATCH)
+	{
+		const int mask = CullSphereMask(frustum, &pSpheres[first]) | (CullSphereMask(frustum, &pSpheres[first + 4]) << 4);
+		visibleCount += CompactIndices(mask, FRUSTUM_SPHERE_BATCH, first, &pVisibleIndices[visibleCount]);
+	}
+
+	if (first < count)
+	{
+		// The remainder is padded out to a whole batch, and the padding's lanes masked off
+		XMFLOAT4 padded[FRUSTUM_SPHERE_BATCH] = {};
+		const int remaining = count - first;
+		for (int i = 0; i < remaining; ++i)
+		{
+			padded[i] = pSpheres[first + i];
+		}
+
+		const int mask = (CullSphereMask(frustum, &padded[0]) | (CullSphereMask(frustum, &padded[4]) << 4)) & ((1 << remaining) - 1);
+		visibleCount += CompactIndices(mask, remaining, first, &pVisibleIndices[visibleCount]);
+	}
+
+	return visibleCount;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+int CullBoxes(const Frustum& frustum, const XMFLOAT4* pCentres, const XMFLOAT4* pExtents, int count, int* pVisibleIndices)
+{
+	int visibleCount = 0;
+	int first = 0;
+
+	for (; first + FRUSTUM_BOX_BATCH <= count; first += FRUSTUM_BOX_BATCH)
+	{
+		const int mask = CullBoxMask(frustum, &pCentres[first], &pExtents[first]);
+		visibleCount += CompactIndices(mask, FRUSTUM_BOX_BATCH, first, &pVisibleIndices[visibleCount]);
+	}
+
+	if (first < count)
+	{
+		XMFLOAT4 paddedCentres[FRUSTUM_BOX_BATCH] = {};
+		XMFLOAT4 paddedExtents[FRUSTUM_BOX_BATCH] = {};
+		const int remaining = count - first;
+		for (int i = 0; i < remaining; ++i)
+		{
+			paddedCentres[i] = pCentres[first + i];
+			paddedExtents[i] = pExtents[first + i];
+		}
+
+		const int mask = CullBoxMask(frustum, paddedCentres, paddedExtents) & ((1 << remaining) - 1);
+		visibleCount += CompactIndices(mask, remaining, first, &pVisibleIndices[visibleCount]);
+	}
+
+	return visibleCount;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+#if TESTING_ENABLED
+void RunFrustumDiagnostics()
+{
+	const int sphereCount = 1000000;
+	const int repeats = 10;
+
+	// The rotating camera's projection, looking across a field of spheres much larger than the view
+	const Frustum frustum(XMMatrixMultiply(XMMatrixLookAtLH(XMVectorSet(0.0f, 50.0f, -50.0f, 0.0f), XMVectorZero(), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)),
+		XMMatrixPerspectiveFovLH(XM_PI / 7, 2, 1.5f, 5000.0f)));
+
+	std::vector<XMFLOAT4> spheres(sphereCount);
+	srand(1);
+	for (auto& sphere : spheres)
+	{
+		sphere.x = (rand() / (float)RAND_MAX - 0.5f) * 2000.0f;
+		sphere.y = (rand() / (float)RAND_MAX - 0.5f) * 200.0f;
+		sphere.z = (rand() / (float)RAND_MAX - 0.5f) * 2000.0f;
+		sphere.w = 0.5f + rand() / (float)RAND_MAX * 2.0f;
+	}
+
+	// Reference, one sphere and one plane at a time
+	std::vector<int> expected;
+	for (int i = 0; i < sphereCount; ++i)
+	{
+		bool bInside = true;
+		for (int p = 0; p < FRUSTUM_PLANE_COUNT && bInside; ++p)
+		{
+			const XMFLOAT4& plane = frustum.planes[p];
+			// Summed in the same order as CullSphereMask, so spheres touching a plane agree too
+			const float dist = ((plane.x * spheres[i].x + plane.w) + plane.y * spheres[i].y) + plane.z * spheres[i].z;
+			bInside = dist >= -spheres[i].w;
+		}
+		if (bInside)
+		{
+			expected.push_back(i);
+		}
+	}
+
+	std::vector<int> visible(sphereCount);
+	int visibleCount = 0;
+	const auto start = std::chrono::high_resolution_clock::now();
+	for (int repeat = 0; repeat < repeats; ++repeat)
+	{
+		visibleCount = CullSpheres(frustum, &spheres[0], sphereCount, &visible[0]);
+	}
+	const double cullMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / repeats;
+
+	int mismatches = abs(visibleCount - (int)expected.size());
+	for (int i = 0; i < min(visibleCount, (int)expected.size()); ++i)
+	{
+		mismatches += visible[i] != expected[i];
+	}
+
+	dprintf("Frustum: culled %d spheres in %.3f ms (%.2f ns each), %d visible, %d mismatches against the reference\n",
+		sphereCount, cullMs, cullMs * 1e6 / sphereCount, visibleCount, mismatches);
+	assert(mismatches == 0);
+}
+#endif
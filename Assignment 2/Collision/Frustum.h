@@ -0,0 +1,45 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <DirectXMath.h>
+
+#include "Macro.h"
+
+#define FRUSTUM_PLANE_COUNT 6
+
+// Spheres tested per step of CullSpheres, as two four wide SoA halves
+#define FRUSTUM_SPHERE_BATCH 8
+// Boxes tested per step of CullBoxes
+#define FRUSTUM_BOX_BATCH 4
+
+// The clip planes of a view-projection matrix, normalised and facing inwards,
+// so a point p is inside when dot(plane.xyz, p) + plane.w >= 0 for all six
+struct DX_ALIGNED Frustum
+{
+	OP_NEW;
+	OP_DEL;
+
+	explicit Frustum(const DirectX::XMMATRIX& viewProjection);
+
+	DirectX::XMFLOAT4 planes[FRUSTUM_PLANE_COUNT];
+
+	// Each plane component splatted, for testing four things against a plane at once
+	DirectX::XMVECTOR planeX[FRUSTUM_PLANE_COUNT];
+	DirectX::XMVECTOR planeY[FRUSTUM_PLANE_COUNT];
+	DirectX::XMVECTOR planeZ[FRUSTUM_PLANE_COUNT];
+	DirectX::XMVECTOR planeW[FRUSTUM_PLANE_COUNT];
+};
+
+// Writes the indices of the spheres (centre in xyz, radius in w) that are at least partly
+// inside the frustum to pVisibleIndices, in order, and returns how many there were
+int CullSpheres(const Frustum& frustum, const DirectX::XMFLOAT4* pSpheres, int count, int* pVisibleIndices);
+
+// As CullSpheres, for axis aligned boxes given as centres and half extents (w unused)
+int CullBoxes(const Frustum& frustum, const DirectX::XMFLOAT4* pCentres, const DirectX::XMFLOAT4* pExtents, int count, int* pVisibleIndices);
+
+#if TESTING_ENABLED
+// Checks CullSpheres against a one sphere at a time reference and times it at a million spheres
+void RunFrustumDiagnostics();
+#endif
+
+#endif
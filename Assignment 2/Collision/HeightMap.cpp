@@ -1,6 +1,173 @@
 #include "HeightMap.h"
+#include "Frustum.h"
+#include "JobSystem.h"
+#include "PhysicsWorld.h"
+#include "Profiler.h"
+#include "XMVectorUtils.h"
 
+#include <float.h>
 #include <stack>
+#include <vector>
+
+static const float INV_SQRT2 = 0.70710678f;
+
+// The original ray test slid the hit point this far back along the ray before checking it against 
+// the edge planes through the ray origin. Beyond this distance that accepts back facing hits rather 
+// than front facing ones, and the batched test keeps the same rule so hits are unchanged
+static const float RAY_BACKOFF_DISTANCE = 2.0f;
+
+// Contacts whose normals are closer than this (cosine of ~18 degrees) are treated as the same contact
+static const float MANIFOLD_MERGE_COS = 0.95f;
+
+static_assert((sizeof(Vertex_Pos3fColour4ubNormal3fTex2f) * VERTEX_STREAM_BATCH) % 64 == 0, "Streamed vertex batches must be whole cache lines");
+
+// Adds a contact to the manifold, merging it into an existing contact with a near identical normal
+// and evicting the shallowest contact once the manifold is full
+static void add_manifold_contact(HeightMapManifold& manifold, const XMVECTOR& normal, float penetration)
+{
+	for (int i = 0; i < manifold.contactCount; ++i)
+	{
+		if (XMVectorGetX(XMVector3Dot(manifold.normals[i], normal)) > MANIFOLD_MERGE_COS)
+		{
+			manifold.normals[i] = XMVector3Normalize(manifold.normals[i] + normal);
+			manifold.penetrations[i] = max(manifold.penetrations[i], penetration);
+			return;
+		}
+	}
+
+	int slot = manifold.contactCount;
+	if (slot == MAX_MANIFOLD_CONTACTS)
+	{
+		slot = 0;
+		for (int i = 1; i < MAX_MANIFOLD_CONTACTS; ++i)
+		{
+			if (manifold.penetrations[i] < manifold.penetrations[slot])
+			{
+				slot = i;
+			}
+		}
+
+		if (manifold.penetrations[slot] >= penetration)
+		{
+			return;
+		}
+	}
+	else
+	{
+		++manifold.contactCount;
+	}
+
+	manifold.normals[slot] = normal;
+	manifold.penetrations[slot] = penetration;
+}
+
+// Insertion sort, the manifold holds at most MAX_MANIFOLD_CONTACTS entries
+static void sort_manifold_deepest_first(HeightMapManifold& manifold)
+{
+	for (int i = 1; i < manifold.contactCount; ++i)
+	{
+		const XMVECTOR normal = manifold.normals[i];
+		const float penetration = manifold.penetrations[i];
+		int j = i - 1;
+		while (j >= 0 && manifold.penetrations[j] < penetration)
+		{
+			manifold.normals[j + 1] = manifold.normals[j];
+			manifold.penetrations[j + 1] = manifold.penetrations[j];
+			--j;
+		}
+		manifold.normals[j + 1] = normal;
+		manifold.penetrations[j + 1] = penetration;
+	}
+}
+
+static inline XMVECTOR dot3_soa(const XMVECTOR a[3], const XMVECTOR b[3])
+{
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static inline void select3_soa(XMVECTOR result[3], const XMVECTOR a[3], const XMVECTOR& scale, const XMVECTOR dir[3], const XMVECTOR& mask)
+{
+	for (int c = 0; c < 3; ++c)
+	{
+		result[c] = XMVectorSelect(result[c], a[c] + scale * dir[c], mask);
+	}
+}
+
+// closestPtPointTriangle for four triangles at once, one per lane. Every Voronoi region is evaluated 
+// and the result picked with select masks, applied in reverse order of the scalar version's early 
+// outs so the first region that matches there still wins. Returns the squared distance from p to 
+// the closest point on each triangle
+static XMVECTOR closest_pt_point_triangle_dist_sq_x4(const XMVECTOR p[3], const XMVECTOR a[3], const XMVECTOR b[3], const XMVECTOR c[3])
+{
+	const XMVECTOR zero = XMVectorZero();
+
+	XMVECTOR ab[3], ac[3], bc[3], ap[3], bp[3], cp[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		ab[i] = b[i] - a[i];
+		ac[i] = c[i] - a[i];
+		bc[i] = c[i] - b[i];
+		ap[i] = p[i] - a[i];
+		bp[i] = p[i] - b[i];
+		cp[i] = p[i] - c[i];
+	}
+
+	const XMVECTOR d1 = dot3_soa(ab, ap);
+	const XMVECTOR d2 = dot3_soa(ac, ap);
+	const XMVECTOR d3 = dot3_soa(ab, bp);
+	const XMVECTOR d4 = dot3_soa(ac, bp);
+	const XMVECTOR d5 = dot3_soa(ab, cp);
+	const XMVECTOR d6 = dot3_soa(ac, cp);
+
+	const XMVECTOR va = d3 * d6 - d5 * d4;
+	const XMVECTOR vb = d5 * d2 - d1 * d6;
+	const XMVECTOR vc = d1 * d4 - d3 * d2;
+
+	// Inside the face
+	const XMVECTOR denom = XMVectorReciprocal(va + vb + vc);
+	const XMVECTOR faceV = vb * denom;
+	const XMVECTOR faceW = vc * denom;
+
+	XMVECTOR result[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		result[i] = a[i] + ab[i] * faceV + ac[i] * faceW;
+	}
+
+	// Edge BC
+	const XMVECTOR d43 = d4 - d3;
+	const XMVECTOR d56 = d5 - d6;
+	XMVECTOR mask = XMVectorAndInt(XMVectorLessOrEqual(va, zero), XMVectorAndInt(XMVectorGreaterOrEqual(d43, zero), XMVectorGreaterOrEqual(d56, zero)));
+	select3_soa(result, b, d43 / (d43 + d56), bc, mask);
+
+	// Edge AC
+	mask = XMVectorAndInt(XMVectorLessOrEqual(vb, zero), XMVectorAndInt(XMVectorGreaterOrEqual(d2, zero), XMVectorLessOrEqual(d6, zero)));
+	select3_soa(result, a, d2 / (d2 - d6), ac, mask);
+
+	// Vertex C
+	mask = XMVectorAndInt(XMVectorGreaterOrEqual(d6, zero), XMVectorLessOrEqual(d5, d6));
+	select3_soa(result, c, zero, ac, mask);
+
+	// Edge AB
+	mask = XMVectorAndInt(XMVectorLessOrEqual(vc, zero), XMVectorAndInt(XMVectorGreaterOrEqual(d1, zero), XMVectorLessOrEqual(d3, zero)));
+	select3_soa(result, a, d1 / (d1 - d3), ab, mask);
+
+	// Vertex B
+	mask = XMVectorAndInt(XMVectorGreaterOrEqual(d3, zero), XMVectorLessOrEqual(d4, d3));
+	select3_soa(result, b, zero, ab, mask);
+
+	// Vertex A
+	mask = XMVectorAndInt(XMVectorLessOrEqual(d1, zero), XMVectorLessOrEqual(d2, zero));
+	select3_soa(result, a, zero, ab, mask);
+
+	XMVECTOR offset[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		offset[i] = result[i] - p[i];
+	}
+
+	return dot3_soa(offset, offset);
+}
 
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
@@ -10,21 +177,28 @@ HeightMap::HeightMap(char* filename, float gridSize, float heightRange)
 	LoadHeightMap(filename, gridSize, heightRange);
 
 	m_pHeightMapBuffer = NULL;
+	m_pHeightMapIndexBuffer = NULL;
+	m_pFaceFlagBuffer = NULL;
+	m_pFaceFlagView = NULL;
 
 	m_pPSCBuffer = NULL;
 	m_pVSCBuffer = NULL;
+	m_psCBufferSizeBytes = 0;
+	m_vsCBufferSizeBytes = 0;
 
 	m_HeightMapFaceCount = (m_HeightMapLength - 1) * (m_HeightMapWidth - 1) * 2;
 
 	m_pFaceData = new FaceCollisionData[m_HeightMapFaceCount];
+	m_collidedFaces.resize(m_HeightMapFaceCount);
+	m_disabledFaces.resize(m_HeightMapFaceCount);
+	m_shadedFaces.resize(m_HeightMapFaceCount);
+	m_uploadedCollidedFaces.resize(m_HeightMapFaceCount);
+	m_uploadedDisabledFaces.resize(m_HeightMapFaceCount);
 
-	for (int f = 0; f < m_HeightMapFaceCount; ++f)
-	{
-		m_pFaceData[f].m_bDisabled = false;
-		m_pFaceData[f].m_bCollided = false;
-	}
+	m_faceRayBlockCount = (m_HeightMapFaceCount + 3) / 4;
+	m_pFaceRayBlocks = new FaceRayBlock[m_faceRayBlockCount];
 
-	m_HeightMapVtxCount = m_HeightMapFaceCount * 3;
+	m_HeightMapVtxCount = m_HeightMapWidth * m_HeightMapLength;
 
 	for (size_t i = 0; i < NUM_TEXTURE_FILES; ++i)
 	{
@@ -34,11 +208,46 @@ HeightMap::HeightMap(char* filename, float gridSize, float heightRange)
 
 	m_pSamplerState = NULL;
 
-	m_pHeightMapBuffer = CreateDynamicVertexBuffer(Application::s_pApp->GetDevice(), sizeof Vertex_Pos3fColour4ubNormal3fTex2f * m_HeightMapVtxCount, 0);
-
 	BuildCollisionData();
 	//DisableBelowLevel(Y_DISABLE_VALUE);
-	RebuildVertexData();
+
+	ID3D11Device* pDevice = Application::s_pApp->GetDevice();
+
+	// The mesh itself never changes after loading
+	BuildChunks();
+
+	const int totalVtxCount = m_HeightMapVtxCount + m_skirtVtxCount;
+	Vertex_Pos3fColour4ubNormal3fTex2f* pMapVtxs = static_cast<Vertex_Pos3fColour4ubNormal3fTex2f*>(_mm_malloc(sizeof(Vertex_Pos3fColour4ubNormal3fTex2f) * totalVtxCount, 64));
+	GenerateVertexData(pMapVtxs);
+	GenerateSkirtVertices(pMapVtxs);
+	m_pHeightMapBuffer = CreateImmutableVertexBuffer(pDevice, sizeof(Vertex_Pos3fColour4ubNormal3fTex2f) * totalVtxCount, pMapVtxs);
+	_mm_free(pMapVtxs);
+
+	uint32_t* pIndices = new uint32_t[m_HeightMapIndexCount];
+	GenerateChunkLods(pIndices);
+	m_pHeightMapIndexBuffer = CreateImmutableIndexBuffer(pDevice, sizeof(uint32_t) * m_HeightMapIndexCount, pIndices);
+	SAFE_FREE_ARR(pIndices);
+
+	// Default usage, as after this only the changed ranges are copied up with UpdateSubresource
+	m_pFaceFlags = new uint8_t[m_HeightMapFaceCount];
+	GenerateFaceFlags(m_collidedFaces, m_disabledFaces, 0, m_HeightMapFaceCount, m_pFaceFlags);
+	m_uploadedCollidedFaces.copyFrom(m_collidedFaces);
+	m_uploadedDisabledFaces.copyFrom(m_disabledFaces);
+
+	m_pFaceFlagBuffer = CreateBuffer(pDevice, m_HeightMapFaceCount, D3D11_USAGE_DEFAULT, D3D11_BIND_SHADER_RESOURCE, 0, m_pFaceFlags);
+	if (m_pFaceFlagBuffer)
+	{
+		D3D11_SHADER_RESOURCE_VIEW_DESC viewDesc;
+		viewDesc.Format = DXGI_FORMAT_R8_UINT;
+		viewDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+		viewDesc.Buffer.FirstElement = 0;
+		viewDesc.Buffer.NumElements = m_HeightMapFaceCount;
+
+		if (FAILED(pDevice->CreateShaderResourceView(m_pFaceFlagBuffer, &viewDesc, &m_pFaceFlagView)))
+		{
+			m_pFaceFlagView = NULL;
+		}
+	}
 
 	for (size_t i = 0; i < NUM_TEXTURE_FILES; ++i)
 	{
@@ -98,6 +307,12 @@ void HeightMap::BuildCollisionData(void)
 				XMStoreFloat3(&m_pFaceData[faceIndex + 1].m_vNormal, vN2);
 				XMStoreFloat3(&m_pFaceData[faceIndex + 1].m_centre, (v1 + v2 + v3) / 3.0f);
 
+				if (XMVectorGetX(vN1) < 0.25f)
+					m_shadedFaces.set(faceIndex + 0);
+
+				if (XMVectorGetX(vN2) < 0.25f)
+					m_shadedFaces.set(faceIndex + 1);
+
 
 				faceIndex += 2;
 			}
@@ -105,6 +320,33 @@ void HeightMap::BuildCollisionData(void)
 			mapIndex++;
 		}
 	}
+
+	// Pack the faces into blocks of four for RayTriangleBatch. Lanes past the last face 
+	// are left as degenerate triangles, which can never report a hit
+	for (int b = 0; b < m_faceRayBlockCount; ++b)
+	{
+		float v0[3][4] = {};
+		float edge1[3][4] = {};
+		float edge2[3][4] = {};
+
+		for (int lane = 0; lane < 4 && b * 4 + lane < m_HeightMapFaceCount; ++lane)
+		{
+			const FaceCollisionData& face = m_pFaceData[b * 4 + lane];
+			const XMFLOAT3 e1 = face.m_v1 - face.m_v0;
+			const XMFLOAT3 e2 = face.m_v2 - face.m_v0;
+
+			v0[0][lane] = face.m_v0.x; v0[1][lane] = face.m_v0.y; v0[2][lane] = face.m_v0.z;
+			edge1[0][lane] = e1.x; edge1[1][lane] = e1.y; edge1[2][lane] = e1.z;
+			edge2[0][lane] = e2.x; edge2[1][lane] = e2.y; edge2[2][lane] = e2.z;
+		}
+
+		for (int c = 0; c < 3; ++c)
+		{
+			m_pFaceRayBlocks[b].m_v0[c] = XMVectorSet(v0[c][0], v0[c][1], v0[c][2], v0[c][3]);
+			m_pFaceRayBlocks[b].m_edge1[c] = XMVectorSet(edge1[c][0], edge1[c][1], edge1[c][2], edge1[c][3]);
+			m_pFaceRayBlocks[b].m_edge2[c] = XMVectorSet(edge2[c][0], edge2[c][1], edge2[c][2], edge2[c][3]);
+		}
+	}
 }
 
 XMVECTOR HeightMap::closestPtPointTriangle(const XMVECTOR & pos, int faceIdx)
@@ -175,6 +417,64 @@ XMVECTOR HeightMap::closestPtPointTriangle(const XMVECTOR & pos, int faceIdx)
 	return a + ab * v + ac * w;
 }
 
+void HeightMap::GatherTriangleBatch(const int* pFaceIndices, int count, TriangleBatch& batch) const
+{
+	assert(count > 0 && count <= CLOSEST_POINT_BATCH_SIZE);
+
+	// Unused lanes repeat the first face so they stay finite, their results are ignored
+	float a[3][CLOSEST_POINT_BATCH_SIZE], b[3][CLOSEST_POINT_BATCH_SIZE], c[3][CLOSEST_POINT_BATCH_SIZE];
+	for (int lane = 0; lane < CLOSEST_POINT_BATCH_SIZE; ++lane)
+	{
+		const int faceIdx = pFaceIndices[lane < count ? lane : 0];
+		const FaceCollisionData& face = m_pFaceData[faceIdx];
+
+		a[0][lane] = face.m_v0.x; a[1][lane] = face.m_v0.y; a[2][lane] = face.m_v0.z;
+		b[0][lane] = face.m_v1.x; b[1][lane] = face.m_v1.y; b[2][lane] = face.m_v1.z;
+		c[0][lane] = face.m_v2.x; c[1][lane] = face.m_v2.y; c[2][lane] = face.m_v2.z;
+		batch.m_faceIndices[lane] = lane < count ? faceIdx : INDEX_NONE;
+	}
+
+	for (int half = 0; half < 2; ++half)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			batch.m_a[half][i] = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&a[i][half * 4]));
+			batch.m_b[half][i] = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&b[i][half * 4]));
+			batch.m_c[half][i] = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&c[i][half * 4]));
+		}
+	}
+
+	batch.m_count = count;
+}
+
+int HeightMap::ClosestPtPointTriangleBatch(const XMVECTOR& pos, const TriangleBatch& batch, float distancesSq[CLOSEST_POINT_BATCH_SIZE], float& minDistSq) const
+{
+	const XMVECTOR p[3] = { XMVectorSplatX(pos), XMVectorSplatY(pos), XMVectorSplatZ(pos) };
+
+	for (int half = 0; half < 2; ++half)
+	{
+		const XMVECTOR distSq = closest_pt_point_triangle_dist_sq_x4(p, batch.m_a[half], batch.m_b[half], batch.m_c[half]);
+		XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(&distancesSq[half * 4]), distSq);
+	}
+
+	int minFace = INDEX_NONE;
+	minDistSq = FLT_MAX;
+	for (int lane = 0; lane < CLOSEST_POINT_BATCH_SIZE; ++lane)
+	{
+		if (lane >= batch.m_count)
+		{
+			distancesSq[lane] = FLT_MAX;
+		}
+		else if (distancesSq[lane] < minDistSq)
+		{
+			minDistSq = distancesSq[lane];
+			minFace = batch.m_faceIndices[lane];
+		}
+	}
+
+	return minFace;
+}
+
 void HeightMap::SetupStaticOctTree()
 {
 	STreeObject obj;
@@ -197,99 +497,444 @@ void HeightMap::SetupStaticOctTree()
 	obj.radius = 0.2f;
 }
 
-void HeightMap::RebuildVertexData(void)
+void HeightMap::GenerateVertex(int mapIndex, Vertex_Pos3fColour4ubNormal3fTex2f& vtx) const
+{
+	static VertexColour STANDARD_COLOUR(255, 255, 255, 255);
+
+	const float inv2GridSize = 0.5f / m_gridSize;
+	const int w = mapIndex % m_HeightMapWidth;
+	const int l = mapIndex / m_HeightMapWidth;
+
+	// Smooth normal from the central difference of the neighbouring heights, clamped at the edges
+	const float hL = m_pHeightMap[w > 0 ? mapIndex - 1 : mapIndex].y;
+	const float hR = m_pHeightMap[w < m_HeightMapWidth - 1 ? mapIndex + 1 : mapIndex].y;
+	const float hD = m_pHeightMap[l > 0 ? mapIndex - m_HeightMapWidth : mapIndex].y;
+	const float hU = m_pHeightMap[l < m_HeightMapLength - 1 ? mapIndex + m_HeightMapWidth : mapIndex].y;
+	const XMVECTOR vN = XMVector3Normalize(XMVectorSet((hL - hR) * inv2GridSize, 1.0f, (hD - hU) * inv2GridSize, 0.0f));
+
+	// One texture repeat per grid cell, the shader takes the fraction
+	vtx = Vertex_Pos3fColour4ubNormal3fTex2f(XMLoadFloat4(&m_pHeightMap[mapIndex]), STANDARD_COLOUR, vN, XMFLOAT2((float)w, (float)l));
+}
+
+void HeightMap::GenerateVertexRange(int firstVtx, int endVtx, Vertex_Pos3fColour4ubNormal3fTex2f* pVtxs) const
 {
-	D3D11_MAPPED_SUBRESOURCE map;
+	assert(firstVtx >= 0 && endVtx <= m_HeightMapVtxCount);
+	assert(firstVtx % VERTEX_STREAM_BATCH == 0);
+	assert(((uintptr_t)pVtxs & 15) == 0);
+
+	static VertexColour STANDARD_COLOUR(255, 255, 255, 255);
+
+	const XMVECTOR inv2GridSize = XMVectorReplicate(0.5f / m_gridSize);
+
+	// Each batch is assembled here and then streamed out as whole cache lines, so the destination 
+	// is never read into the cache and write-combined memory only ever sees full lines
+	DX_ALIGNED Vertex_Pos3fColour4ubNormal3fTex2f batch[VERTEX_STREAM_BATCH];
+	DX_ALIGNED float normals[3][4];
 
-	if (SUCCEEDED(Application::s_pApp->GetDeviceContext()->Map(m_pHeightMapBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map)))
+	int w = firstVtx % m_HeightMapWidth;
+	int l = firstVtx / m_HeightMapWidth;
+
+	int vtx = firstVtx;
+	for (; vtx + VERTEX_STREAM_BATCH <= endVtx; vtx += VERTEX_STREAM_BATCH)
 	{
-		Vertex_Pos3fColour4ubNormal3fTex2f* pMapVtxs = (Vertex_Pos3fColour4ubNormal3fTex2f*)map.pData;
+		for (int quad = 0; quad < VERTEX_STREAM_BATCH; quad += 4)
+		{
+			// Gather the neighbouring heights of four vertices, clamped at the edges as in GenerateVertex
+			DX_ALIGNED float hL[4], hR[4], hD[4], hU[4];
+			int laneW = w;
+			int laneL = l;
+			for (int lane = 0; lane < 4; ++lane)
+			{
+				const int mapIndex = vtx + quad + lane;
+				hL[lane] = m_pHeightMap[laneW > 0 ? mapIndex - 1 : mapIndex].y;
+				hR[lane] = m_pHeightMap[laneW < m_HeightMapWidth - 1 ? mapIndex + 1 : mapIndex].y;
+				hD[lane] = m_pHeightMap[laneL > 0 ? mapIndex - m_HeightMapWidth : mapIndex].y;
+				hU[lane] = m_pHeightMap[laneL < m_HeightMapLength - 1 ? mapIndex + m_HeightMapWidth : mapIndex].y;
+
+				if (++laneW == m_HeightMapWidth)
+				{
+					laneW = 0;
+					++laneL;
+				}
+			}
 
-		int vtxIndex = 0;
-		int mapIndex = 0;
+			// Normalise the four (dx, 1, dz) normals together
+			const XMVECTOR nX = (XMLoadFloat4A(reinterpret_cast<XMFLOAT4A*>(hL)) - XMLoadFloat4A(reinterpret_cast<XMFLOAT4A*>(hR))) * inv2GridSize;
+			const XMVECTOR nZ = (XMLoadFloat4A(reinterpret_cast<XMFLOAT4A*>(hD)) - XMLoadFloat4A(reinterpret_cast<XMFLOAT4A*>(hU))) * inv2GridSize;
+			const XMVECTOR invLength = XMVectorReciprocal(XMVectorSqrt(nX * nX + nZ * nZ + XMVectorSplatOne()));
+			XMStoreFloat4A(reinterpret_cast<XMFLOAT4A*>(normals[0]), nX * invLength);
+			XMStoreFloat4A(reinterpret_cast<XMFLOAT4A*>(normals[1]), invLength);
+			XMStoreFloat4A(reinterpret_cast<XMFLOAT4A*>(normals[2]), nZ * invLength);
 
-		XMVECTOR v0, v1, v2, v3, v4, v5;
-		float tX0, tY0, tX1, tY1, tX2, tY2, tX3, tY3;
+			for (int lane = 0; lane < 4; ++lane)
+			{
+				const XMFLOAT4& pos = m_pHeightMap[vtx + quad + lane];
+				Vertex_Pos3fColour4ubNormal3fTex2f& out = batch[quad + lane];
+				out.pos.x = pos.x;
+				out.pos.y = pos.y;
+				out.pos.z = pos.z;
+				out.colour = STANDARD_COLOUR;
+				out.normal.x = normals[0][lane];
+				out.normal.y = normals[1][lane];
+				out.normal.z = normals[2][lane];
+				out.tex.x = (float)w;
+				out.tex.y = (float)l;
+
+				if (++w == m_HeightMapWidth)
+				{
+					w = 0;
+					++l;
+				}
+			}
+		}
 
-		VertexColour c0, c1, c2, c3;
-		XMVECTOR vN1, vN2;
+		const __m128* pSrc = reinterpret_cast<const __m128*>(batch);
+		float* pDst = reinterpret_cast<float*>(&pVtxs[vtx]);
+		for (int i = 0; i < (int)(sizeof(batch) / sizeof(__m128)); ++i)
+		{
+			_mm_stream_ps(pDst + i * 4, pSrc[i]);
+		}
+	}
+
+	// The streamed stores are weakly ordered, make them visible before anyone reads the range
+	_mm_sfence();
+
+	for (; vtx < endVtx; ++vtx)
+	{
+		GenerateVertex(vtx, pVtxs[vtx]);
+	}
+}
 
-		static VertexColour STANDARD_COLOUR(255, 255, 255, 255);
-		static VertexColour COLLISION_COLOUR(255, 0, 0, 255);
+void HeightMap::GenerateVertexData(Vertex_Pos3fColour4ubNormal3fTex2f* pVtxs) const
+{
+	PROFILE_SCOPE("HeightMap::GenerateVertexData");
 
-		VertexColour CUBE_COLOUR;
+	// Whole batches are shared out as evenly as possible, the last range picking up the tail. 
+	// Small maps aren't worth splitting up
+	const int batchCount = m_HeightMapVtxCount / VERTEX_STREAM_BATCH;
+	if (batchCount == 0)
+	{
+		GenerateVertexRange(0, m_HeightMapVtxCount, pVtxs);
+		return;
+	}
+
+	Application::s_pApp->GetJobSystem()->parallelFor(0, batchCount, VERTEX_STREAM_MIN_RANGE_BATCHES, [this, batchCount, pVtxs](int firstBatch, int endBatch)
+	{
+		GenerateVertexRange(firstBatch * VERTEX_STREAM_BATCH, endBatch == batchCount ? m_HeightMapVtxCount : endBatch * VERTEX_STREAM_BATCH, pVtxs);
+	});
+}
 
-		// This is the unstripped method, I wouldn't recommend changing this to the stripped method for the collision assignment
-		for (int f = 0; f < m_HeightMapFaceCount; f += 2)
+void HeightMap::GenerateSkirtVertices(Vertex_Pos3fColour4ubNormal3fTex2f* pVtxs) const
+{
+	// Only the edges between chunks get skirts, nothing can show through the outside of the map
+	for (int chunkRow = 1; chunkRow < m_chunksLong; ++chunkRow)
+	{
+		const int l = chunkRow * HEIGHTMAP_CHUNK_CELLS;
+		for (int w = 0; w < m_HeightMapWidth; ++w)
+		{
+			Vertex_Pos3fColour4ubNormal3fTex2f& vtx = pVtxs[SkirtRowVertex(chunkRow, w)];
+			vtx = pVtxs[l * m_HeightMapWidth + w];
+			vtx.pos.y -= m_skirtDepth;
+		}
+	}
+
+	for (int chunkColumn = 1; chunkColumn < m_chunksWide; ++chunkColumn)
+	{
+		const int w = chunkColumn * HEIGHTMAP_CHUNK_CELLS;
+		for (int l = 0; l < m_HeightMapLength; ++l)
 		{
-			v0 = XMLoadFloat3(&m_pFaceData[f + 0].m_v0);
-			v1 = XMLoadFloat3(&m_pFaceData[f + 0].m_v1);
-			v2 = XMLoadFloat3(&m_pFaceData[f + 0].m_v2);
-			v3 = XMLoadFloat3(&m_pFaceData[f + 1].m_v0);
-			v4 = XMLoadFloat3(&m_pFaceData[f + 1].m_v1);
-			v5 = XMLoadFloat3(&m_pFaceData[f + 1].m_v2);
+			Vertex_Pos3fColour4ubNormal3fTex2f& vtx = pVtxs[SkirtColumnVertex(chunkColumn, l)];
+			vtx = pVtxs[l * m_HeightMapWidth + w];
+			vtx.pos.y -= m_skirtDepth;
+		}
+	}
+}
+
+void HeightMap::BuildChunks(void)
+{
+	const int cellsWide = m_HeightMapWidth - 1;
+	const int cellsLong = m_HeightMapLength - 1;
+
+	m_chunksWide = (cellsWide + HEIGHTMAP_CHUNK_CELLS - 1) / HEIGHTMAP_CHUNK_CELLS;
+	m_chunksLong = (cellsLong + HEIGHTMAP_CHUNK_CELLS - 1) / HEIGHTMAP_CHUNK_CELLS;
+	m_skirtVtxCount = (m_chunksLong - 1) * m_HeightMapWidth + (m_chunksWide - 1) * m_HeightMapLength;
 
-			if (m_pFaceData[f + 0].m_bDisabled)
-				v0 = v1 = v2 = XMVectorZero();
+	m_chunks.clear();
+	m_chunkCentres.clear();
+	m_chunkExtents.clear();
 
-			if (m_pFaceData[f + 1].m_bDisabled)
-				v3 = v4 = v5 = XMVectorZero();
+	XMVECTOR vMapMin = XMLoadFloat4(&m_pHeightMap[0]);
+	XMVECTOR vMapMax = vMapMin;
 
-			vN1 = XMLoadFloat3(&m_pFaceData[f + 0].m_vNormal);
-			vN2 = XMLoadFloat3(&m_pFaceData[f + 1].m_vNormal);
+	int firstIndex = 0;
+	for (int chunkL = 0; chunkL < m_chunksLong; ++chunkL)
+	{
+		for (int chunkW = 0; chunkW < m_chunksWide; ++chunkW)
+		{
+			TerrainChunk chunk;
+			chunk.m_firstCellW = chunkW * HEIGHTMAP_CHUNK_CELLS;
+			chunk.m_firstCellL = chunkL * HEIGHTMAP_CHUNK_CELLS;
+			chunk.m_cellsWide = min(HEIGHTMAP_CHUNK_CELLS, cellsWide - chunk.m_firstCellW);
+			chunk.m_cellsLong = min(HEIGHTMAP_CHUNK_CELLS, cellsLong - chunk.m_firstCellL);
+
+			// Quads across and down at each level, the last ones narrower when the step doesn't divide the chunk
+			const int skirtEdgesAcross = (chunkL > 0) + (chunkL < m_chunksLong - 1);
+			const int skirtEdgesDown = (chunkW > 0) + (chunkW < m_chunksWide - 1);
+			for (int lod = 0; lod < HEIGHTMAP_LOD_COUNT; ++lod)
+			{
+				const int step = 1 << lod;
+				const int quadsWide = (chunk.m_cellsWide + step - 1) / step;
+				const int quadsLong = (chunk.m_cellsLong + step - 1) / step;
+
+				chunk.m_firstIndex[lod] = firstIndex;
+				chunk.m_indexCount[lod] = (quadsWide * quadsLong + quadsWide * skirtEdgesAcross + quadsLong * skirtEdgesDown) * 6;
+				chunk.m_lodError[lod] = 0.0f;
+				firstIndex += chunk.m_indexCount[lod];
+			}
 
-			tX0 = 0.0f;
-			tY0 = 0.0f;
-			tX1 = 0.0f;
-			tY1 = 1.0f;
-			tX2 = 1.0f;
-			tY2 = 0.0f;
-			tX3 = 1.0f;
-			tY3 = 1.0f;
+			m_chunks.push_back(chunk);
 
-			c0 = m_pFaceData[f + 0].m_bCollided ? COLLISION_COLOUR : STANDARD_COLOUR;
-			c1 = m_pFaceData[f + 1].m_bCollided ? COLLISION_COLOUR : STANDARD_COLOUR;
+			// Bounds of every height sample the chunk's cells touch
+			XMVECTOR vMin = XMLoadFloat4(&m_pHeightMap[chunk.m_firstCellL * m_HeightMapWidth + chunk.m_firstCellW]);
+			XMVECTOR vMax = vMin;
+			for (int l = chunk.m_firstCellL; l <= chunk.m_firstCellL + chunk.m_cellsLong; ++l)
+			{
+				for (int w = chunk.m_firstCellW; w <= chunk.m_firstCellW + chunk.m_cellsWide; ++w)
+				{
+					const XMVECTOR vPos = XMLoadFloat4(&m_pHeightMap[l * m_HeightMapWidth + w]);
+					vMin = XMVectorMin(vMin, vPos);
+					vMax = XMVectorMax(vMax, vPos);
+				}
+			}
 
-			pMapVtxs[vtxIndex + 0] = Vertex_Pos3fColour4ubNormal3fTex2f(v0, c0, vN1, XMFLOAT2(tX0, tY0));
-			pMapVtxs[vtxIndex + 1] = Vertex_Pos3fColour4ubNormal3fTex2f(v1, c0, vN1, XMFLOAT2(tX1, tY1));
-			pMapVtxs[vtxIndex + 2] = Vertex_Pos3fColour4ubNormal3fTex2f(v2, c0, vN1, XMFLOAT2(tX2, tY2));
-			pMapVtxs[vtxIndex + 3] = Vertex_Pos3fColour4ubNormal3fTex2f(v3, c1, vN2, XMFLOAT2(tX2, tY2));
-			pMapVtxs[vtxIndex + 4] = Vertex_Pos3fColour4ubNormal3fTex2f(v4, c1, vN2, XMFLOAT2(tX1, tY1));
-			pMapVtxs[vtxIndex + 5] = Vertex_Pos3fColour4ubNormal3fTex2f(v5, c1, vN2, XMFLOAT2(tX3, tY3));
+			vMapMin = XMVectorMin(vMapMin, vMin);
+			vMapMax = XMVectorMax(vMapMax, vMax);
 
-			vtxIndex += 6;
+			XMFLOAT4 centre, extents;
+			XMStoreFloat4(&centre, XMVectorScale(XMVectorAdd(vMin, vMax), 0.5f));
+			XMStoreFloat4(&extents, XMVectorScale(XMVectorSubtract(vMax, vMin), 0.5f));
+			m_chunkCentres.push_back(centre);
+			m_chunkExtents.push_back(extents);
 		}
 	}
 
-	Application::s_pApp->GetDeviceContext()->Unmap(m_pHeightMapBuffer, 0);
+	// No level can be out by more than the map's height range, so skirts that deep always cover the crack
+	m_skirtDepth = XMVectorGetY(XMVectorSubtract(vMapMax, vMapMin)) + m_gridSize;
+
+	m_HeightMapIndexCount = firstIndex;
+	m_visibleChunks.resize(m_chunks.size());
 }
 
+void HeightMap::GenerateChunkLodRange(int firstChunk, int endChunk, uint32_t* pIndices)
+{
+	for (int chunkIndex = firstChunk; chunkIndex < endChunk; ++chunkIndex)
+	{
+		TerrainChunk& chunk = m_chunks[chunkIndex];
+		const int chunkW = chunk.m_firstCellW / HEIGHTMAP_CHUNK_CELLS;
+		const int chunkL = chunk.m_firstCellL / HEIGHTMAP_CHUNK_CELLS;
+		const int endW = chunk.m_firstCellW + chunk.m_cellsWide;
+		const int endL = chunk.m_firstCellL + chunk.m_cellsLong;
 
-int HeightMap::DisableBelowLevel(float fYLevel)
+		for (int lod = 0; lod < HEIGHTMAP_LOD_COUNT; ++lod)
+		{
+			const int step = 1 << lod;
+			uint32_t* pLodIndices = &pIndices[chunk.m_firstIndex[lod]];
+
+			// Same winding as BuildCollisionData, so level 0 is exactly the collision mesh
+			for (int l = chunk.m_firstCellL; l < endL; l += step)
+			{
+				const int nextL = min(l + step, endL);
+				for (int w = chunk.m_firstCellW; w < endW; w += step)
+				{
+					const int nextW = min(w + step, endW);
+					const uint32_t i0 = l * m_HeightMapWidth + w;
+					const uint32_t i1 = nextL * m_HeightMapWidth + w;
+					const uint32_t i2 = l * m_HeightMapWidth + nextW;
+					const uint32_t i3 = nextL * m_HeightMapWidth + nextW;
+
+					*pLodIndices++ = i0;
+					*pLodIndices++ = i1;
+					*pLodIndices++ = i2;
+					*pLodIndices++ = i2;
+					*pLodIndices++ = i1;
+					*pLodIndices++ = i3;
+				}
+			}
+
+			// A quad from each edge segment down to its skirt vertices
+			auto writeSkirt = [&pLodIndices](uint32_t top0, uint32_t top1, uint32_t skirt0, uint32_t skirt1)
+			{
+				*pLodIndices++ = top0;
+				*pLodIndices++ = skirt0;
+				*pLodIndices++ = top1;
+				*pLodIndices++ = top1;
+				*pLodIndices++ = skirt0;
+				*pLodIndices++ = skirt1;
+			};
+
+			for (int w = chunk.m_firstCellW; w < endW; w += step)
+			{
+				const int nextW = min(w + step, endW);
+				if (chunkL > 0)
+				{
+					const int l = chunk.m_firstCellL;
+					writeSkirt(l * m_HeightMapWidth + w, l * m_HeightMapWidth + nextW, SkirtRowVertex(chunkL, w), SkirtRowVertex(chunkL, nextW));
+				}
+				if (chunkL < m_chunksLong - 1)
+				{
+					writeSkirt(endL * m_HeightMapWidth + w, endL * m_HeightMapWidth + nextW, SkirtRowVertex(chunkL + 1, w), SkirtRowVertex(chunkL + 1, nextW));
+				}
+			}
+
+			for (int l = chunk.m_firstCellL; l < endL; l += step)
+			{
+				const int nextL = min(l + step, endL);
+				if (chunkW > 0)
+				{
+					const int w = chunk.m_firstCellW;
+					writeSkirt(l * m_HeightMapWidth + w, nextL * m_HeightMapWidth + w, SkirtColumnVertex(chunkW, l), SkirtColumnVertex(chunkW, nextL));
+				}
+				if (chunkW < m_chunksWide - 1)
+				{
+					writeSkirt(l * m_HeightMapWidth + endW, nextL * m_HeightMapWidth + endW, SkirtColumnVertex(chunkW + 1, l), SkirtColumnVertex(chunkW + 1, nextL));
+				}
+			}
+
+			assert(pLodIndices == &pIndices[chunk.m_firstIndex[lod] + chunk.m_indexCount[lod]]);
+
+			// The error is how far each height sample is from the level's surface above or below it
+			float maxError = 0.0f;
+			if (lod > 0)
+			{
+				const int lastQuadL = (chunk.m_cellsLong - 1) / step;
+				const int lastQuadW = (chunk.m_cellsWide - 1) / step;
+				for (int l = chunk.m_firstCellL; l <= endL; ++l)
+				{
+					const int quadL = chunk.m_firstCellL + min((l - chunk.m_firstCellL) / step, lastQuadL) * step;
+					const int nextL = min(quadL + step, endL);
+					const float v = (float)(l - quadL) / (nextL - quadL);
+
+					for (int w = chunk.m_firstCellW; w <= endW; ++w)
+					{
+						const int quadW = chunk.m_firstCellW + min((w - chunk.m_firstCellW) / step, lastQuadW) * step;
+						const int nextW = min(quadW + step, endW);
+						const float u = (float)(w - quadW) / (nextW - quadW);
+
+						const float h0 = m_pHeightMap[quadL * m_HeightMapWidth + quadW].y;
+						const float h1 = m_pHeightMap[nextL * m_HeightMapWidth + quadW].y;
+						const float h2 = m_pHeightMap[quadL * m_HeightMapWidth + nextW].y;
+						const float h3 = m_pHeightMap[nextL * m_HeightMapWidth + nextW].y;
+
+						// Either side of the diagonal from i1 to i2
+						const float surface = u + v <= 1.0f ? h0 + u * (h2 - h0) + v * (h1 - h0) : h3 + (1.0f - u) * (h1 - h3) + (1.0f - v) * (h2 - h3);
+						maxError = max(maxError, fabsf(m_pHeightMap[l * m_HeightMapWidth + w].y - surface));
+					}
+				}
+			}
+			chunk.m_lodError[lod] = maxError;
+		}
+	}
+}
+
+void HeightMap::GenerateChunkLods(uint32_t* pIndices)
 {
-	int nHidden = 0;
+	PROFILE_SCOPE("HeightMap::GenerateChunkLods");
 
-	for (int f = 0; f < m_HeightMapFaceCount; ++f)
+	// Chunks write disjoint index ranges, so they're shared out like the vertex batches
+	Application::s_pApp->GetJobSystem()->parallelFor(0, (int)m_chunks.size(), HEIGHTMAP_LOD_MIN_RANGE_CHUNKS, [this, pIndices](int firstChunk, int endChunk)
 	{
-		if (m_pFaceData[f].m_v0.y < fYLevel && m_pFaceData[f].m_v1.y < fYLevel && m_pFaceData[f].m_v2.y < fYLevel)
+		GenerateChunkLodRange(firstChunk, endChunk, pIndices);
+	});
+}
+
+int HeightMap::SelectChunkLod(int chunkIndex, const XMVECTOR& cameraPos) const
+{
+	const TerrainChunk& chunk = m_chunks[chunkIndex];
+
+	// Distance to the nearest point of the chunk's box
+	const XMVECTOR vOffset = XMVectorAbs(XMVectorSubtract(cameraPos, XMLoadFloat4(&m_chunkCentres[chunkIndex])));
+	const XMVECTOR vOutside = XMVectorMax(XMVectorSubtract(vOffset, XMLoadFloat4(&m_chunkExtents[chunkIndex])), XMVectorZero());
+	const float maxError = XMVectorGetX(XMVector3Length(vOutside)) * HEIGHTMAP_LOD_ERROR_RATIO;
+
+	int lod = 0;
+	while (lod + 1 < HEIGHTMAP_LOD_COUNT && chunk.m_lodError[lod + 1] <= maxError)
+	{
+		++lod;
+	}
+	return lod;
+}
+
+void HeightMap::GenerateFaceFlags(const BitArray& collided, const BitArray& disabled, int firstFace, int endFace, uint8_t* pFlags) const
+{
+	assert(firstFace >= 0 && endFace <= m_HeightMapFaceCount);
+	assert(collided.size() == m_HeightMapFaceCount && disabled.size() == m_HeightMapFaceCount);
+
+	for (int f = firstFace; f < endFace; ++f)
+	{
+		pFlags[f] = (collided.test(f) ? FACE_FLAG_COLLIDED : 0) |
+			(disabled.test(f) ? FACE_FLAG_DISABLED : 0) |
+			(m_shadedFaces.test(f) ? FACE_FLAG_SHADED : 0);
+	}
+}
+
+void HeightMap::RebuildFaceFlags(const BitArray& collided, const BitArray& disabled)
+{
+	assert(collided.size() == m_HeightMapFaceCount && disabled.size() == m_HeightMapFaceCount);
+
+	const int wordCount = collided.getWordCount();
+
+	// The flags are compared with the ones last uploaded a word (32 faces) at a time. Each run of 
+	// changed words is regenerated into m_pFaceFlags and copied to the flag buffer as one range
+	int runStart = INDEX_NONE;
+	for (int w = 0; w <= wordCount; ++w)
+	{
+		if (w < wordCount)
 		{
-			m_pFaceData[f].m_bDisabled = true;
-			nHidden++;
+			const uint32_t collidedWord = collided.getWord(w);
+			const uint32_t disabledWord = disabled.getWord(w);
+
+			if (collidedWord != m_uploadedCollidedFaces.getWord(w) || disabledWord != m_uploadedDisabledFaces.getWord(w))
+			{
+				m_uploadedCollidedFaces.setWord(w, collidedWord);
+				m_uploadedDisabledFaces.setWord(w, disabledWord);
+
+				if (runStart == INDEX_NONE)
+				{
+					runStart = w;
+				}
+				continue;
+			}
 		}
-	}
 
-	return nHidden;
+		if (runStart == INDEX_NONE)
+		{
+			continue;
+		}
+
+		const int firstFace = runStart * 32;
+		const int endFace = min(w * 32, m_HeightMapFaceCount);
+		GenerateFaceFlags(m_uploadedCollidedFaces, m_uploadedDisabledFaces, firstFace, endFace, m_pFaceFlags);
+
+		if (m_pFaceFlagBuffer)
+		{
+			RenderCommandBuffer* pCommands = Application::s_pApp->GetRenderCommands();
+			const size_t dataOffset = pCommands->UpdateBuffer(m_pFaceFlagBuffer, firstFace, endFace - firstFace, false);
+			memcpy(pCommands->GetData(dataOffset), &m_pFaceFlags[firstFace], endFace - firstFace);
+		}
+		runStart = INDEX_NONE;
+	}
 }
 
-int HeightMap::EnableAll(void)
+
+int HeightMap::DisableBelowLevel(float fYLevel)
 {
 	int nHidden = 0;
 
 	for (int f = 0; f < m_HeightMapFaceCount; ++f)
 	{
-		if (m_pFaceData[f].m_bDisabled == true)
+		if (m_pFaceData[f].m_v0.y < fYLevel && m_pFaceData[f].m_v1.y < fYLevel && m_pFaceData[f].m_v2.y < fYLevel)
 		{
-			m_pFaceData[f].m_bDisabled = false;
+			m_disabledFaces.set(f);
 			nHidden++;
 		}
 	}
@@ -297,6 +942,14 @@ int HeightMap::EnableAll(void)
 	return nHidden;
 }
 
+int HeightMap::EnableAll(void)
+{
+	const int nHidden = m_disabledFaces.count();
+	m_disabledFaces.clearAll();
+
+	return nHidden;
+}
+
 void HeightMap::GetFaceVerticesByIndex(int index, XMFLOAT3 vecArray[FACE_NORM_VERTICES_COUNT]) const
 {
 	vecArray[0] = m_pFaceData[index].m_v0;
@@ -321,7 +974,13 @@ HeightMap::~HeightMap()
 		Release(m_pTextureViews[i]);
 	}
 
+	SAFE_FREE_ARR(m_pFaceRayBlocks);
+	SAFE_FREE_ARR(m_pFaceFlags);
+
 	Release(m_pHeightMapBuffer);
+	Release(m_pHeightMapIndexBuffer);
+	Release(m_pFaceFlagView);
+	Release(m_pFaceFlagBuffer);
 
 	DeleteShader();
 
@@ -331,90 +990,93 @@ HeightMap::~HeightMap()
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
-void HeightMap::Draw(float frameCount)
+void HeightMap::Draw(float frameCount, const Frustum& frustum, const XMVECTOR& cameraPos)
 {
+	const int visibleChunkCount = CullBoxes(frustum, &m_chunkCentres[0], &m_chunkExtents[0], (int)m_chunks.size(), &m_visibleChunks[0]);
+	if (visibleChunkCount == 0)
+	{
+		return;
+	}
 
 	D3DXMATRIX worldMtx;
 	D3DXMatrixIdentity(&worldMtx);
 
-	ID3D11DeviceContext* pContext = Application::s_pApp->GetDeviceContext();
+	RenderCommandBuffer* pCommands = Application::s_pApp->GetRenderCommands();
 
 	Application::s_pApp->SetWorldMatrix(worldMtx);
 
-	// Fill in the `myGlobals' cbuffer.
-	//
-	// The D3D11_MAP_WRITE_DISCARD flag is best for performance, but
-	// leaves the buffer contents indeterminate. The entire buffer
-	// needs to be set up for each draw.
-	//
-	// (This is the reason you need to "your" globals
-	// into your own cbuffer - the cbuffer set up by CommonApp is
-	// mapped using D3D11_MAP_WRITE_DISCARD too. If you set "your"
-	// values correctly by hand, they will likely disappear when
-	// the CommonApp maps the buffer to set its own variables.)
-	if (m_pPSCBuffer)
+	m_pSamplerState = Application::s_pApp->GetSamplerState(true, true, true);
+
+	// Each chunk is recorded with everything it needs, as the draw queue may reorder them
+	for (int visible = 0; visible < visibleChunkCount; ++visible)
 	{
-		D3D11_MAPPED_SUBRESOURCE map;
-		if (SUCCEEDED(pContext->Map(m_pPSCBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map)))
+		const int chunkIndex = m_visibleChunks[visible];
+		const TerrainChunk& chunk = m_chunks[chunkIndex];
+		const int lod = SelectChunkLod(chunkIndex, cameraPos);
+
+		// Fill in the `myGlobals' cbuffer.
+		//
+		// The D3D11_MAP_WRITE_DISCARD flag is best for performance, but
+		// leaves the buffer contents indeterminate. The entire buffer
+		// needs to be set up for each draw.
+		//
+		// (This is the reason you need to "your" globals
+		// into your own cbuffer - the cbuffer set up by CommonApp is
+		// mapped using D3D11_MAP_WRITE_DISCARD too. If you set "your"
+		// values correctly by hand, they will likely disappear when
+		// the CommonApp maps the buffer to set its own variables.)
+		//
+		// The contents are recorded into the command buffer along with the
+		// CommonApp draw, and copied into the cbuffer when it's submitted.
+		if (m_pPSCBuffer)
 		{
-			// Set the buffer contents. There is only one variable to set in this case.
+			D3D11_MAPPED_SUBRESOURCE map = {};
+			map.pData = pCommands->GetData(pCommands->UpdateBuffer(m_pPSCBuffer, 0, m_psCBufferSizeBytes, true));
+
 			SetCBufferFloat(map, m_psFrameCount, frameCount);
-			pContext->Unmap(m_pPSCBuffer, 0);
-		}
-	}
 
-	if (m_pPSCBuffer)
-	{
-		ID3D11Buffer *apConstantBuffers[] = {
-			m_pPSCBuffer,
-		};
+			// The grid dimensions, for the face flag lookup
+			SetCBufferInt(map, m_psMapCellsWide, m_HeightMapWidth - 1);
+			SetCBufferInt(map, m_psMapCellsLong, m_HeightMapLength - 1);
 
-		pContext->PSSetConstantBuffers(m_psCBufferSlot, 1, apConstantBuffers);
-	}
+			pCommands->SetConstantBuffer(RenderStage_PS, m_psCBufferSlot, m_pPSCBuffer);
+		}
 
-	if (m_pVSCBuffer)
-	{
-		D3D11_MAPPED_SUBRESOURCE map;
-		if (SUCCEEDED(pContext->Map(m_pVSCBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map)))
+		if (m_pVSCBuffer)
 		{
+			D3D11_MAPPED_SUBRESOURCE map = {};
+			map.pData = pCommands->GetData(pCommands->UpdateBuffer(m_pVSCBuffer, 0, m_vsCBufferSizeBytes, true));
+
 			// Set the buffer contents. There is only one variable to set
 			// in this case.
 			SetCBufferFloat(map, m_vsFrameCount, frameCount);
 
-			pContext->Unmap(m_pVSCBuffer, 0);
+			pCommands->SetConstantBuffer(RenderStage_VS, m_vsCBufferSlot, m_pVSCBuffer);
 		}
-	}
-
-	if (m_pVSCBuffer)
-	{
-		ID3D11Buffer *apConstantBuffers[] = {
-			m_pVSCBuffer,
-		};
-
-		pContext->VSSetConstantBuffers(m_vsCBufferSlot, 1, apConstantBuffers);
-	}
 
 
-	if (m_psTexture0 >= 0)
-		pContext->PSSetShaderResources(m_psTexture0, 1, &m_pTextureViews[0]);
+		if (m_psTexture0 >= 0)
+			pCommands->SetShaderResource(RenderStage_PS, m_psTexture0, m_pTextureViews[0]);
 
-	if (m_psTexture1 >= 0)
-		pContext->PSSetShaderResources(m_psTexture1, 1, &m_pTextureViews[1]);
+		if (m_psTexture1 >= 0)
+			pCommands->SetShaderResource(RenderStage_PS, m_psTexture1, m_pTextureViews[1]);
 
-	if (m_psTexture2 >= 0)
-		pContext->PSSetShaderResources(m_psTexture2, 1, &m_pTextureViews[2]);
+		if (m_psTexture2 >= 0)
+			pCommands->SetShaderResource(RenderStage_PS, m_psTexture2, m_pTextureViews[2]);
 
-	if (m_psMaterialMap >= 0)
-		pContext->PSSetShaderResources(m_psMaterialMap, 1, &m_pTextureViews[3]);
+		if (m_psMaterialMap >= 0)
+			pCommands->SetShaderResource(RenderStage_PS, m_psMaterialMap, m_pTextureViews[3]);
 
-	if (m_vsMaterialMap >= 0)
-		pContext->VSSetShaderResources(m_vsMaterialMap, 1, &m_pTextureViews[3]);
+		if (m_vsMaterialMap >= 0)
+			pCommands->SetShaderResource(RenderStage_VS, m_vsMaterialMap, m_pTextureViews[3]);
 
+		if (m_psFaceFlags >= 0)
+			pCommands->SetShaderResource(RenderStage_PS, m_psFaceFlags, m_pFaceFlagView);
 
-	m_pSamplerState = Application::s_pApp->GetSamplerState(true, true, true);
 
-	Application::s_pApp->DrawWithShader(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, m_pHeightMapBuffer, sizeof(Vertex_Pos3fColour4ubNormal3fTex2f),
-		NULL, 0, m_HeightMapVtxCount, NULL, m_pSamplerState, &m_shader);
+		Application::s_pApp->DrawWithShader(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, m_pHeightMapBuffer, sizeof(Vertex_Pos3fColour4ubNormal3fTex2f),
+			m_pHeightMapIndexBuffer, chunk.m_firstIndex[lod], chunk.m_indexCount[lod], NULL, m_pSamplerState, &m_shader, DXGI_FORMAT_R32_UINT);
+	}
 }
 
 bool HeightMap::ReloadShader(void)
@@ -462,6 +1124,8 @@ bool HeightMap::ReloadShader(void)
 
 	ps.FindCBuffer("MyApp", &m_psCBufferSlot);
 	ps.FindFloat(m_psCBufferSlot, "g_frameCount", &m_psFrameCount);
+	ps.FindInt(m_psCBufferSlot, "g_mapCellsWide", &m_psMapCellsWide);
+	ps.FindInt(m_psCBufferSlot, "g_mapCellsLong", &m_psMapCellsLong);
 
 	vs.FindCBuffer("MyApp", &m_vsCBufferSlot);
 	vs.FindFloat(m_vsCBufferSlot, "g_frameCount", &m_vsFrameCount);
@@ -470,13 +1134,16 @@ bool HeightMap::ReloadShader(void)
 	ps.FindTexture("g_texture1", &m_psTexture1);
 	ps.FindTexture("g_texture2", &m_psTexture2);
 	ps.FindTexture("g_materialMap", &m_psMaterialMap);
+	ps.FindTexture("g_faceFlags", &m_psFaceFlags);
 
 	vs.FindTexture("g_materialMap", &m_vsMaterialMap);
 
 	// Create the cbuffer, using the shader description to find out how
 	// large it needs to be.
-	m_pPSCBuffer = CreateBuffer(pDevice, ps.GetCBufferSizeBytes(m_psCBufferSlot), D3D11_USAGE_DYNAMIC, D3D11_BIND_CONSTANT_BUFFER, D3D11_CPU_ACCESS_WRITE, NULL);
-	m_pVSCBuffer = CreateBuffer(pDevice, vs.GetCBufferSizeBytes(m_vsCBufferSlot), D3D11_USAGE_DYNAMIC, D3D11_BIND_CONSTANT_BUFFER, D3D11_CPU_ACCESS_WRITE, NULL);
+	m_psCBufferSizeBytes = unsigned(ps.GetCBufferSizeBytes(m_psCBufferSlot));
+	m_vsCBufferSizeBytes = unsigned(vs.GetCBufferSizeBytes(m_vsCBufferSlot));
+	m_pPSCBuffer = CreateBuffer(pDevice, m_psCBufferSizeBytes, D3D11_USAGE_DYNAMIC, D3D11_BIND_CONSTANT_BUFFER, D3D11_CPU_ACCESS_WRITE, NULL);
+	m_pVSCBuffer = CreateBuffer(pDevice, m_vsCBufferSizeBytes, D3D11_USAGE_DYNAMIC, D3D11_BIND_CONSTANT_BUFFER, D3D11_CPU_ACCESS_WRITE, NULL);
 
 	return true;
 
@@ -533,6 +1200,7 @@ bool HeightMap::LoadHeightMap(char* filename, float gridSize, float heightRange)
 	// Save the dimensions of the terrain.
 	m_HeightMapWidth = bitmapInfoHeader.biWidth;
 	m_HeightMapLength = bitmapInfoHeader.biHeight;
+	m_gridSize = gridSize;
 
 	// Calculate the size of the bitmap image data.
 	imageSize = m_HeightMapWidth * m_HeightMapLength * 3;
@@ -620,11 +1288,9 @@ bool HeightMap::RayCollision(XMVECTOR& rayPos, XMVECTOR rayDir, float raySpeed,
 
 	XMVECTOR v0, v1, v2, v3;
 	int i0, i1, i2, i3;
-	float colDist = 0.0f;
 
 	// This resets the collision colouring
-	for (int f = 0; f < m_HeightMapFaceCount; ++f)
-		m_pFaceData[f].m_bCollided = false;
+	m_collidedFaces.clearAll();
 
 #ifdef COLOURTEST
 	// This is just a piece of test code for the map colouring
@@ -633,37 +1299,212 @@ bool HeightMap::RayCollision(XMVECTOR& rayPos, XMVECTOR rayDir, float raySpeed,
 	for (int f = 0; f < m_HeightMapFaceCount; ++f)
 	{
 		if ((int)frame%m_HeightMapFaceCount == f)
-			m_pFaceData[f].m_bCollided = true;
+			m_collidedFaces.set(f);
 	}
 
-	RebuildVertexData();
-
 	frame += 0.1f;
 
 	// end of test code
 #endif
 
 
-	// This is a brute force solution that checks against every triangle in the heightmap
-	for (int f = 0; f < m_HeightMapFaceCount; ++f)
+	const int f = RayCollisionFace(rayPos, rayDir, raySpeed, colPos, colNormN);
+	if (f != INDEX_NONE)
+	{
+		m_collidedFaces.set(f);
+		return true;
+	}
+
+	return false;
+}
+
+int HeightMap::RayCollisionFace(const XMVECTOR& rayPos, const XMVECTOR& rayDir, float raySpeed, XMVECTOR& colPos, XMVECTOR& colNormN) const
+{
+	const float rayLengthSq = XMVectorGetX(XMVector3LengthSq(rayDir));
+	if (rayLengthSq == 0.0f)
 	{
-		//012 213
-		if (!m_pFaceData[f].m_bDisabled && RayTriangle(f, rayPos, rayDir, colPos, colNormN, colDist))
+		return INDEX_NONE;
+	}
+
+	const XMVECTOR normRayDir = rayDir / sqrtf(rayLengthSq);
+
+	const XMVECTOR rayPosSplat[3] = { XMVectorSplatX(rayPos), XMVectorSplatY(rayPos), XMVectorSplatZ(rayPos) };
+	const XMVECTOR rayDirSplat[3] = { XMVectorSplatX(normRayDir), XMVectorSplatY(normRayDir), XMVectorSplatZ(normRayDir) };
+	const XMVECTOR maxDist = XMVectorReplicate(raySpeed);
+
+	// This is a brute force solution that checks against every triangle in the heightmap, four at a time.
+	// Blocks and lanes are walked in face order so the first hit is the same face the scalar loop found
+	for (int b = 0; b < m_faceRayBlockCount; ++b)
+	{
+		XMFLOAT4 colDists;
+		int hitMask = RayTriangleBatch(m_pFaceRayBlocks[b], rayPosSplat, rayDirSplat, maxDist, colDists);
+		if (hitMask == 0)
+		{
+			continue;
+		}
+
+		// A block's four faces share one nibble of a disabled word
+		hitMask &= ~(m_disabledFaces.getWord(b >> 3) >> ((b & 7) * 4));
+
+		const float* pColDists = &colDists.x;
+		for (int lane = 0; lane < 4; ++lane)
 		{
-			// Needs to be >=0 
-			if (colDist <= raySpeed && colDist >= 0.0f)
+			const int f = b * 4 + lane;
+			if (!(hitMask & (1 << lane)))
 			{
-				m_pFaceData[f].m_bCollided = true;
-				RebuildVertexData();
-				return true;
+				continue;
 			}
+
+			colPos = normRayDir * pColDists[lane] + rayPos;
+			colNormN = XMLoadFloat3(&m_pFaceData[f].m_vNormal);
+			return f;
 		}
 	}
 
-	return false;
+	return INDEX_NONE;
+}
+
+int HeightMap::RayTriangleBatch(const FaceRayBlock& block, const XMVECTOR rayPos[3], const XMVECTOR rayDir[3], const XMVECTOR& maxDist, XMFLOAT4& colDists) const
+{
+	const XMVECTOR zero = XMVectorZero();
+	const XMVECTOR one = XMVectorSplatOne();
+
+	// p = dir x edge2, det = edge1 . p
+	const XMVECTOR pX = rayDir[1] * block.m_edge2[2] - rayDir[2] * block.m_edge2[1];
+	const XMVECTOR pY = rayDir[2] * block.m_edge2[0] - rayDir[0] * block.m_edge2[2];
+	const XMVECTOR pZ = rayDir[0] * block.m_edge2[1] - rayDir[1] * block.m_edge2[0];
+	const XMVECTOR det = block.m_edge1[0] * pX + block.m_edge1[1] * pY + block.m_edge1[2] * pZ;
+
+	// s = rayPos - v0, q = s x edge1
+	const XMVECTOR sX = rayPos[0] - block.m_v0[0];
+	const XMVECTOR sY = rayPos[1] - block.m_v0[1];
+	const XMVECTOR sZ = rayPos[2] - block.m_v0[2];
+	const XMVECTOR qX = sY * block.m_edge1[2] - sZ * block.m_edge1[1];
+	const XMVECTOR qY = sZ * block.m_edge1[0] - sX * block.m_edge1[2];
+	const XMVECTOR qZ = sX * block.m_edge1[1] - sY * block.m_edge1[0];
+
+	// Barycentric coordinates and distance along the ray
+	const XMVECTOR u = (sX * pX + sY * pY + sZ * pZ) / det;
+	const XMVECTOR v = (rayDir[0] * qX + rayDir[1] * qY + rayDir[2] * qZ) / det;
+	const XMVECTOR t = (block.m_edge2[0] * qX + block.m_edge2[1] * qY + block.m_edge2[2] * qZ) / det;
+
+	// det > 0 when the ray travels against the face normal. Front facing hits count up to the backoff 
+	// distance along the ray and back facing ones only beyond it
+	const XMVECTOR backoff = XMVectorReplicate(RAY_BACKOFF_DISTANCE);
+	const XMVECTOR inWindow = XMVectorSelect(XMVectorLessOrEqual(t, backoff), XMVectorGreaterOrEqual(t, backoff), XMVectorGreater(det, zero));
+
+	XMVECTOR hit = XMVectorNotEqual(det, zero);
+	hit = XMVectorAndInt(hit, XMVectorGreaterOrEqual(u, zero));
+	hit = XMVectorAndInt(hit, XMVectorGreaterOrEqual(v, zero));
+	hit = XMVectorAndInt(hit, XMVectorLessOrEqual(u + v, one));
+	hit = XMVectorAndInt(hit, XMVectorGreaterOrEqual(t, zero));
+	hit = XMVectorAndInt(hit, XMVectorLessOrEqual(t, maxDist));
+	hit = XMVectorAndInt(hit, inWindow);
+
+	uint32_t laneMasks[4];
+	XMStoreInt4(laneMasks, hit);
+	const int hitMask = (laneMasks[0] & 1) | ((laneMasks[1] & 1) << 1) | ((laneMasks[2] & 1) << 2) | ((laneMasks[3] & 1) << 3);
+
+	if (hitMask != 0)
+	{
+		XMStoreFloat4(&colDists, t);
+	}
+
+	return hitMask;
 }
 
-bool HeightMap::SphereCollision(const XMVECTOR & spherePos, float radius, XMVECTOR & colNormN, float& penetration)
+bool HeightMap::SphereCollision(const XMVECTOR & spherePos, float radius, HeightMapManifold& manifold)
+{
+	PROFILE_SCOPE("HeightMap::SphereCollision");
+
+	manifold.contactCount = 0;
+	if (!SphereCollisionGrid(spherePos, radius, manifold))
+	{
+		SphereCollisionOctTree(spherePos, radius, manifold);
+	}
+
+	return manifold.contactCount > 0;
+}
+
+bool HeightMap::SphereCollisionGrid(const XMVECTOR & spherePos, float radius, HeightMapManifold& manifold)
+{
+	XMFLOAT3 pos;
+	XMStoreFloat3(&pos, spherePos);
+
+	// Position of the sphere centre in grid units, relative to the first height sample
+	const float cellX = (pos.x - m_pHeightMap[0].x) / m_gridSize;
+	const float cellZ = (pos.z - m_pHeightMap[0].z) / m_gridSize;
+
+	const int w = (int)floorf(cellX);
+	const int l = (int)floorf(cellZ);
+
+	if (w < 0 || l < 0 || w >= m_HeightMapWidth - 1 || l >= m_HeightMapLength - 1)
+	{
+		return false;
+	}
+
+	const float fx = cellX - w;
+	const float fz = cellZ - l;
+
+	// Each cell is split along its (w + 1, l) -> (w, l + 1) diagonal, see BuildCollisionData
+	const bool bSecondFace = fx + fz > 1.0f;
+
+	// If the sphere's footprint reaches over an edge of the triangle then a neighbouring face may be 
+	// closer, so leave it to the exact test. Otherwise every other face is at least a radius away 
+	// horizontally, whatever the slope, and the nearest point is the projection onto this face's plane.
+	const float edgeDist = bSecondFace
+		? min(min(1.0f - fx, 1.0f - fz), (fx + fz - 1.0f) * INV_SQRT2)
+		: min(min(fx, fz), (1.0f - fx - fz) * INV_SQRT2);
+
+	if (edgeDist * m_gridSize < radius)
+	{
+		return false;
+	}
+
+	const int mapIndex = l * m_HeightMapWidth + w;
+	const float h00 = m_pHeightMap[mapIndex].y;
+	const float h10 = m_pHeightMap[mapIndex + 1].y;
+	const float h01 = m_pHeightMap[mapIndex + m_HeightMapWidth].y;
+	const float h11 = m_pHeightMap[mapIndex + m_HeightMapWidth + 1].y;
+
+	// Height rise across the cell in x and z, and the barycentric height under the centre
+	float riseX, riseZ, height;
+	if (bSecondFace)
+	{
+		riseX = h11 - h01;
+		riseZ = h11 - h10;
+		height = h11 + (fx - 1.0f) * riseX + (fz - 1.0f) * riseZ;
+	}
+	else
+	{
+		riseX = h10 - h00;
+		riseZ = h01 - h00;
+		height = h00 + fx * riseX + fz * riseZ;
+	}
+
+	const int faceIdx = 2 * (l * (m_HeightMapWidth - 1) + w) + (bSecondFace ? 1 : 0);
+
+	if (m_disabledFaces.test(faceIdx))
+	{
+		return true;
+	}
+
+	const XMVECTOR normal = XMVector3Normalize(XMVectorSet(-riseX, m_gridSize, -riseZ, 0.0f));
+
+	// Perpendicular distance to the plane is the vertical distance scaled by the normal's y
+	const float dist = fabsf((pos.y - height) * XMVectorGetY(normal));
+	if (dist <= radius)
+	{
+		manifold.normals[0] = normal;
+		manifold.penetrations[0] = radius - dist;
+		manifold.contactCount = 1;
+		m_collidedFaces.setAtomic(faceIdx);
+	}
+
+	return true;
+}
+
+void HeightMap::SphereCollisionOctTree(const XMVECTOR & spherePos, float radius, HeightMapManifold& manifold)
 {
 	//broadphase for heightmap collision via linear oct-tree
 	std::stack<int> possibleCollidingFaces;
@@ -672,34 +1513,446 @@ bool HeightMap::SphereCollision(const XMVECTOR & spherePos, float radius, XMVECT
 	obj.radius = radius;
 
 	get_static_oct_tree_query_list(&m_sTreeArray, possibleCollidingFaces, obj);
-	while (!possibleCollidingFaces.empty())
-	{
-		const int top = possibleCollidingFaces.top();
 
-		//if the face is disabled -> ignore collision and pop the stack
-		if (m_pFaceData[top].m_bDisabled)
+	// Candidates are tested CLOSEST_POINT_BATCH_SIZE at a time
+	TriangleBatch batch;
+	int candidates[CLOSEST_POINT_BATCH_SIZE];
+	int candidateCount = 0;
+	float distancesSq[CLOSEST_POINT_BATCH_SIZE];
+	float minDistSq;
+
+	while (!possibleCollidingFaces.empty() || candidateCount > 0)
+	{
+		if (!possibleCollidingFaces.empty())
 		{
+			const int top = possibleCollidingFaces.top();
 			possibleCollidingFaces.pop();
+
+			//if the face is disabled -> ignore collision
+			if (m_disabledFaces.test(top))
+			{
+				continue;
+			}
+
+			candidates[candidateCount++] = top;
+			if (candidateCount < CLOSEST_POINT_BATCH_SIZE && !possibleCollidingFaces.empty())
+			{
+				continue;
+			}
+		}
+
+		GatherTriangleBatch(candidates, candidateCount, batch);
+		if (ClosestPtPointTriangleBatch(spherePos, batch, distancesSq, minDistSq) != INDEX_NONE && minDistSq <= radius * radius)
+		{
+			for (int lane = 0; lane < candidateCount; ++lane)
+			{
+				if (distancesSq[lane] <= radius * radius)
+				{
+					const int faceIdx = batch.m_faceIndices[lane];
+					add_manifold_contact(manifold, XMLoadFloat3(&m_pFaceData[faceIdx].m_vNormal), radius - sqrtf(distancesSq[lane]));
+					m_collidedFaces.setAtomic(faceIdx);
+				}
+			}
+		}
+		candidateCount = 0;
+	}
+
+	sort_manifold_deepest_first(manifold);
+}
+
+
+#if TESTING_ENABLED
+void HeightMap::RunDiagnostics()
+{
+	// Drop test spheres over every few faces at heights either side of the surface and check that 
+	// whenever the grid fast path claims a result it agrees with a brute force search of all faces
+	const float radius = 1.0f;
+	const float heightOffsets[] = { -0.75f, 0.0f, 0.5f, 0.9f, 1.5f };
+	int resolvedCount = 0;
+	int sampleCount = 0;
+	int mismatchCount = 0;
+
+	for (int f = 0; f < m_HeightMapFaceCount; f += 7)
+	{
+		for (float offset : heightOffsets)
+		{
+			const XMFLOAT3& centre = m_pFaceData[f].m_centre;
+			const XMVECTOR spherePos = XMVectorSet(centre.x, centre.y + offset, centre.z, 0.0f);
+			++sampleCount;
+
+			HeightMapManifold manifold;
+			if (!SphereCollisionGrid(spherePos, radius, manifold))
+			{
+				continue;
+			}
+			++resolvedCount;
+
+			float minDistSq = FLT_MAX;
+			int minFace = INDEX_NONE;
+			for (int g = 0; g < m_HeightMapFaceCount; ++g)
+			{
+				if (m_disabledFaces.test(g))
+				{
+					continue;
+				}
+
+				const float distSq = XMVectorGetX(XMVector3LengthSq(closestPtPointTriangle(spherePos, g) - spherePos));
+				if (distSq < minDistSq)
+				{
+					minDistSq = distSq;
+					minFace = g;
+				}
+			}
+
+			const bool bExactCollided = minDistSq <= radius * radius;
+			bool bMatch = (manifold.contactCount > 0) == bExactCollided;
+			if (bMatch && bExactCollided)
+			{
+				const float exactPenetration = radius - sqrtf(minDistSq);
+				const float normalDot = XMVectorGetX(XMVector3Dot(manifold.normals[0], XMLoadFloat3(&m_pFaceData[minFace].m_vNormal)));
+				bMatch = manifold.contactCount == 1 && fabsf(exactPenetration - manifold.penetrations[0]) < 0.001f && normalDot > 0.999f;
+			}
+
+			if (!bMatch)
+			{
+				dprintf("HeightMap: grid sphere query mismatch over face %d (offset %.2f)\n", f, offset);
+				++mismatchCount;
+			}
+		}
+	}
+
+	m_collidedFaces.clearAll();
+
+	dprintf("HeightMap: grid sphere query resolved %d of %d samples, %d mismatches\n", resolvedCount, sampleCount, mismatchCount);
+	assert(mismatchCount == 0);
+
+	// Fire rays from around every few face centres and check the batched ray test finds the same 
+	// first hit as the original per face RayTriangle loop, timing both as we go
+	const XMVECTOR rayOffsets[] = {
+		XMVectorSet(0.0f, 3.0f, 0.0f, 0.0f),
+		XMVectorSet(0.3f, 1.5f, -0.2f, 0.0f),
+		XMVectorSet(-0.4f, -2.0f, 0.1f, 0.0f),
+	};
+	const XMVECTOR rayDirs[] = {
+		XMVectorSet(0.0f, -1.0f, 0.0f, 0.0f),
+		XMVectorSet(0.3f, -1.0f, 0.2f, 0.0f),
+		XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f),
+		XMVectorSet(-0.5f, -1.0f, 0.4f, 0.0f),
+	};
+	const float raySpeeds[] = { 1.0f, 2.5f, 10.0f };
+
+	std::chrono::high_resolution_clock::duration scalarTime(0), batchTime(0);
+	int rayCount = 0;
+	int rayHitCount = 0;
+	mismatchCount = 0;
+
+	for (int f = 0; f < m_HeightMapFaceCount; f += 5)
+	{
+		const XMVECTOR centre = XMLoadFloat3(&m_pFaceData[f].m_centre);
+		for (const XMVECTOR& offset : rayOffsets)
+		{
+			for (const XMVECTOR& rayDir : rayDirs)
+			{
+				for (float raySpeed : raySpeeds)
+				{
+					const XMVECTOR rayPos = centre + offset;
+					++rayCount;
+
+					auto start = std::chrono::high_resolution_clock::now();
+					XMVECTOR scalarPos, scalarNormal;
+					int scalarFace = INDEX_NONE;
+					for (int g = 0; g < m_HeightMapFaceCount; ++g)
+					{
+						float colDist;
+						if (!m_disabledFaces.test(g) && RayTriangle(g, rayPos, rayDir, scalarPos, scalarNormal, colDist) &&
+							colDist <= raySpeed && colDist >= 0.0f)
+						{
+							scalarFace = g;
+							break;
+						}
+					}
+					scalarTime += std::chrono::high_resolution_clock::now() - start;
+
+					start = std::chrono::high_resolution_clock::now();
+					XMVECTOR batchPos, batchNormal;
+					const int batchFace = RayCollisionFace(rayPos, rayDir, raySpeed, batchPos, batchNormal);
+					batchTime += std::chrono::high_resolution_clock::now() - start;
+
+					bool bMatch = scalarFace == batchFace;
+					if (bMatch && batchFace != INDEX_NONE)
+					{
+						++rayHitCount;
+						bMatch = XMVectorGetX(XMVector3LengthSq(scalarPos - batchPos)) < 0.000001f;
+					}
+
+					if (!bMatch)
+					{
+						dprintf("HeightMap: batched ray test mismatch from face %d (scalar %d, batched %d)\n", f, scalarFace, batchFace);
+						++mismatchCount;
+					}
+				}
+			}
+		}
+	}
+
+	const double scalarUs = std::chrono::duration<double, std::micro>(scalarTime).count() / rayCount;
+	const double batchUs = std::chrono::duration<double, std::micro>(batchTime).count() / rayCount;
+	dprintf("HeightMap: %d rays, %d hits, %d mismatches. Scalar %.2f us/ray, batched %.2f us/ray (%.1fx)\n",
+		rayCount, rayHitCount, mismatchCount, scalarUs, batchUs, scalarUs / batchUs);
+	assert(mismatchCount == 0);
+
+	// Short rays fired at each enabled face from just in front of it, as the bodies' rays are, 
+	// must hit well inside the backoff distance
+	int shortRayMissCount = 0;
+	for (int f = 0; f < m_HeightMapFaceCount; ++f)
+	{
+		if (m_disabledFaces.test(f))
+		{
 			continue;
 		}
 
-		XMVECTOR closestPoint = closestPtPointTriangle(spherePos, top);
-		XMVECTOR v = closestPoint - spherePos;
+		const XMVECTOR normal = XMLoadFloat3(&m_pFaceData[f].m_vNormal);
+		const XMVECTOR rayPos = XMLoadFloat3(&m_pFaceData[f].m_centre) + normal * 0.5f;
+		XMVECTOR colPos, colNormal;
+		if (RayCollisionFace(rayPos, -normal, 1.0f, colPos, colNormal) == INDEX_NONE)
+		{
+			dprintf("HeightMap: short ray missed face %d\n", f);
+			++shortRayMissCount;
+		}
+	}
+	assert(shortRayMissCount == 0);
+	// Closest point kernel in isolation: pre-gathered batches of consecutive faces, each queried from 
+	// a point offset from its first face, against eight calls to the scalar closestPtPointTriangle
+	const int batchCount = min(m_HeightMapFaceCount / CLOSEST_POINT_BATCH_SIZE, 512);
+	const int benchRepeats = 20;
+	TriangleBatch* pBatches = new TriangleBatch[batchCount];
+	XMFLOAT3* pQueryPoints = new XMFLOAT3[batchCount];
+
+	for (int b = 0; b < batchCount; ++b)
+	{
+		int faceIndices[CLOSEST_POINT_BATCH_SIZE];
+		for (int lane = 0; lane < CLOSEST_POINT_BATCH_SIZE; ++lane)
+		{
+			faceIndices[lane] = b * CLOSEST_POINT_BATCH_SIZE + lane;
+		}
+		GatherTriangleBatch(faceIndices, CLOSEST_POINT_BATCH_SIZE, pBatches[b]);
+		pQueryPoints[b] = m_pFaceData[faceIndices[0]].m_centre + XMFLOAT3(0.3f, 0.8f, -0.2f);
+	}
+
+	mismatchCount = 0;
+	float scalarSink = 0.0f, batchSink = 0.0f;
+	scalarTime = batchTime = std::chrono::high_resolution_clock::duration(0);
 
-		const float dist = XMVectorGetX(XMVector3Dot(v, v));
-		if (dist <= radius * radius)
+	for (int repeat = 0; repeat < benchRepeats; ++repeat)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int b = 0; b < batchCount; ++b)
 		{
-			colNormN = XMLoadFloat3(&m_pFaceData[top].m_vNormal);
-			penetration = radius - sqrtf(dist);
-			m_pFaceData[top].m_bCollided = true;
+			const XMVECTOR queryPoint = XMLoadFloat3(&pQueryPoints[b]);
+			float minDistSq = FLT_MAX;
+			for (int lane = 0; lane < CLOSEST_POINT_BATCH_SIZE; ++lane)
+			{
+				const XMVECTOR v = closestPtPointTriangle(queryPoint, pBatches[b].m_faceIndices[lane]) - queryPoint;
+				minDistSq = min(minDistSq, XMVectorGetX(XMVector3Dot(v, v)));
+			}
+			scalarSink += minDistSq;
+		}
+		scalarTime += std::chrono::high_resolution_clock::now() - start;
 
-			return true;
+		start = std::chrono::high_resolution_clock::now();
+		for (int b = 0; b < batchCount; ++b)
+		{
+			float distancesSq[CLOSEST_POINT_BATCH_SIZE];
+			float minDistSq;
+			ClosestPtPointTriangleBatch(XMLoadFloat3(&pQueryPoints[b]), pBatches[b], distancesSq, minDistSq);
+			batchSink += minDistSq;
 		}
-		possibleCollidingFaces.pop();
+		batchTime += std::chrono::high_resolution_clock::now() - start;
 	}
-	return false;
-}
 
+	for (int b = 0; b < batchCount; ++b)
+	{
+		const XMVECTOR queryPoint = XMLoadFloat3(&pQueryPoints[b]);
+		float distancesSq[CLOSEST_POINT_BATCH_SIZE];
+		float minDistSq;
+		ClosestPtPointTriangleBatch(queryPoint, pBatches[b], distancesSq, minDistSq);
+
+		for (int lane = 0; lane < CLOSEST_POINT_BATCH_SIZE; ++lane)
+		{
+			const int faceIdx = pBatches[b].m_faceIndices[lane];
+			const XMVECTOR v = closestPtPointTriangle(queryPoint, faceIdx) - queryPoint;
+			const float distSq = XMVectorGetX(XMVector3Dot(v, v));
+
+			if (fabsf(distSq - distancesSq[lane]) > 0.0001f * max(1.0f, distSq) || distancesSq[lane] < minDistSq)
+			{
+				dprintf("HeightMap: batched closest point mismatch on face %d\n", faceIdx);
+				++mismatchCount;
+			}
+		}
+	}
+
+	const int pointTriangleTests = batchCount * CLOSEST_POINT_BATCH_SIZE * benchRepeats;
+	dprintf("HeightMap: closest point %d mismatches. Scalar %.1f ns/triangle, batched %.1f ns/triangle (checksums %.1f, %.1f)\n",
+		mismatchCount,
+		std::chrono::duration<double, std::nano>(scalarTime).count() / pointTriangleTests,
+		std::chrono::duration<double, std::nano>(batchTime).count() / pointTriangleTests,
+		scalarSink, batchSink);
+	assert(mismatchCount == 0);
+
+	SAFE_FREE_ARR(pBatches);
+	SAFE_FREE_ARR(pQueryPoints);
+
+	// Check the terrain mesh buffers reproduce every collision face, time generating them against 
+	// the size of the old unindexed six vertices per cell mesh, then check that the incremental flag 
+	// rebuild matches a full regeneration after colouring and clearing a scattering of faces
+	const int generateRepeats = 10;
+	const size_t vertexBytes = sizeof(Vertex_Pos3fColour4ubNormal3fTex2f) * m_HeightMapVtxCount;
+	Vertex_Pos3fColour4ubNormal3fTex2f* pVtxs = static_cast<Vertex_Pos3fColour4ubNormal3fTex2f*>(_mm_malloc(vertexBytes, 64));
+	Vertex_Pos3fColour4ubNormal3fTex2f* pScalarVtxs = static_cast<Vertex_Pos3fColour4ubNormal3fTex2f*>(_mm_malloc(vertexBytes, 64));
+	uint32_t* pIndices = new uint32_t[m_HeightMapIndexCount];
+	uint8_t* pFlags = new uint8_t[m_HeightMapFaceCount];
+
+	// Both writers target plain heap memory, the scalar one a vertex constructor and copy at a time
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int repeat = 0; repeat < generateRepeats; ++repeat)
+	{
+		for (int v = 0; v < m_HeightMapVtxCount; ++v)
+		{
+			GenerateVertex(v, pScalarVtxs[v]);
+		}
+	}
+	const double scalarGenerateMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / generateRepeats;
+
+	start = std::chrono::high_resolution_clock::now();
+	for (int repeat = 0; repeat < generateRepeats; ++repeat)
+	{
+		GenerateVertexRange(0, m_HeightMapVtxCount, pVtxs);
+	}
+	const double streamGenerateMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / generateRepeats;
+
+	start = std::chrono::high_resolution_clock::now();
+	for (int repeat = 0; repeat < generateRepeats; ++repeat)
+	{
+		GenerateVertexData(pVtxs);
+	}
+	const double generateMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / generateRepeats;
+
+	// The batched normals are normalised with a different instruction sequence to XMVector3Normalize
+	mismatchCount = 0;
+	for (int v = 0; v < m_HeightMapVtxCount; ++v)
+	{
+		const Vertex_Pos3fColour4ubNormal3fTex2f& a = pVtxs[v];
+		const Vertex_Pos3fColour4ubNormal3fTex2f& b = pScalarVtxs[v];
+		if (a.pos.x != b.pos.x || a.pos.y != b.pos.y || a.pos.z != b.pos.z || a.tex.x != b.tex.x || a.tex.y != b.tex.y ||
+			memcmp(&a.colour, &b.colour, sizeof(VertexColour)) != 0 || fabsf(a.normal.x - b.normal.x) > 1e-6f ||
+			fabsf(a.normal.y - b.normal.y) > 1e-6f || fabsf(a.normal.z - b.normal.z) > 1e-6f)
+		{
+			dprintf("HeightMap: streamed vertex %d doesn't match the scalar vertex\n", v);
+			++mismatchCount;
+		}
+	}
+
+	const double vertexGB = (double)vertexBytes / (1024.0 * 1024.0 * 1024.0);
+	dprintf("HeightMap: vertex writers %.2f GB/s scalar, %.2f GB/s streamed, %.2f GB/s streamed on up to %d threads, %d mismatches\n",
+		vertexGB / (scalarGenerateMs * 0.001), vertexGB / (streamGenerateMs * 0.001), vertexGB / (generateMs * 0.001),
+		Application::s_pApp->GetJobSystem()->getThreadCount(), mismatchCount);
+	assert(mismatchCount == 0);
+
+	start = std::chrono::high_resolution_clock::now();
+	GenerateChunkLods(pIndices);
+	const double lodGenerateMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+	// Level 0 of each chunk is its cells in order, two faces a cell
+	mismatchCount = 0;
+	for (const TerrainChunk& chunk : m_chunks)
+	{
+		const uint32_t* pChunkIndices = &pIndices[chunk.m_firstIndex[0]];
+		for (int l = chunk.m_firstCellL; l < chunk.m_firstCellL + chunk.m_cellsLong; ++l)
+		{
+			for (int w = chunk.m_firstCellW; w < chunk.m_firstCellW + chunk.m_cellsWide; ++w)
+			{
+				for (int half = 0; half < 2; ++half)
+				{
+					const int f = (l * (m_HeightMapWidth - 1) + w) * 2 + half;
+					const XMFLOAT3* pFaceVerts[3] = { &m_pFaceData[f].m_v0, &m_pFaceData[f].m_v1, &m_pFaceData[f].m_v2 };
+					for (int corner = 0; corner < 3; ++corner)
+					{
+						const uint32_t index = *pChunkIndices++;
+						if (index >= (uint32_t)m_HeightMapVtxCount || pVtxs[index].pos.x != pFaceVerts[corner]->x ||
+							pVtxs[index].pos.y != pFaceVerts[corner]->y || pVtxs[index].pos.z != pFaceVerts[corner]->z)
+						{
+							dprintf("HeightMap: terrain mesh doesn't match face %d\n", f);
+							++mismatchCount;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < m_HeightMapIndexCount; ++i)
+	{
+		if (pIndices[i] >= (uint32_t)(m_HeightMapVtxCount + m_skirtVtxCount))
+		{
+			dprintf("HeightMap: terrain index %d is out of range\n", i);
+			++mismatchCount;
+		}
+	}
+
+	// Triangles submitted for the whole map, ignoring the frustum, with the camera pulled further and further back
+	for (float distance = 50.0f; distance <= 3200.0f; distance *= 4.0f)
+	{
+		const XMVECTOR cameraPos = XMVectorSet(0.0f, distance, -distance, 0.0f);
+		int lodTriangles = 0;
+		int lodCounts[HEIGHTMAP_LOD_COUNT] = {};
+		for (int chunkIndex = 0; chunkIndex < (int)m_chunks.size(); ++chunkIndex)
+		{
+			const int lod = SelectChunkLod(chunkIndex, cameraPos);
+			lodTriangles += m_chunks[chunkIndex].m_indexCount[lod] / 3;
+			++lodCounts[lod];
+		}
+
+		dprintf("HeightMap: camera at %.0f, %d triangles against %d at full resolution, chunks per level %d %d %d %d %d\n",
+			distance, lodTriangles, m_HeightMapFaceCount, lodCounts[0], lodCounts[1], lodCounts[2], lodCounts[3], lodCounts[4]);
+	}
+	dprintf("HeightMap: %d chunk levels generated in %.3f ms, %d indices for %d faces, %d skirt vertices\n",
+		(int)m_chunks.size() * HEIGHTMAP_LOD_COUNT, lodGenerateMs, m_HeightMapIndexCount, m_HeightMapFaceCount, m_skirtVtxCount);
+
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		for (int f = 0; f < m_HeightMapFaceCount; f += 97)
+		{
+			if (pass == 0)
+			{
+				m_collidedFaces.set(f);
+			}
+			else
+			{
+				m_collidedFaces.reset(f);
+			}
+		}
+
+		RebuildFaceFlags(m_collidedFaces, m_disabledFaces);
+		GenerateFaceFlags(m_collidedFaces, m_disabledFaces, 0, m_HeightMapFaceCount, pFlags);
+		if (memcmp(pFlags, m_pFaceFlags, m_HeightMapFaceCount) != 0)
+		{
+			dprintf("HeightMap: incremental face flag rebuild doesn't match a full rebuild\n");
+			++mismatchCount;
+		}
+	}
+
+	const double vertexMB = (double)m_HeightMapVtxCount * sizeof(Vertex_Pos3fColour4ubNormal3fTex2f) / (1024.0 * 1024.0);
+	const double unindexedMB = (double)m_HeightMapFaceCount * 3 * sizeof(Vertex_Pos3fColour4ubNormal3fTex2f) / (1024.0 * 1024.0);
+	dprintf("HeightMap: vertex generation %.3f ms for %.2f MB (unindexed mesh was %.2f MB), face flags %d bytes, %d mismatches\n",
+		generateMs, vertexMB, unindexedMB, m_HeightMapFaceCount, mismatchCount);
+	assert(mismatchCount == 0);
+
+	_mm_free(pVtxs);
+	_mm_free(pScalarVtxs);
+	SAFE_FREE_ARR(pIndices);
+	SAFE_FREE_ARR(pFlags);
+}
+#endif
 
 // Function:	rayTriangle
 // Description: Tests a ray for intersection with a triangle
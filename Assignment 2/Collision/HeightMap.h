@@ -11,7 +11,10 @@
 
 #include "Application.h"
 #include "StaticOctTree.h"	
+#include "BitArray.h"
 
+struct HeightMapManifold;
+struct Frustum;
 
 static const char * const g_aTextureFileNames[] = {
 	"Resources/Intersection.dds",
@@ -24,6 +27,28 @@ static const char * const g_aTextureFileNames[] = {
 
 #define Y_DISABLE_VALUE 4.0f
 
+#define CLOSEST_POINT_BATCH_SIZE 8
+
+// Bits of the per face flag buffer read by the terrain pixel shader
+#define FACE_FLAG_COLLIDED 1
+#define FACE_FLAG_DISABLED 2
+#define FACE_FLAG_SHADED 4 // face normal x < 0.25, drawn slightly darker
+
+// Vertices written per streamed batch, 16 36 byte vertices being exactly nine 64 byte lines
+#define VERTEX_STREAM_BATCH 16
+// Fewest batches worth handing to a job when generating the vertices
+#define VERTEX_STREAM_MIN_RANGE_BATCHES 1024
+
+// Grid cells along each side of a terrain chunk, the unit the terrain is frustum culled and drawn in
+#define HEIGHTMAP_CHUNK_CELLS 16
+// Levels of detail built for each chunk, level n stepping 1 << n cells at a time, down to one quad
+#define HEIGHTMAP_LOD_COUNT 5
+// Largest height error a chunk's level may have as a fraction of its distance from the camera, 
+// about three pixels at 720p with the perspective camera
+#define HEIGHTMAP_LOD_ERROR_RATIO 0.002f
+// Fewest chunks worth handing to a job when generating the levels
+#define HEIGHTMAP_LOD_MIN_RANGE_CHUNKS 16
+
 static const size_t NUM_TEXTURE_FILES = sizeof g_aTextureFileNames / sizeof g_aTextureFileNames[0];
 
 class HeightMap
@@ -33,13 +58,24 @@ public:
 	HeightMap(char* filename, float gridSize, float heightRange);
 	~HeightMap();
 
-	void Draw(float frameCount);
-	void Tick() { RebuildVertexData(); }
+	// Draws the chunks at least partly inside the frustum, each at the coarsest level 
+	// whose error is small enough from cameraPos
+	void Draw(float frameCount, const Frustum& frustum, const XMVECTOR& cameraPos);
+	// Uploads the face colours from a copy of the collided and disabled flags published by the 
+	// physics thread. Render thread only, the flags themselves belong to the physics thread
+	void Tick(const BitArray& collided, const BitArray& disabled) { RebuildFaceFlags(collided, disabled); }
 	bool ReloadShader();
 	void DeleteShader();
 
 	bool RayCollision(XMVECTOR& rayPos, XMVECTOR rayDir, float speed, XMVECTOR& colPos, XMVECTOR& colNormN);
-	bool SphereCollision(const XMVECTOR& spherePos, float radius, XMVECTOR& colNormN, float& penetration);
+	// Fills the manifold with up to MAX_MANIFOLD_CONTACTS contacts, deepest first. Only the manifold and 
+	// the collided face flags are written, the flags atomically, so different manifolds can be filled at once
+	bool SphereCollision(const XMVECTOR& spherePos, float radius, HeightMapManifold& manifold);
+
+#if TESTING_ENABLED
+	// Cross-checks the optimised collision queries against brute force reference results
+	void RunDiagnostics();
+#endif
 
 	int DisableBelowLevel(float fY);
 	int EnableAll(void);
@@ -50,6 +86,10 @@ public:
 	int GetWidth() const { return m_HeightMapWidth; }
 	int GetLength() const { return m_HeightMapLength; }
 
+	const BitArray& GetCollidedFaces() const { return m_collidedFaces; }
+	void ClearCollidedFaces() { m_collidedFaces.clearAll(); }
+	const BitArray& GetDisabledFaces() const { return m_disabledFaces; }
+
 private:
 
 	struct FaceCollisionData
@@ -59,17 +99,90 @@ private:
 		XMFLOAT3 m_v2;
 		XMFLOAT3 m_vNormal;
 		XMFLOAT3 m_centre;
-		bool m_bCollided; // Debug colouring
-		bool m_bDisabled;
+	};
+
+	// A rectangle of grid cells drawn with one indexed draw. Each level's indices are contiguous, 
+	// a row of quads at a time followed by the skirts hanging from the edges shared with other 
+	// chunks, which hide the cracks where neighbouring levels differ
+	struct TerrainChunk
+	{
+		int m_firstCellW;
+		int m_firstCellL;
+		int m_cellsWide;
+		int m_cellsLong;
+		int m_firstIndex[HEIGHTMAP_LOD_COUNT];
+		int m_indexCount[HEIGHTMAP_LOD_COUNT];
+		float m_lodError[HEIGHTMAP_LOD_COUNT]; // Largest height difference from the full resolution grid
+	};
+
+	// Ray test data for four consecutive faces, one face per lane, built once in BuildCollisionData
+	struct DX_ALIGNED FaceRayBlock
+	{
+		OP_NEW_ARR;
+		OP_DEL_ARR;
+
+		XMVECTOR m_v0[3];		// x, y, z of the first vertex
+		XMVECTOR m_edge1[3];	// v1 - v0
+		XMVECTOR m_edge2[3];	// v2 - v0
+	};
+
+	// Up to CLOSEST_POINT_BATCH_SIZE faces gathered for ClosestPtPointTriangleBatch, 
+	// as two four wide SoA halves of x, y, z
+	struct DX_ALIGNED TriangleBatch
+	{
+		OP_NEW_ARR;
+		OP_DEL_ARR;
+
+		XMVECTOR m_a[2][3];
+		XMVECTOR m_b[2][3];
+		XMVECTOR m_c[2][3];
+		int m_faceIndices[CLOSEST_POINT_BATCH_SIZE];
+		int m_count;
 	};
 
 	bool LoadHeightMap(char* filename, float gridSize, float heightRange);
 	bool RayTriangle(int nFaceIndex, const XMVECTOR& rayPos, const XMVECTOR& rayDir, XMVECTOR& colPos, XMVECTOR& colNormN, float& colDist);
+	// Moller-Trumbore test of a splatted ray against the four faces of a block. 
+	// Returns a bitmask of the lanes hit within maxDist, with the hit distances in colDists
+	int RayTriangleBatch(const FaceRayBlock& block, const XMVECTOR rayPos[3], const XMVECTOR rayDir[3], const XMVECTOR& maxDist, XMFLOAT4& colDists) const;
+	// Lowest indexed enabled face hit by the ray within raySpeed, or INDEX_NONE. Does not touch the face flags
+	int RayCollisionFace(const XMVECTOR& rayPos, const XMVECTOR& rayDir, float raySpeed, XMVECTOR& colPos, XMVECTOR& colNormN) const;
 	bool PointPlane(const XMVECTOR& vert0, const XMVECTOR& vert1, const XMVECTOR& vert2, const XMVECTOR& pointPos);
-	void RebuildVertexData(void);
+	// Regenerates and uploads the flags of faces whose state in collided and disabled changed since the last call
+	void RebuildFaceFlags(const BitArray& collided, const BitArray& disabled);
+	// The terrain mesh is one vertex per height sample followed by the skirt vertices, indexed 
+	// chunk by chunk at every level. The shader works the face index out from the grid position 
+	// in the texture coordinates, whatever the level. None of these touch D3D
+	// GenerateVertexData streams the vertices out in batches split over worker threads, pVtxs must 
+	// be 16 byte aligned. GenerateVertex is the plain one vertex at a time version
+	void GenerateVertexData(Vertex_Pos3fColour4ubNormal3fTex2f* pVtxs) const;
+	void GenerateVertexRange(int firstVtx, int endVtx, Vertex_Pos3fColour4ubNormal3fTex2f* pVtxs) const;
+	void GenerateVertex(int mapIndex, Vertex_Pos3fColour4ubNormal3fTex2f& vtx) const;
+	// Copies of the vertices along the chunk edges, dropped by m_skirtDepth, after the grid's
+	void GenerateSkirtVertices(Vertex_Pos3fColour4ubNormal3fTex2f* pVtxs) const;
+	// Splits the grid into chunks, with their bounding boxes and index ranges, before anything is generated
+	void BuildChunks(void);
+	// Writes every level of every chunk into pIndices and measures their errors, split over worker threads
+	void GenerateChunkLods(uint32_t* pIndices);
+	void GenerateChunkLodRange(int firstChunk, int endChunk, uint32_t* pIndices);
+	int SkirtRowVertex(int chunkRow, int w) const { return m_HeightMapVtxCount + (chunkRow - 1) * m_HeightMapWidth + w; }
+	int SkirtColumnVertex(int chunkColumn, int l) const { return m_HeightMapVtxCount + (m_chunksLong - 1) * m_HeightMapWidth + (chunkColumn - 1) * m_HeightMapLength + l; }
+	int SelectChunkLod(int chunkIndex, const XMVECTOR& cameraPos) const;
+	// Writes the FACE_FLAG_* bits of faces [firstFace, endFace) at their place in pFlags
+	void GenerateFaceFlags(const BitArray& collided, const BitArray& disabled, int firstFace, int endFace, uint8_t* pFlags) const;
 	bool PointOverQuad(XMVECTOR& vPos, XMVECTOR& v0, XMVECTOR& v1, XMVECTOR& v2);
 	void BuildCollisionData(void);
 	XMVECTOR closestPtPointTriangle(const XMVECTOR& pos, int faceIdx);
+	void GatherTriangleBatch(const int* pFaceIndices, int count, TriangleBatch& batch) const;
+	// Squared distance from pos to each face of the batch (lanes past the batch count are FLT_MAX). 
+	// Returns the index of the nearest face, with its squared distance in minDistSq
+	int ClosestPtPointTriangleBatch(const XMVECTOR& pos, const TriangleBatch& batch, float distancesSq[CLOSEST_POINT_BATCH_SIZE], float& minDistSq) const;
+
+	// Fast path for SphereCollision: reads the triangle under the sphere centre straight from the grid
+	// and resolves the single contact analytically. Returns false when the sphere's footprint leaves 
+	// that triangle, in which case the manifold is untouched and the octree query has to be used instead.
+	bool SphereCollisionGrid(const XMVECTOR& spherePos, float radius, HeightMapManifold& manifold);
+	void SphereCollisionOctTree(const XMVECTOR& spherePos, float radius, HeightMapManifold& manifold);
 
 	void SetupStaticOctTree();
 
@@ -79,19 +192,45 @@ private:
 	XMFLOAT3 GetAveragedVertexNormal(int index, int row);
 
 	ID3D11Buffer *m_pHeightMapBuffer;
+	ID3D11Buffer *m_pHeightMapIndexBuffer;
+	ID3D11Buffer *m_pFaceFlagBuffer;
+	ID3D11ShaderResourceView *m_pFaceFlagView;
 
 	int m_HeightMapWidth;
 	int m_HeightMapLength;
-	int m_HeightMapVtxCount;
+	int m_HeightMapVtxCount; // Of the grid, not counting the skirts
+	int m_skirtVtxCount;
+	int m_HeightMapIndexCount;
 	int m_HeightMapFaceCount;
+	float m_gridSize;
 	XMFLOAT4* m_pHeightMap;
 	FaceCollisionData* m_pFaceData;
-	Vertex_Pos3fColour4ubNormal3fTex2f* m_pMapVtxs;
+	// Per face flags, kept out of m_pFaceData so clearing or testing them doesn't touch the geometry
+	BitArray m_collidedFaces; // Debug colouring
+	BitArray m_disabledFaces;
+	BitArray m_shadedFaces;
+	// The flags m_pFaceFlags and the flag buffer were last built from
+	BitArray m_uploadedCollidedFaces;
+	BitArray m_uploadedDisabledFaces;
+	FaceRayBlock* m_pFaceRayBlocks;
+	int m_faceRayBlockCount;
+	uint8_t* m_pFaceFlags; // CPU copy of the flag buffer
+
+	std::vector<TerrainChunk> m_chunks;
+	int m_chunksWide;
+	int m_chunksLong;
+	float m_skirtDepth;
+	// Chunk bounding boxes as centres and half extents, contiguous for CullBoxes
+	std::vector<XMFLOAT4> m_chunkCentres;
+	std::vector<XMFLOAT4> m_chunkExtents;
+	std::vector<int> m_visibleChunks;
 
 	Application::Shader m_shader;
 
 	ID3D11Buffer *m_pPSCBuffer;
 	ID3D11Buffer *m_pVSCBuffer;
+	unsigned m_psCBufferSizeBytes;
+	unsigned m_vsCBufferSizeBytes;
 
 	int m_psCBufferSlot;
 	int m_psFrameCount;
@@ -101,6 +240,9 @@ private:
 	int m_psTexture2;
 	int m_psMaterialMap;
 	int m_vsMaterialMap;
+	int m_psFaceFlags;
+	int m_psMapCellsWide;
+	int m_psMapCellsLong;
 
 	int m_vsCBufferSlot;
 	int m_vsFrameCount;
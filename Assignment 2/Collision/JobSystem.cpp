@@ -0,0 +1,234 @@
+#include "JobSystem.h"
+
+#include <assert.h>
+
+// The job system whose worker is running on this thread, if any, and the worker's queue
+static thread_local const JobSystem* s_pWorkerJobSystem = nullptr;
+static thread_local int s_workerQueueIndex = -1;
+
+JobSystem::JobSystem(int workerCount)
+{
+	if (workerCount < 0)
+	{
+		const int hardwareThreads = (int)std::thread::hardware_concurrency();
+		workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+	}
+
+	m_queueCount = workerCount + 1;
+	m_pQueues = new WorkQueue[m_queueCount];
+
+	m_workers.reserve(workerCount);
+	for (int worker = 0; worker < workerCount; ++worker)
+	{
+		m_workers.push_back(std::thread(&JobSystem::workerMain, this, worker));
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+		m_bStopping.store(true);
+	}
+	m_wake.notify_all();
+
+	for (auto& worker : m_workers)
+	{
+		worker.join();
+	}
+
+	delete[] m_pQueues;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void JobSystem::run(Job job, JobCounter* pCounter)
+{
+	if (pCounter)
+	{
+		pCounter->m_count.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	push(QueuedJob{ std::move(job), pCounter });
+}
+
+void JobSystem::runAfter(JobCounter& dependency, Job job, JobCounter* pCounter)
+{
+	if (pCounter)
+	{
+		pCounter->m_count.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	{
+		// The count only reaches zero with the lock held, so the job is either added before the
+		// continuations are taken or sees that they already have been
+		std::lock_guard<std::mutex> lock(dependency.m_mutex);
+		if (dependency.m_count.load(std::memory_order_relaxed) != 0)
+		{
+			JobSystem* pThis = this;
+			dependency.m_continuations.push_back([pThis, job, pCounter]() mutable { pThis->push(QueuedJob{ std::move(job), pCounter }); });
+			return;
+		}
+	}
+
+	push(QueuedJob{ std::move(job), pCounter });
+}
+
+void JobSystem::wait(JobCounter& counter)
+{
+	const int queueIndex = getQueueIndex();
+
+	while (!counter.isDone())
+	{
+		if (!tryRunJob(queueIndex))
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	// The last job to finish still holds the lock for a moment after the count reaches zero,
+	// and the counter mustn't go out of scope under it
+	std::lock_guard<std::mutex> lock(counter.m_mutex);
+}
+
+void JobSystem::parallelFor(int begin, int end, int grainSize, const std::function<void(int, int)>& body)
+{
+	const int count = end - begin;
+	if (count <= 0)
+	{
+		return;
+	}
+
+	if (grainSize < 1)
+	{
+		grainSize = 1;
+	}
+
+	// Enough ranges for every thread to have a few, but none smaller than grainSize
+	const int maxRangeCount = getThreadCount() * JOB_RANGES_PER_THREAD;
+	int rangeCount = count / grainSize;
+	rangeCount = rangeCount < 1 ? 1 : rangeCount > maxRangeCount ? maxRangeCount : rangeCount;
+
+	JobCounter counter;
+	for (int range = 1; range < rangeCount; ++range)
+	{
+		const int first = begin + (int)((long long)count * range / rangeCount);
+		const int last = begin + (int)((long long)count * (range + 1) / rangeCount);
+		run([&body, first, last]() { body(first, last); }, &counter);
+	}
+
+	// The first range is run here rather than queued, it would only be popped straight back off
+	body(begin, begin + count / rangeCount);
+
+	wait(counter);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void JobSystem::workerMain(int queueIndex)
+{
+	s_pWorkerJobSystem = this;
+	s_workerQueueIndex = queueIndex;
+
+	while (!m_bStopping.load(std::memory_order_relaxed))
+	{
+		if (tryRunJob(queueIndex))
+		{
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_sleepMutex);
+		m_wake.wait(lock, [this]() { return m_bStopping.load() || m_queuedJobCount.load() > 0; });
+	}
+}
+
+int JobSystem::getQueueIndex() const
+{
+	return s_pWorkerJobSystem == this ? s_workerQueueIndex : m_queueCount - 1;
+}
+
+void JobSystem::push(QueuedJob&& queuedJob)
+{
+	WorkQueue& queue = m_pQueues[getQueueIndex()];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back(std::move(queuedJob));
+	}
+	m_queuedJobCount.fetch_add(1);
+
+	// Taking the lock means a worker about to sleep either sees the new count or is already waiting for the notify
+	{
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+	}
+	m_wake.notify_one();
+}
+
+bool JobSystem::tryRunJob(int queueIndex)
+{
+	QueuedJob queuedJob;
+	bool bFound = false;
+
+	// Own queue from the back, then the others' from the front
+	for (int offset = 0; offset < m_queueCount && !bFound; ++offset)
+	{
+		WorkQueue& queue = m_pQueues[(queueIndex + offset) % m_queueCount];
+
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.jobs.empty())
+		{
+			continue;
+		}
+
+		if (offset == 0)
+		{
+			queuedJob = std::move(queue.jobs.back());
+			queue.jobs.pop_back();
+		}
+		else
+		{
+			queuedJob = std::move(queue.jobs.front());
+			queue.jobs.pop_front();
+		}
+		bFound = true;
+	}
+
+	if (!bFound)
+	{
+		return false;
+	}
+
+	m_queuedJobCount.fetch_sub(1);
+
+	queuedJob.job();
+	finish(queuedJob.pCounter);
+
+	return true;
+}
+
+void JobSystem::finish(JobCounter* pCounter)
+{
+	if (!pCounter)
+	{
+		return;
+	}
+
+	std::vector<std::function<void()>> continuations;
+	{
+		std::lock_guard<std::mutex> lock(pCounter->m_mutex);
+
+		const int previous = pCounter->m_count.fetch_sub(1, std::memory_order_acq_rel);
+		assert(previous > 0);
+
+		if (previous == 1)
+		{
+			continuations.swap(pCounter->m_continuations);
+		}
+	}
+
+	for (auto& continuation : continuations)
+	{
+		continuation();
+	}
+}
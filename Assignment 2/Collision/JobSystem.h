@@ -0,0 +1,102 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Ranges parallelFor aims to split into per thread, so threads that finish early have some to steal
+#define JOB_RANGES_PER_THREAD 4
+
+typedef std::function<void()> Job;
+
+class JobCounter;
+
+// Work-stealing job system. Each thread has its own deque of jobs; it pushes and pops its own at
+// the back, so the most recently split work stays in its cache, and when that runs dry it steals
+// from the front of the others'. Threads that aren't workers share one extra deque, and help run
+// jobs whenever they wait, so the calling thread is never idle either
+class JobSystem
+{
+public:
+
+	// workerCount threads are started besides the ones that call in, -1 for one less than the hardware threads
+	explicit JobSystem(int workerCount = -1);
+	~JobSystem();
+
+	// Queues job. If pCounter is given it counts the job until it has finished
+	void run(Job job, JobCounter* pCounter = nullptr);
+	// As run, but the job isn't queued until dependency reaches zero
+	void runAfter(JobCounter& dependency, Job job, JobCounter* pCounter = nullptr);
+	// Runs queued jobs until counter reaches zero
+	void wait(JobCounter& counter);
+
+	// Calls body(first, end) for ranges covering [begin, end) of at least grainSize each where
+	// possible, on whichever threads are free, and returns once they have all finished
+	void parallelFor(int begin, int end, int grainSize, const std::function<void(int, int)>& body);
+
+	// Worker threads plus the calling thread
+	int getThreadCount() const { return (int)m_workers.size() + 1; }
+
+private:
+
+	struct QueuedJob
+	{
+		Job job;
+		JobCounter* pCounter;
+	};
+
+	struct WorkQueue
+	{
+		std::mutex mutex;
+		std::deque<QueuedJob> jobs;
+	};
+
+	void workerMain(int queueIndex);
+	int getQueueIndex() const;
+	void push(QueuedJob&& queuedJob);
+	// Pops a job from the queue at queueIndex or steals one from another, and runs it. False if there were none
+	bool tryRunJob(int queueIndex);
+	void finish(JobCounter* pCounter);
+
+	std::vector<std::thread> m_workers;
+	// One per worker, then the one shared by every other thread
+	WorkQueue* m_pQueues = nullptr;
+	int m_queueCount = 0;
+
+	std::atomic<int> m_queuedJobCount{ 0 };
+	std::mutex m_sleepMutex;
+	std::condition_variable m_wake;
+	std::atomic<bool> m_bStopping{ false };
+
+	JobSystem(const JobSystem&);
+	JobSystem& operator=(const JobSystem&);
+};
+
+// Jobs run with a counter add one to it when queued and take one off when they finish, so waiting
+// for it to reach zero waits for all of them. Jobs queued with runAfter are held here until it does
+class JobCounter
+{
+public:
+
+	JobCounter() {}
+
+	bool isDone() const { return m_count.load(std::memory_order_acquire) == 0; }
+
+private:
+
+	friend class JobSystem;
+
+	std::atomic<int> m_count{ 0 };
+	std::mutex m_mutex;
+	std::vector<std::function<void()>> m_continuations;
+
+	JobCounter(const JobCounter&);
+	JobCounter& operator=(const JobCounter&);
+};
+
+#endif
@@ -28,5 +28,15 @@
 	_mm_free(p);\
 }\
 
+#define OP_NEW_ARR void* operator new[](size_t i)\
+{\
+	return _mm_malloc(i, 16);\
+}\
+
+#define OP_DEL_ARR void operator delete[](void* p) \
+{\
+	_mm_free(p);\
+}\
+
 
 #endif
\ No newline at end of file
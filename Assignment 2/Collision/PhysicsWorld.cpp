@@ -1,20 +1,32 @@
 #include "PhysicsWorld.h"
 #include "XMVectorUtils.h"
 #include "DynamicOctTree.h"
+#include "JobSystem.h"
 
-PhysicsWorld::PhysicsWorld(DynamicBody * pDynamicBodies[SPHERE_COUNT])
+#include <algorithm>
+
+PhysicsWorld::PhysicsWorld(DynamicBody * pDynamicBodies[SPHERE_COUNT], JobSystem* pJobSystem)
+	: m_pJobSystem(pJobSystem)
 {
 	for (int i = 0; i < SPHERE_COUNT; ++i)
 	{
 		m_pDynamicBodies[i] = pDynamicBodies[i];
+		m_pDynamicBodies[i]->setBodyIndex(i);
 	}
 
+	m_awakeBodies.reserve(SPHERE_COUNT);
+	m_bInSleepingTree.resize(SPHERE_COUNT);
+	m_wakeQueryTicks.resize(SPHERE_COUNT);
+	m_bodyColours.resize(SPHERE_COUNT);
+	m_islandRoots.resize(SPHERE_COUNT);
+	m_bIslandMoving.resize(SPHERE_COUNT);
+	m_islandSlots.resize(SPHERE_COUNT);
 }
 
 PhysicsWorld::~PhysicsWorld()
 {
 	cleanup_dynamic_tree(m_pRootNode);
-	SAFE_FREE(m_pRootNode);
+	cleanup_dynamic_tree(m_pSleepingRootNode);
 }
 
 void PhysicsWorld::tick()
@@ -23,9 +35,22 @@ void PhysicsWorld::tick()
 	m_pRootNode->centre = XMFLOAT3(0, 0, 0);
 	m_pRootNode->halfBounds = 30.0f;
 	float dt = Application::s_pApp->m_deltaTime;
+	m_deltaTime = dt;
+	++m_tickIndex;
+
+	// Sleeping bodies don't move, so they're kept out of the per tick passes, in a tree of their own 
+	// that's only rebuilt when one has gone to sleep or been woken since it was built
+	m_awakeBodies.clear();
+	bool bSleepersChanged = false;
 	for (auto& pDynBody : m_pDynamicBodies)
 	{
-		if (!pDynBody->isActive())
+		const bool bSleeping = pDynBody->isActive() && pDynBody->isSleeping();
+		if (bSleeping != (m_bInSleepingTree[pDynBody->getBodyIndex()] != 0))
+		{
+			bSleepersChanged = true;
+		}
+
+		if (!pDynBody->isActive() || bSleeping)
 		{
 			continue;
 		}
@@ -35,7 +60,33 @@ void PhysicsWorld::tick()
 			pDynBody->setActivityFlag(false);
 		}
 
-		pDynBody->updateDynamicBody(dt);
+		m_awakeBodies.push_back(pDynBody);
+	}
+
+	if (bSleepersChanged)
+	{
+		rebuildSleepingTree();
+	}
+
+	// Each body finds its own terrain contacts and then moves only itself. The heightmap is only 
+	// read, apart from the collided face flags, which are set atomically
+	m_pJobSystem->parallelFor(0, (int)m_awakeBodies.size(), PHYSICS_BODIES_PER_JOB, [this, dt](int first, int end)
+	{
+		for (int i = first; i < end; ++i)
+		{
+			DynamicBody* pDynBody = m_awakeBodies[i];
+			if (pDynBody->isActive())
+			{
+				pDynBody->checkHeightMapCollision();
+			}
+
+			pDynBody->updateDynamicBody(dt);
+		}
+	});
+
+	// The tree insert shares scratch space between calls, so it stays on this thread
+	for (auto pDynBody : m_awakeBodies)
+	{
 		insert_into_dynamic_tree(m_pRootNode, pDynBody, 3);
 	}
 
@@ -43,10 +94,47 @@ void PhysicsWorld::tick()
 
 
 	test_all_collisions(m_pRootNode, m_collisionPODs);
+
+	// Sleeping bodies can only be woken by awake ones, so pairs of them are only looked for once one is woken
+	if (m_pSleepingRootNode)
+	{
+		for (auto pDynBody : m_awakeBodies)
+		{
+			test_collisions_with_tree(m_pSleepingRootNode, pDynBody, m_collisionPODs);
+		}
+	}
+
 	cleanup_dynamic_tree(m_pRootNode);
+	m_pRootNode = nullptr; // the cleanup deletes the root as well
 	clearCollisionStack();
 }
 
+void PhysicsWorld::rebuildSleepingTree()
+{
+	cleanup_dynamic_tree(m_pSleepingRootNode);
+	m_pSleepingRootNode = nullptr;
+
+	for (auto& pDynBody : m_pDynamicBodies)
+	{
+		const bool bSleeping = pDynBody->isActive() && pDynBody->isSleeping();
+		m_bInSleepingTree[pDynBody->getBodyIndex()] = bSleeping;
+
+		if (!bSleeping)
+		{
+			continue;
+		}
+
+		if (!m_pSleepingRootNode)
+		{
+			m_pSleepingRootNode = new DTreeNode;
+			m_pSleepingRootNode->centre = XMFLOAT3(0, 0, 0);
+			m_pSleepingRootNode->halfBounds = 30.0f;
+		}
+
+		insert_into_dynamic_tree(m_pSleepingRootNode, pDynBody, 3);
+	}
+}
+
 void PhysicsWorld::generateCollisionPairs()
 {
 	const auto beginIT = std::begin(m_pDynamicBodies);
@@ -77,39 +165,113 @@ void PhysicsWorld::generateCollisionPairs()
 void PhysicsWorld::clearCollisionStack()
 {
 #pragma region HANDLE THE SPHERE COLLISIONS STACK
+	// Every pair is tested before any is resolved, so the contacts can be coloured first
+	m_contacts.clear();
 	while (!m_collisionPODs.empty())
 	{
 		CollisionPOD collPOD = m_collisionPODs.top();
-		bool result = SpherevsSpherePaired(collPOD);
-		if (result)
+		m_collisionPODs.pop();
+
+		addContact(collPOD);
+	}
+
+	wakeTouchingSleepers();
+	colourContacts();
+	buildIslands();
+
+	// Islands share no bodies, so each is solved as a job of its own, apart from small ones, which are
+	// batched up to PHYSICS_CONTACTS_PER_JOB contacts. They're queued biggest first and idle threads steal
+	// from the front of the queue, so the big islands are started early and the small ones fill in round them
+	JobCounter islandCounter;
+	for (int first = 0; first < (int)m_islands.size();)
+	{
+		int end = first + 1;
+		int contactCount = m_islands[first].contactCount;
+		while (end < (int)m_islands.size() && contactCount + m_islands[end].contactCount <= PHYSICS_CONTACTS_PER_JOB)
 		{
-			resolveImpulse(collPOD);
-			correctPosition(collPOD);
+			contactCount += m_islands[end++].contactCount;
 		}
 
-		m_collisionPODs.pop();
+		m_pJobSystem->run([this, first, end]()
+		{
+			for (int island = first; island < end; ++island)
+			{
+				solveIsland(m_islands[island]);
+			}
+		}, &islandCounter);
+
+		first = end;
+	}
+	m_pJobSystem->wait(islandCounter);
+
+	for (const auto& contact : m_islandContacts)
+	{
+		m_contactPairs.find(contact.pairKey)->accumulatedImpulse = contact.accumulatedImpulse;
 	}
 
 #pragma endregion
 
 #pragma region HANDLE THE HEIGHTMAP COLLISIONS
 
-	for (auto pDynBody : m_pDynamicBodies)
+	// Each manifold belongs to one body and only changes that body
+	m_pJobSystem->parallelFor(0, (int)m_awakeBodies.size(), PHYSICS_BODIES_PER_JOB, [this](int first, int end)
 	{
-		if (!pDynBody->isActive())
+		for (int i = first; i < end; ++i)
 		{
-			continue;
-		}
+			DynamicBody* pDynBody = m_awakeBodies[i];
+			if (!pDynBody->isActive())
+			{
+				continue;
+			}
 
-		if (!pDynBody->didCollideWithHeightmap())
-		{
-			continue;
+			if (!pDynBody->didCollideWithHeightmap())
+			{
+				continue;
+			}
+
+			resolveHeightmapCollision(*pDynBody->getHeightmapCollisionData());
+			positionalCorrectionHeightmap(*pDynBody->getHeightmapCollisionData());
 		}
+	});
+#pragma endregion
+
+	updateIslandSleep();
+	updateContactPairs();
+}
 
-		resolveHeightmapCollision(*pDynBody->getHeightmapCollisionData());
-		positionalCorrectionHeightmap(*pDynBody->getHeightmapCollisionData());
+void PhysicsWorld::addContact(CollisionPOD& collPOD)
+{
+	if (!SpherevsSpherePaired(collPOD))
+	{
+		return;
 	}
-#pragma endregion
+
+	// The lower body index always comes first, so a pair finds its impulse from last tick whichever
+	// way round the tree produced it
+	if (collPOD.pBodyA->getBodyIndex() > collPOD.pBodyB->getBodyIndex())
+	{
+		std::swap(collPOD.pBodyA, collPOD.pBodyB);
+		collPOD.normal = -collPOD.normal;
+	}
+
+	SolverContact contact;
+	contact.pBodyA = collPOD.pBodyA;
+	contact.pBodyB = collPOD.pBodyB;
+	XMStoreFloat3(&contact.normal, collPOD.normal);
+	contact.penetration = collPOD.penetration;
+	contact.pairKey = ContactPairCache::makeKey(contact.pBodyA->getBodyIndex(), contact.pBodyB->getBodyIndex());
+
+	// A pair carries its impulse and age from tick to tick for as long as it goes on touching
+	bool bAdded;
+	ContactPair& pair = m_contactPairs.findOrAdd(contact.pairKey, bAdded);
+	if (!bAdded && pair.lastTouchedTick != m_tickIndex)
+	{
+		++pair.age;
+	}
+	pair.lastTouchedTick = m_tickIndex;
+	contact.accumulatedImpulse = pair.accumulatedImpulse;
+
+	m_contacts.push_back(contact);
 }
 
 bool SpherevsSpherePaired(CollisionPOD & collPod)
@@ -146,56 +308,459 @@ bool SpherevsSpherePaired(CollisionPOD & collPod)
 	return false;
 }
 
-void PhysicsWorld::resolveImpulse(CollisionPOD & collPOD)
+void PhysicsWorld::colourContacts()
+{
+	// Greedy, in contact order: each contact takes the lowest colour neither of its bodies has yet
+	std::fill(m_bodyColours.begin(), m_bodyColours.end(), 0u);
+
+	for (auto& contact : m_contacts)
+	{
+		uint32_t& coloursA = m_bodyColours[contact.pBodyA->getBodyIndex()];
+		uint32_t& coloursB = m_bodyColours[contact.pBodyB->getBodyIndex()];
+		const uint32_t usedColours = coloursA | coloursB;
+
+		int colour = 0;
+		while (colour < PHYSICS_MAX_CONTACT_COLOURS && (usedColours & (1u << colour)))
+		{
+			++colour;
+		}
+
+		if (colour < PHYSICS_MAX_CONTACT_COLOURS)
+		{
+			coloursA |= 1u << colour;
+			coloursB |= 1u << colour;
+		}
+
+		contact.colour = colour;
+	}
+}
+
+void PhysicsWorld::wakeTouchingSleepers()
+{
+	// A sleeping body is only ever found touching an awake one, which wakes it. It joins the awake bodies for
+	// the rest of the tick, having missed this tick's terrain contacts and move, and its contacts are solved.
+	// It's then tested against the sleeping tree itself, so a pile wakes as a whole the tick it's first touched 
+	// rather than one layer a tick
+	auto wakeOnContact = [this](DynamicBody* pDynBody)
+	{
+		if (pDynBody->isSleeping())
+		{
+			pDynBody->wake();
+			m_awakeBodies.push_back(pDynBody);
+		}
+	};
+
+	size_t nextContact = 0;
+	for (size_t nextWoken = m_awakeBodies.size();; ++nextWoken)
+	{
+		for (; nextContact < m_contacts.size(); ++nextContact)
+		{
+			wakeOnContact(m_contacts[nextContact].pBodyA);
+			wakeOnContact(m_contacts[nextContact].pBodyB);
+		}
+
+		if (nextWoken == m_awakeBodies.size())
+		{
+			break;
+		}
+
+		// The tree still holds the bodies woken this tick. A pair of them is left to whichever is tested first
+		DynamicBody* pWokenBody = m_awakeBodies[nextWoken];
+		m_wakeQueryTicks[pWokenBody->getBodyIndex()] = m_tickIndex;
+		test_collisions_with_tree(m_pSleepingRootNode, pWokenBody, m_collisionPODs);
+
+		while (!m_collisionPODs.empty())
+		{
+			CollisionPOD collPOD = m_collisionPODs.top();
+			m_collisionPODs.pop();
+
+			if (m_wakeQueryTicks[collPOD.pBodyA->getBodyIndex()] != m_tickIndex)
+			{
+				addContact(collPOD);
+			}
+		}
+	}
+}
+
+void PhysicsWorld::buildIslands()
+{
+	// Union-find over the body indices, each awake body starting as an island of its own. The lower root
+	// always becomes the parent, so the islands come out the same whatever order the contacts are joined in
+	for (auto pDynBody : m_awakeBodies)
+	{
+		m_islandRoots[pDynBody->getBodyIndex()] = pDynBody->getBodyIndex();
+	}
+
+	auto findRoot = [this](int bodyIndex)
+	{
+		while (m_islandRoots[bodyIndex] != bodyIndex)
+		{
+			m_islandRoots[bodyIndex] = m_islandRoots[m_islandRoots[bodyIndex]];
+			bodyIndex = m_islandRoots[bodyIndex];
+		}
+		return bodyIndex;
+	};
+
+	for (const auto& contact : m_contacts)
+	{
+		const int rootA = findRoot(contact.pBodyA->getBodyIndex());
+		const int rootB = findRoot(contact.pBodyB->getBodyIndex());
+		if (rootA != rootB)
+		{
+			m_islandRoots[max(rootA, rootB)] = min(rootA, rootB);
+		}
+	}
+
+	// From here on every body points straight at its root
+	for (auto pDynBody : m_awakeBodies)
+	{
+		const int bodyIndex = pDynBody->getBodyIndex();
+		m_islandRoots[bodyIndex] = findRoot(bodyIndex);
+		m_islandSlots[bodyIndex] = -1;
+	}
+
+	m_islands.clear();
+	for (const auto& contact : m_contacts)
+	{
+		const int root = m_islandRoots[contact.pBodyA->getBodyIndex()];
+		if (m_islandSlots[root] < 0)
+		{
+			m_islandSlots[root] = (int)m_islands.size();
+			ContactIsland island;
+			island.root = root;
+			island.firstContact = 0;
+			island.contactCount = 0;
+			m_islands.push_back(island);
+		}
+		++m_islands[m_islandSlots[root]].contactCount;
+	}
+
+	std::sort(m_islands.begin(), m_islands.end(), [](const ContactIsland& islandA, const ContactIsland& islandB)
+	{
+		return islandA.contactCount != islandB.contactCount ? islandA.contactCount > islandB.contactCount : islandA.root < islandB.root;
+	});
+
+	int contactCount = 0;
+	for (int slot = 0; slot < (int)m_islands.size(); ++slot)
+	{
+		m_islands[slot].firstContact = contactCount;
+		contactCount += m_islands[slot].contactCount;
+		m_islandSlots[m_islands[slot].root] = slot;
+	}
+
+	// Each island's contacts in tree order, then grouped by colour keeping that order
+	m_islandContacts.resize(contactCount);
+	for (auto& island : m_islands)
+	{
+		island.contactCount = 0;
+	}
+
+	for (const auto& contact : m_contacts)
+	{
+		ContactIsland& island = m_islands[m_islandSlots[m_islandRoots[contact.pBodyA->getBodyIndex()]]];
+		m_islandContacts[island.firstContact + island.contactCount++] = contact;
+	}
+
+	for (const auto& island : m_islands)
+	{
+		std::stable_sort(m_islandContacts.begin() + island.firstContact, m_islandContacts.begin() + island.firstContact + island.contactCount,
+			[](const SolverContact& contactA, const SolverContact& contactB) { return contactA.colour < contactB.colour; });
+	}
+}
+
+void PhysicsWorld::solveIsland(const ContactIsland& island)
+{
+	SolverContact* pIslandContacts = m_islandContacts.data() + island.firstContact;
+
+	// The targets come from the velocities before anything is applied, then last tick's impulses are 
+	// put straight back, so a resting pile starts each tick from the answer it reached the tick before
+	for (int i = 0; i < island.contactCount; ++i)
+	{
+		prepareContact(pIslandContacts[i]);
+	}
+
+	for (int i = 0; i < island.contactCount; ++i)
+	{
+		const SolverContact& contact = pIslandContacts[i];
+		if (contact.accumulatedImpulse == 0.0f)
+		{
+			continue;
+		}
+
+		XMFLOAT3 impulseA;
+		XMFLOAT3 impulseB;
+		XMStoreFloat3(&impulseA, -contact.accumulatedImpulse * XMLoadFloat3(&contact.normal));
+		XMStoreFloat3(&impulseB, contact.accumulatedImpulse * XMLoadFloat3(&contact.normal));
+		contact.pBodyA->applyImpulse(impulseA);
+		contact.pBodyB->applyImpulse(impulseB);
+	}
+
+	// Each iteration goes through the colours in order. A colour's contacts never share a body, so they're 
+	// taken four at a time, and split over the threads too if there are enough of them. Neither the colouring
+	// nor the islands depend on the threads, so the results don't either
+	for (int iteration = 0; iteration < m_solverIterations; ++iteration)
+	{
+		for (int first = 0; first < island.contactCount;)
+		{
+			const int colour = pIslandContacts[first].colour;
+			int end = first + 1;
+			while (end < island.contactCount && pIslandContacts[end].colour == colour)
+			{
+				++end;
+			}
+
+			SolverContact* pBatch = pIslandContacts + first;
+			const int batchSize = end - first;
+			first = end;
+
+			if (colour == PHYSICS_MAX_CONTACT_COLOURS)
+			{
+				// The leftovers can share bodies, so one at a time
+				for (int i = 0; i < batchSize; ++i)
+				{
+					solveContactGroup(pBatch + i, 1);
+				}
+				continue;
+			}
+
+			const int groupCount = (batchSize + 3) / 4;
+			auto solveGroups = [this, pBatch, batchSize](int firstGroup, int endGroup)
+			{
+				for (int group = firstGroup; group < endGroup; ++group)
+				{
+					solveContactGroup(pBatch + group * 4, min(4, batchSize - group * 4));
+				}
+			};
+
+			if (batchSize >= 2 * PHYSICS_CONTACTS_PER_JOB)
+			{
+				m_pJobSystem->parallelFor(0, groupCount, PHYSICS_CONTACTS_PER_JOB / 4, solveGroups);
+			}
+			else
+			{
+				solveGroups(0, groupCount);
+			}
+		}
+	}
+}
+
+void PhysicsWorld::updateIslandSleep()
+{
+	// Each body counts its own still ticks, but one only sleeps once everything it's touching can too,
+	// otherwise the contact would just wake it again next tick
+	for (auto pDynBody : m_awakeBodies)
+	{
+		m_bIslandMoving[pDynBody->getBodyIndex()] = 0;
+	}
+
+	for (auto pDynBody : m_awakeBodies)
+	{
+		if (!pDynBody->isActive())
+		{
+			continue;
+		}
+
+		pDynBody->updateStillTicks(PHYSICS_SLEEP_ENERGY);
+		if (pDynBody->getStillTicks() < PHYSICS_SLEEP_TICKS)
+		{
+			m_bIslandMoving[m_islandRoots[pDynBody->getBodyIndex()]] = 1;
+		}
+	}
+
+	for (auto pDynBody : m_awakeBodies)
+	{
+		if (pDynBody->isActive() && !m_bIslandMoving[m_islandRoots[pDynBody->getBodyIndex()]])
+		{
+			pDynBody->sleep();
+		}
+	}
+}
+
+void PhysicsWorld::prepareContact(SolverContact& contact)
 {
-	//DynamicBody
 	constexpr float e = 0.4f;
-	const float invMassSum = collPOD.pBodyA->getInverseMass() + collPOD.pBodyB->getInverseMass();
 
-	XMVECTOR relativeVel = collPOD.pBodyB->getVelocity() - collPOD.pBodyA->getVelocity();
-	const float velAlongNormal = XMVectorGetX(XMVector3Dot(relativeVel, collPOD.normal));
-	if (velAlongNormal > 0)
-	{// moving apart so do nothing 
-		return;
+	const float invMassSum = contact.pBodyA->getInverseMass() + contact.pBodyB->getInverseMass();
+	contact.effectiveMass = invMassSum > 0.0f ? 1.0f / invMassSum : 0.0f;
+
+	// Only bounce off a real approach, so bodies resting on each other aren't kicked apart by the 
+	// speed gravity gives them each tick
+	const XMVECTOR relativeVel = contact.pBodyB->getVelocity() - contact.pBodyA->getVelocity();
+	const float velAlongNormal = XMVectorGetX(XMVector3Dot(relativeVel, XMLoadFloat3(&contact.normal)));
+	const float bounce = velAlongNormal < -PHYSICS_RESTITUTION_SPEED ? -e * velAlongNormal : 0.0f;
+
+	// Baumgarte: push apart fast enough to remove a share of the penetration each tick
+	const float bias = PHYSICS_BAUMGARTE / m_deltaTime * max(contact.penetration - Application::CollisionThreshold, 0.0f);
+
+	contact.targetVelAlongNormal = max(bounce, bias);
+}
+
+void PhysicsWorld::updateContactPairs()
+{
+	m_contactEvents.clear();
+
+	for (const auto& contact : m_islandContacts)
+	{
+		const ContactPair* pPair = m_contactPairs.find(contact.pairKey);
+
+		ContactEvent contactEvent;
+		contactEvent.type = pPair->age == 0 ? ContactBegin : ContactPersist;
+		contactEvent.pBodyA = contact.pBodyA;
+		contactEvent.pBodyB = contact.pBodyB;
+		contactEvent.age = pPair->age;
+		contactEvent.impulse = pPair->accumulatedImpulse;
+		m_contactEvents.push_back(contactEvent);
 	}
-	const float j = (-(1 + e) * velAlongNormal) / invMassSum;
-	XMVECTOR impulse = j * collPOD.normal;
 
-	XMFLOAT3 impulseFloat3A;
-	XMFLOAT3 impulseFloat3B;
+	// A pair not found this tick has ended, unless neither of its bodies has moved since they were last found 
+	// touching: each is asleep, or was asleep at the start of the tick and only woken by a contact during it. 
+	// Those pairs aren't all looked for, but can't have moved apart either, so they're kept as they are, 
+	// impulse and all, for whenever they're solved again
+	auto hasNotMoved = [this](DynamicBody* pDynBody)
+	{
+		return pDynBody->isActive() && (pDynBody->isSleeping() || m_wakeQueryTicks[pDynBody->getBodyIndex()] == m_tickIndex);
+	};
 
-	XMStoreFloat3(&impulseFloat3A, -impulse);
-	XMStoreFloat3(&impulseFloat3B, impulse);
+	m_contactPairs.retain([this, &hasNotMoved](const ContactPair& pair)
+	{
+		if (pair.lastTouchedTick == m_tickIndex)
+		{
+			return true;
+		}
 
-	collPOD.pBodyA->applyImpulse(impulseFloat3A);
-	collPOD.pBodyB->applyImpulse(impulseFloat3B);
+		DynamicBody* pBodyA = m_pDynamicBodies[ContactPairCache::getBodyIndexA(pair.key)];
+		DynamicBody* pBodyB = m_pDynamicBodies[ContactPairCache::getBodyIndexB(pair.key)];
+		if (hasNotMoved(pBodyA) && hasNotMoved(pBodyB))
+		{
+			return true;
+		}
+
+		ContactEvent contactEvent;
+		contactEvent.type = ContactEnd;
+		contactEvent.pBodyA = pBodyA;
+		contactEvent.pBodyB = pBodyB;
+		contactEvent.age = pair.age;
+		contactEvent.impulse = pair.accumulatedImpulse;
+		m_contactEvents.push_back(contactEvent);
+		return false;
+	});
+
+	if (m_contactCallback)
+	{
+		for (const auto& contactEvent : m_contactEvents)
+		{
+			m_contactCallback(contactEvent);
+		}
+	}
 }
 
-void PhysicsWorld::resolveHeightmapCollision(const CollisionPOD& collPod)
+void PhysicsWorld::solveContactGroup(SolverContact* pContacts, int count)
+{
+	// One contact per row, transposed so each row holds one component of all four. Unused lanes
+	// get zero vectors and masses, and come out with nothing to apply
+	XMMATRIX normals(XMVectorZero(), XMVectorZero(), XMVectorZero(), XMVectorZero());
+	XMMATRIX relativeVels = normals;
+	XMFLOAT4 effectiveMasses(0.0f, 0.0f, 0.0f, 0.0f);
+	XMFLOAT4 targets(0.0f, 0.0f, 0.0f, 0.0f);
+	XMFLOAT4 accumulatedImpulses(0.0f, 0.0f, 0.0f, 0.0f);
+
+	for (int lane = 0; lane < count; ++lane)
+	{
+		const SolverContact& contact = pContacts[lane];
+		normals.r[lane] = XMLoadFloat3(&contact.normal);
+		relativeVels.r[lane] = contact.pBodyB->getVelocity() - contact.pBodyA->getVelocity();
+		(&effectiveMasses.x)[lane] = contact.effectiveMass;
+		(&targets.x)[lane] = contact.targetVelAlongNormal;
+		(&accumulatedImpulses.x)[lane] = contact.accumulatedImpulse;
+	}
+
+	normals = XMMatrixTranspose(normals);
+	relativeVels = XMMatrixTranspose(relativeVels);
+
+	const XMVECTOR velAlongNormal = XMVectorMultiplyAdd(normals.r[0], relativeVels.r[0],
+		XMVectorMultiplyAdd(normals.r[1], relativeVels.r[1], normals.r[2] * relativeVels.r[2]));
+
+	// The total impulse per contact may only push, so an iteration can take back what an earlier one
+	// over applied but never pull the bodies together
+	const XMVECTOR previous = XMLoadFloat4(&accumulatedImpulses);
+	const XMVECTOR accumulated = XMVectorMax(previous + (XMLoadFloat4(&targets) - velAlongNormal) * XMLoadFloat4(&effectiveMasses), XMVectorZero());
+
+	XMFLOAT4 impulseSizes;
+	XMStoreFloat4(&accumulatedImpulses, accumulated);
+	XMStoreFloat4(&impulseSizes, accumulated - previous);
+
+	for (int lane = 0; lane < count; ++lane)
+	{
+		SolverContact& contact = pContacts[lane];
+		contact.accumulatedImpulse = (&accumulatedImpulses.x)[lane];
+
+		const XMVECTOR normal = XMLoadFloat3(&contact.normal);
+
+		XMFLOAT3 impulseA;
+		XMFLOAT3 impulseB;
+		XMStoreFloat3(&impulseA, -(&impulseSizes.x)[lane] * normal);
+		XMStoreFloat3(&impulseB, (&impulseSizes.x)[lane] * normal);
+		contact.pBodyA->applyImpulse(impulseA);
+		contact.pBodyB->applyImpulse(impulseB);
+	}
+}
+
+void PhysicsWorld::resolveHeightmapCollision(const HeightMapManifold& manifold)
 {
 	constexpr float e = 0.7f;
 	constexpr float staticFric = 0.5f;
 	constexpr float dynamicFric = 0.2f;
 
-	//COLLISION IMPULSE
-	XMVECTOR relativeVel = -collPod.pBodyA->getVelocity();
-	const float velAlongNormal = XMVectorGetX(XMVector3Dot(relativeVel, collPod.normal));
-
-	if (velAlongNormal < 0.0f)
+	DynamicBody* pBody = manifold.pBody;
+	const float invMass = pBody->getInverseMass();
+	if (invMass == 0.0f)
 	{
 		return;
 	}
 
-	const float j = -(1.0f + e) * velAlongNormal;
-	XMVECTOR impulse = j * collPod.normal;
+	//COLLISION IMPULSE
+	// The bounce targets come from the approach velocity before any contact is resolved, so contacts 
+	// solved later don't see the first contact's bounce and add a second one on top of it
+	float targetVelAlongNormal[MAX_MANIFOLD_CONTACTS];
+	float accumulatedImpulse[MAX_MANIFOLD_CONTACTS];
+	for (int i = 0; i < manifold.contactCount; ++i)
+	{
+		const float velAlongNormal = XMVectorGetX(XMVector3Dot(pBody->getVelocity(), manifold.normals[i]));
+		targetVelAlongNormal[i] = velAlongNormal < 0.0f ? -e * velAlongNormal : 0.0f;
+		accumulatedImpulse[i] = 0.0f;
+	}
+
+	// Solve the contacts together; the accumulated impulse per contact may only push, 
+	// so one contact can take back what another has over applied
+	for (int iteration = 0; iteration < m_solverIterations; ++iteration)
+	{
+		for (int i = 0; i < manifold.contactCount; ++i)
+		{
+			const float velAlongNormal = XMVectorGetX(XMVector3Dot(pBody->getVelocity(), manifold.normals[i]));
+			const float previous = accumulatedImpulse[i];
+			accumulatedImpulse[i] = max(previous + (targetVelAlongNormal[i] - velAlongNormal) / invMass, 0.0f);
 
-	XMFLOAT3 tempImpulse;
-	XMStoreFloat3(&tempImpulse, -impulse);
-	collPod.pBodyA->applyImpulse(tempImpulse);
+			XMFLOAT3 tempImpulse;
+			XMStoreFloat3(&tempImpulse, (accumulatedImpulse[i] - previous) * manifold.normals[i]);
+			pBody->applyImpulse(tempImpulse);
+		}
+	}
 
 	// FRICTION IMPULSE
-	relativeVel = -collPod.pBodyA->getVelocity();
-	XMVECTOR t = relativeVel - (collPod.normal * XMVectorGetX(XMVector3Dot(collPod.normal, relativeVel)));
+	// Applied once against the combined normal impulse of the manifold
+	XMVECTOR totalImpulse = XMVectorZero();
+	for (int i = 0; i < manifold.contactCount; ++i)
+	{
+		totalImpulse += accumulatedImpulse[i] * manifold.normals[i];
+	}
+
+	const float j = XMVectorGetX(XMVector3Length(totalImpulse));
+	if (j < 0.00000001f)
+		return;
+
+	const XMVECTOR normal = totalImpulse / j;
+	const XMVECTOR relativeVel = -pBody->getVelocity();
+	XMVECTOR t = relativeVel - (normal * XMVectorGetX(XMVector3Dot(normal, relativeVel)));
 	float tLength = XMVectorGetX(XMVector3LengthSq(t));
 
 	if (tLength < 0.00000001f)
@@ -203,11 +768,11 @@ void PhysicsWorld::resolveHeightmapCollision(const CollisionPOD& collPod)
 
 	tLength = sqrtf(tLength);
 
-	const XMVECTOR fn = -t / tLength;
+	// relativeVel is the terrain's velocity relative to the body, so t already points against the body's 
+	// sliding and the friction goes along it, not along -t, which sped sliding bodies up
+	const XMVECTOR fn = t / tLength;
 
-	const float denom = collPod.pBodyA->getInverseMass();
-
-	float fj = tLength / denom;
+	float fj = tLength / invMass;
 
 	if (fj > j * staticFric)
 	{
@@ -216,34 +781,31 @@ void PhysicsWorld::resolveHeightmapCollision(const CollisionPOD& collPod)
 
 	const XMVECTOR fjv = fn * fj;
 
-
 	XMFLOAT3 temp;
 	XMStoreFloat3(&temp, fjv);
-	collPod.pBodyA->applyImpulse(temp);
-
-	//setVelocity(m_velocity - impulse);
-}
-
-void PhysicsWorld::positionalCorrectionHeightmap(const CollisionPOD& collPod)
-{
-	XMVECTOR correction = (max(collPod.penetration - Application::CollisionThreshold, 0.0f) / collPod.pBodyA->getInverseMass())
-		* Application::CollisionPercentage* collPod.normal;
-	collPod.pBodyA->setPosition(collPod.pBodyA->getPosition() + correction);
+	pBody->applyImpulse(temp);
 }
 
-void PhysicsWorld::correctPosition(CollisionPOD & collPod)
+void PhysicsWorld::positionalCorrectionHeightmap(const HeightMapManifold& manifold)
 {
-	////float penetration = radius - XMVectorGetX(XMVector3Length(colPos - m_position));
-	const float invMassA = collPod.pBodyA->getInverseMass();
-	const float invMassB = collPod.pBodyB->getInverseMass();
+	DynamicBody* pBody = manifold.pBody;
 
-	const float unit_converted_penetration = collPod.penetration / 10.0f;
+	// Deepest contact first; each later contact only adds the part of its correction 
+	// not already covered along its normal by the contacts before it
+	XMVECTOR correction = XMVectorZero();
+	for (int i = 0; i < manifold.contactCount; ++i)
+	{
+		const float required = (max(manifold.penetrations[i] - Application::CollisionThreshold, 0.0f) / pBody->getInverseMass())
+			* Application::CollisionPercentage;
+		const float applied = XMVectorGetX(XMVector3Dot(correction, manifold.normals[i]));
 
-	XMVECTOR correction = ((max(unit_converted_penetration - Application::CollisionThreshold, 0.0f)) / (invMassA + invMassB))
-		* Application::CollisionPercentage * collPod.normal;
+		if (required > applied)
+		{
+			correction += (required - applied) * manifold.normals[i];
+		}
+	}
 
-	collPod.pBodyA->setPosition(collPod.pBodyA->getPosition() - correction);
-	collPod.pBodyB->setPosition(collPod.pBodyB->getPosition() + correction);
+	pBody->setPosition(pBody->getPosition() + correction);
 }
 
 bool SpherevsSphere(const XMFLOAT3 & centreA, float radiusA, const XMFLOAT3 & centreB, float radiusB)
@@ -2,7 +2,13 @@
 #define PHYSICS_WORLD
 
 #include "Application.h"
+#include "ContactPairCache.h"
+#include <functional>
 #include <stack>
+#include <stdint.h>
+#include <vector>
+
+class JobSystem;
 
 //forward declarations
 struct DTreeNode;
@@ -18,6 +24,66 @@ struct DX_ALIGNED CollisionPOD
 	XMVECTOR normal;
 };
 
+#define MAX_MANIFOLD_CONTACTS 4
+
+// Bodies per job in the tick's parallel passes
+#define PHYSICS_BODIES_PER_JOB 16
+
+// Sphere contacts per job when a colour batch is solved in parallel
+#define PHYSICS_CONTACTS_PER_JOB 32
+
+// Colours tried before a sphere contact is left to the final batch, which is solved on one thread
+#define PHYSICS_MAX_CONTACT_COLOURS 32
+
+// Passes the sphere contact solver makes over each island's contacts, by default
+#define PHYSICS_SOLVER_ITERATIONS 8
+
+// Share of the penetration between two spheres the solver removes each tick, and the speed two spheres
+// must be approaching at for them to bounce apart rather than come to rest
+#define PHYSICS_BAUMGARTE 0.2f
+#define PHYSICS_RESTITUTION_SPEED 4.0f
+
+// A body goes to sleep once it has ended PHYSICS_SLEEP_TICKS ticks in a row with less kinetic energy 
+// than PHYSICS_SLEEP_ENERGY, along with the bodies it's touching. A body resting on the terrain still 
+// picks up about G_VALUE * PhysicsDT of speed each tick before the terrain stops it, so the energy 
+// has to allow for that
+#define PHYSICS_SLEEP_ENERGY 2.0f
+#define PHYSICS_SLEEP_TICKS 30
+
+// Contacts between one body and the heightmap, deepest first.
+// Contacts with near identical normals are merged by HeightMap::SphereCollision
+struct DX_ALIGNED HeightMapManifold
+{
+	OP_NEW;
+	OP_DEL;
+
+	DynamicBody* pBody = nullptr;
+	XMVECTOR normals[MAX_MANIFOLD_CONTACTS];
+	float penetrations[MAX_MANIFOLD_CONTACTS];
+	int contactCount = 0;
+};
+
+enum ContactEventType
+{
+	ContactBegin,
+	ContactPersist,
+	ContactEnd
+};
+
+// Two spheres starting to touch, still touching or no longer touching, reported at the end of the tick
+struct ContactEvent
+{
+	ContactEventType type;
+	DynamicBody* pBodyA;
+	DynamicBody* pBodyB;
+	// Ticks the pair has been found touching on since it began, and its total impulse along the 
+	// normal the last tick it was solved
+	int age;
+	float impulse;
+};
+
+typedef std::function<void(const ContactEvent&)> ContactCallback;
+
 //Quick lightweight test (used for static tree collision detection with heightmap)
 bool SpherevsSphere(const XMFLOAT3& centreA, float radiusA, const XMFLOAT3& centreB, float radiusB);
 
@@ -28,30 +94,116 @@ class DX_ALIGNED PhysicsWorld
 {
 public:
 
-	PhysicsWorld(DynamicBody*  pDynamicBodies[SPHERE_COUNT]);
+	// The tick's per body passes are split over pJobSystem's threads
+	PhysicsWorld(DynamicBody*  pDynamicBodies[SPHERE_COUNT], JobSystem* pJobSystem);
 	~PhysicsWorld();
 
 	void tick();
 
+	// Passes the solvers make over the contacts each tick. More settle piles in fewer ticks, at a cost per tick
+	void setSolverIterations(int solverIterations) { m_solverIterations = max(solverIterations, 1); }
+	int getSolverIterations() const { return m_solverIterations; }
+
+	// Called on the physics thread at the end of each tick, once for each of the tick's contact events
+	void setContactCallback(ContactCallback callback) { m_contactCallback = callback; }
+	// The last tick's events: a begin or persist for each pair touching, in solve order, then the ends
+	const std::vector<ContactEvent>& getContactEvents() const { return m_contactEvents; }
+	// Pairs touching, including those asleep and not looked for
+	int getContactPairCount() const { return m_contactPairs.size(); }
+
 	OP_NEW;
 	OP_DEL;
 
 private:
 
+	// A sphere contact ready to solve. Unaligned, unlike CollisionPOD, so it can be kept in a vector.
+	// pBodyA always has the lower body index, and the normal points from it to pBodyB
+	struct SolverContact
+	{
+		DynamicBody* pBodyA;
+		DynamicBody* pBodyB;
+		XMFLOAT3 normal;
+		float penetration;
+		int colour;
+		uint64_t pairKey;
+
+		float effectiveMass;
+		// Speed along the normal the solver aims for, to bounce or to push out of the penetration
+		float targetVelAlongNormal;
+		// Total impulse along the normal so far this tick, starting from the pair's total last tick
+		float accumulatedImpulse;
+	};
+
+	// Bodies joined by sphere contacts this tick, whose contacts are a run of m_islandContacts
+	struct ContactIsland
+	{
+		int root;// lowest body index in the island
+		int firstContact;
+		int contactCount;
+	};
+
 	void generateCollisionPairs();
 	void clearCollisionStack();
-
-	void resolveImpulse(CollisionPOD& collPod);
-
-	void resolveHeightmapCollision(const CollisionPOD& collPod);
-	void positionalCorrectionHeightmap(const CollisionPOD& collPod);
-
-	void correctPosition(CollisionPOD& collPod);
+	// Adds the pair to m_contacts, and touches it in m_contactPairs, if the bodies are touching
+	void addContact(CollisionPOD& collPOD);
+
+	void rebuildSleepingTree();
+
+	// Wakes the sleeping bodies touched, and the sleeping bodies touching those in turn, adding the contacts found
+	void wakeTouchingSleepers();
+	// Colours m_contacts so no body appears twice among the contacts of a colour
+	void colourContacts();
+	// Joins the bodies touching into islands, and gathers each island's contacts into m_islandContacts, 
+	// grouped by colour
+	void buildIslands();
+	void solveIsland(const ContactIsland& island);
+	// Puts each island to sleep whose bodies have all been still long enough
+	void updateIslandSleep();
+	// Drops the pairs that have stopped touching and reports the tick's contact events
+	void updateContactPairs();
+	// Works out the contact's effective mass and target speed from the velocities before solving
+	void prepareContact(SolverContact& contact);
+	// One solver pass over up to four contacts at once, one per SIMD lane. The contacts mustn't share bodies
+	void solveContactGroup(SolverContact* pContacts, int count);
+
+	void resolveHeightmapCollision(const HeightMapManifold& manifold);
+	void positionalCorrectionHeightmap(const HeightMapManifold& manifold);
 
 	DynamicBody* m_pDynamicBodies[SPHERE_COUNT];
+	// The bodies active and awake at the start of the tick, gathered so the passes over them can be split 
+	// into ranges, then any woken by contacts during it
+	std::vector<DynamicBody*> m_awakeBodies;
 	std::stack<CollisionPOD> m_collisionPODs;
 
+	// The sphere contacts found this tick, in the order the tree produced them, then grouped by island.
+	// Colour PHYSICS_MAX_CONTACT_COLOURS is given to the contacts that found no colour free
+	std::vector<SolverContact> m_contacts;
+	std::vector<SolverContact> m_islandContacts;
+	// The awake islands with contacts, biggest first
+	std::vector<ContactIsland> m_islands;
+
+	// Per body index: whether the body is in the sleeping tree, the last tick it was woken and tested against 
+	// the sleeping tree, the colours already used by it this tick, its island's root, whether anything in its 
+	// island is still moving, and its island's slot in m_islands
+	std::vector<uint8_t> m_bInSleepingTree;
+	std::vector<int> m_wakeQueryTicks;
+	std::vector<uint32_t> m_bodyColours;
+	std::vector<int> m_islandRoots;
+	std::vector<uint8_t> m_bIslandMoving;
+	std::vector<int> m_islandSlots;
+
+	// Every pair touching, kept from tick to tick while it goes on touching
+	ContactPairCache m_contactPairs;
+	std::vector<ContactEvent> m_contactEvents;
+	ContactCallback m_contactCallback;
+	int m_tickIndex = 0;
+
+	JobSystem* m_pJobSystem;
+	int m_solverIterations = PHYSICS_SOLVER_ITERATIONS;
+	float m_deltaTime = 0.0f;
+
 	DTreeNode* m_pRootNode = nullptr;
+	DTreeNode* m_pSleepingRootNode = nullptr;
 };
 
 #endif 
@@ -0,0 +1,71 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "Application.h"
+
+#if TESTING_ENABLED
+
+#include <atomic>
+#include <chrono>
+
+// Accumulates the time spent inside a named scope and reports the 
+// average through dprintf every REPORT_INTERVAL calls. Scopes may be 
+// timed on several threads at once; calls that finish while a report 
+// is being made just go towards the next one
+struct ProfileStat
+{
+	static const int REPORT_INTERVAL = 1000;
+
+	explicit ProfileStat(const char* pStatName) : pName(pStatName) {}
+
+	void add(long long nanoseconds)
+	{
+		totalNs.fetch_add(nanoseconds, std::memory_order_relaxed);
+		if (calls.fetch_add(1, std::memory_order_relaxed) + 1 == REPORT_INTERVAL)
+		{
+			const long long reportNs = totalNs.exchange(0, std::memory_order_relaxed);
+			calls.fetch_sub(REPORT_INTERVAL, std::memory_order_relaxed);
+			dprintf("Profile: %s %.3f us avg over %d calls\n", pName, (double)reportNs / REPORT_INTERVAL / 1000.0, REPORT_INTERVAL);
+		}
+	}
+
+	const char* pName;
+	std::atomic<long long> totalNs{ 0 };
+	std::atomic<int> calls{ 0 };
+};
+
+class ScopedProfile
+{
+public:
+
+	explicit ScopedProfile(ProfileStat& stat) : m_stat(stat), m_start(std::chrono::high_resolution_clock::now()) {}
+
+	~ScopedProfile()
+	{
+		const auto elapsed = std::chrono::high_resolution_clock::now() - m_start;
+		m_stat.add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+	}
+
+private:
+
+	ProfileStat& m_stat;
+	std::chrono::high_resolution_clock::time_point m_start;
+
+	ScopedProfile(const ScopedProfile&);
+	ScopedProfile& operator=(const ScopedProfile&);
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+// Times the rest of the enclosing scope
+#define PROFILE_SCOPE(name) static ProfileStat PROFILE_CONCAT(s_profileStat, __LINE__)(name); \
+	ScopedProfile PROFILE_CONCAT(scopedProfile, __LINE__)(PROFILE_CONCAT(s_profileStat, __LINE__))
+
+#else
+
+#define PROFILE_SCOPE(name)
+
+#endif
+
+#endif
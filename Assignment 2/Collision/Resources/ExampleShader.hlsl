@@ -37,6 +37,10 @@ cbuffer MyApp
 {
 	float	g_frameCount;
 	float3	g_waveOrigin;
+
+	// Grid cells across and down the terrain, for finding the face under a pixel
+	int		g_mapCellsWide;
+	int		g_mapCellsLong;
 }
 
 struct VSInput
@@ -61,6 +65,10 @@ struct PSOutput
 	float4 colour:SV_Target;
 };
 
+// Per face FACE_FLAG_* bits from HeightMap.h, indexed by face
+// 1 = collided, 2 = disabled, 4 = shaded
+Buffer<uint> g_faceFlags;
+
 Texture2D g_materialMap;
 Texture2D g_texture0;
 Texture2D g_texture1;
@@ -87,18 +95,29 @@ void VSMain(const VSInput input, out PSInput output)
 
 void PSMain(const PSInput input, out PSOutput output)
 {
+	// The texture coordinates are the grid position, which gives the face whatever level of detail 
+	// the terrain is drawn at. Two faces per cell, split along the diagonal from (0, 1) to (1, 0)
+	const int2 cell = clamp((int2)input.tex, int2(0, 0), int2(g_mapCellsWide, g_mapCellsLong) - 1);
+	const float2 cellPos = input.tex - cell;
+	const uint face = (cell.y * g_mapCellsWide + cell.x) * 2 + (cellPos.x + cellPos.y > 1.0f ? 1 : 0);
+	const uint faceFlags = g_faceFlags.Load(face);
+
+	if( faceFlags & 2 )
+		discard;
+
 	float4 colour = input.colour;
 
 	//Add a bit of a grid
-	if( input.tex.x <= 0.01f || input.tex.y <= 0.01f || input.tex.x >= 0.99f || input.tex.y >= 0.99f  )
+	float2 cellTex = frac(input.tex);
+	if( cellTex.x <= 0.01f || cellTex.y <= 0.01f || cellTex.x >= 0.99f || cellTex.y >= 0.99f  )
 		colour = float4( 1.0f, 1.0f, 1.0f, 1.0f );
 	else
 		colour = float4( 0.6f, 0.6f, 0.6f, 1.0f );
 
-	if( input.colour.y == 0.0f )
+	if( faceFlags & 1 )
 		colour = float4( 1.0f, 0.0f, 0.0f, 1.0f );
 
-	if( input.normal.x < 0.25 )
+	if( faceFlags & 4 )
 		colour = colour*0.95;
 
 	output.colour.xyz = (float3)colour;
@@ -18,7 +18,9 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <atomic>
 #include <chrono>
+#include <thread>
 
 #include "D3DHelpers.h"
 
@@ -35,6 +37,24 @@
 float App::m_appBaseDT = 0.016f; // init with dt value for 60 fps
 using namespace std;
 
+// Each tick's time moves the smoothed average this much of the way.
+static const double TICK_TIME_SMOOTHING = .1;
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+PhysicsTimingStats::PhysicsTimingStats():
+numTicks(0),
+numDroppedTicks(0),
+averageTickTime(0.f),
+maxTicksPerWake(MaxPhysicsTicksPerWake),
+simulationRate(1.f)
+{
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
 App::App() :
 	m_pD3DDevice(NULL),
 	m_pD3DDebug(NULL),
@@ -205,6 +225,7 @@ void App::Render()
 
 	// Do the actual rendering.
 	this->HandleRender();
+	this->HandleEndRender();
 
 	// Present whatever.
 	m_pDXGISwapChain->Present(1, 0);
@@ -226,6 +247,94 @@ void App::Update()
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
+void App::PhysicsUpdate()
+{
+	this->HandlePhysicsUpdate();
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void App::RunPhysicsLoop(const atomic<bool> &stop)
+{
+	typedef chrono::steady_clock Clock;
+
+	const Clock::duration step = chrono::duration_cast<Clock::duration>(chrono::duration<double>(PhysicsDT));
+
+	PhysicsTimingStats stats;
+	double averageTickTime = 0.0;
+
+	Clock::time_point nextTick = Clock::now();
+
+	Clock::time_point rateStart = nextTick;
+	unsigned rateTicks = 0;
+
+	while (!stop.load(memory_order_relaxed))
+	{
+		Clock::time_point now = Clock::now();
+		if (now < nextTick)
+		{
+			this_thread::sleep_until(nextTick);
+			now = Clock::now();
+		}
+
+		// The tick at nextTick is due, plus one for each step since.
+		const unsigned numDue = unsigned((now - nextTick) / step) + 1;
+		const unsigned numTicks = numDue < stats.maxTicksPerWake ? numDue : stats.maxTicksPerWake;
+
+		for (unsigned i = 0; i < numTicks; ++i)
+		{
+			const Clock::time_point tickStart = Clock::now();
+
+			this->PhysicsUpdate();
+
+			const double tickTime = chrono::duration<double>(Clock::now() - tickStart).count();
+			averageTickTime += (tickTime - averageTickTime) * TICK_TIME_SMOOTHING;
+		}
+
+		// Whatever's left is dropped, rather than carried over to make
+		// the next catch-up longer still. The simulation just runs slow.
+		nextTick += step * numDue;
+
+		stats.numTicks += numTicks;
+		stats.numDroppedTicks += numDue - numTicks;
+		rateTicks += numTicks;
+
+		// Catching up must take no longer than a step, or it would be
+		// even further behind afterwards.
+		const double affordable = averageTickTime > 0.0 ? PhysicsDT / averageTickTime : MaxPhysicsTicksPerWake;
+		stats.maxTicksPerWake = affordable < 1.0 ? 1 : affordable > MaxPhysicsTicksPerWake ? MaxPhysicsTicksPerWake : unsigned(affordable);
+
+		const double rateTime = chrono::duration<double>(now - rateStart).count();
+		if (rateTime >= 1.0)
+		{
+			stats.averageTickTime = float(averageTickTime);
+			stats.simulationRate = float(rateTicks * PhysicsDT / rateTime);
+
+			rateStart = now;
+			rateTicks = 0;
+		}
+
+		{
+			lock_guard<mutex> lock(m_physicsTimingMutex);
+			m_physicsTimingStats = stats;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+PhysicsTimingStats App::GetPhysicsTimingStats() const
+{
+	lock_guard<mutex> lock(m_physicsTimingMutex);
+
+	return m_physicsTimingStats;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
 bool App::CanRender() const
 {
 	return m_canRender;
@@ -283,6 +392,13 @@ void App::HandleRender()
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
+void App::HandleEndRender()
+{
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
 void App::HandleUpdate()
 {
 }
@@ -290,6 +406,13 @@ void App::HandleUpdate()
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
+void App::HandlePhysicsUpdate()
+{
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
 void App::SetStartErrorMessage(const char *pFmt, ...)
 {
 	char buf[1000];
@@ -575,6 +698,15 @@ int Run(App *pApp)
 	// This makes Sleep more accurate.
 	timeBeginPeriod(1);
 
+	// Physics ticks at the fixed PhysicsDT on its own thread, so it
+	// overlaps rendering rather than taking turns with it.
+	atomic<bool> stopPhysics(false);
+
+	thread physicsThread([pApp, &stopPhysics]()
+	{
+		pApp->RunPhysicsLoop(stopPhysics);
+	});
+
 	// Time for next update.
 	LARGE_INTEGER nextUpdate;
 	QueryPerformanceCounter(&nextUpdate);
@@ -583,7 +715,6 @@ int Run(App *pApp)
 	chrono::time_point<chrono::steady_clock> prevTime = chrono::high_resolution_clock::now();
 	chrono::time_point<chrono::steady_clock> currentTime = prevTime;
 	static bool tickedOnce = false;
-	float accumulator = 0.0f;
 	while (DoMessages())
 	{
 		// Wait until the next 60th-of-a-second boundary has
@@ -594,10 +725,8 @@ int Run(App *pApp)
 
 		if (tickedOnce)
 		{
-			const chrono::milliseconds timeInMs = chrono::duration_cast<chrono::milliseconds>((currentTime - prevTime));
-			pApp->m_appBaseDT = (float)(timeInMs.count()) / 1000.0f;
-
-			accumulator += pApp->m_appBaseDT > PhysicsDT ? pApp->m_appBaseDT : (pApp->m_appBaseDT = PhysicsDT);
+			const float frameTime = chrono::duration<float>(currentTime - prevTime).count();
+			pApp->m_appBaseDT = frameTime < MaxFrameDT ? frameTime : MaxFrameDT;
 		}
 
 		for (;;)
@@ -615,11 +744,7 @@ int Run(App *pApp)
 
 		nextUpdate.QuadPart = now.QuadPart + oneFrame.QuadPart;
 
-		while (accumulator >= PhysicsDT)
-		{
-			pApp->Update();
-			accumulator -= PhysicsDT;
-		}
+		pApp->Update();
 
 		pApp->Render();
 
@@ -629,6 +754,9 @@ int Run(App *pApp)
 		}
 	}
 
+	stopPhysics.store(true, memory_order_relaxed);
+	physicsThread.join();
+
 	pApp->Stop();
 
 	pApp->StopD3D();
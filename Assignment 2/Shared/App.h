@@ -15,6 +15,9 @@
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 
+#include <atomic>
+#include <mutex>
+
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
@@ -31,6 +34,31 @@ struct ID3D11Texture2D;
 
 constexpr float PhysicsDT = 1.0f / 100.0f;
 
+// Most physics ticks run back to back to catch up, before any more that
+// are due are dropped. Fewer are allowed when ticks are expensive.
+constexpr unsigned MaxPhysicsTicksPerWake = 4;
+
+// Longest frame m_appBaseDT reports, however long the frame really
+// took - after a breakpoint, say.
+constexpr float MaxFrameDT = 0.25f;
+
+// How the physics thread is keeping up with PhysicsDT. Totals count
+// from the start, the rest are updated about once a second.
+struct PhysicsTimingStats
+{
+	unsigned numTicks;
+	unsigned numDroppedTicks;// skipped to stop physics falling further behind
+
+	float averageTickTime;// seconds, smoothed
+	unsigned maxTicksPerWake;// the current catch-up limit
+
+	// Simulated time over real time. 1 when keeping up, less when ticks
+	// take longer than PhysicsDT or are being dropped.
+	float simulationRate;
+
+	PhysicsTimingStats();
+};
+
 class App
 {
 public:
@@ -55,6 +83,16 @@ public:
 
 	//
 	void Render();
+
+	//
+	void PhysicsUpdate();
+
+	// Runs PhysicsUpdate every PhysicsDT until stop is set. This is what
+	// the physics thread does.
+	void RunPhysicsLoop(const std::atomic<bool> &stop);
+
+	// Copy of the stats as the physics thread last left them.
+	PhysicsTimingStats GetPhysicsTimingStats() const;
 protected:
 	bool CanRender() const;
 
@@ -85,11 +123,24 @@ protected:
 	// Default implementation does nothing.
 	virtual void HandleRender();
 
-	// Gets called at roughly 60Hz.
+	// Called after HandleRender, just before the frame is presented.
+	//
+	// Default implementation does nothing.
+	virtual void HandleEndRender();
+
+	// Gets called at roughly 60Hz, once per frame, just before
+	// HandleRender. m_appBaseDT is the time since the previous frame.
 	//
 	// Default implementation does nothing.
 	virtual void HandleUpdate();
 
+	// Gets called every PhysicsDT, on a thread of its own that runs
+	// alongside the main one. Anything shared with the render side
+	// must be handed over in a thread safe way - see TripleBuffer.h.
+	//
+	// Default implementation does nothing.
+	virtual void HandlePhysicsUpdate();
+
 	// Set the error message displayed, if HandleStart returns false.
 	void SetStartErrorMessage(const char *pFmt, ...);
 
@@ -125,6 +176,9 @@ private:
 
 	bool m_isInFocus;
 
+	mutable std::mutex m_physicsTimingMutex;
+	PhysicsTimingStats m_physicsTimingStats;
+
 	void ReleaseRenderTargetsAndViews();
 	void RecreateRenderTargetsAndViews();
 
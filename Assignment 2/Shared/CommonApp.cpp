@@ -56,6 +56,9 @@ const char g_aShader[]=
 	"#ifdef TEXTURED\n"
 	"    float2 tex:TEXCOORD;\n"
 	"#endif//TEXTURED\n"
+	"#ifdef INSTANCED\n"
+	"    float4 instance:INSTANCE;\n"//(x,y,z,scale)
+	"#endif//INSTANCED\n"
 	"};\n"
 	"\n"
 	"struct PSInput\n"
@@ -118,14 +121,20 @@ const char g_aShader[]=
 	"\n"
 	"void VSMain(const VSInput input, out PSInput output)\n"
 	"{\n"
-	"    output.pos = mul(input.pos, g_WVP);\n"
+	"#ifdef INSTANCED\n"
+	"    float4 pos = float4(input.pos.xyz * input.instance.w + input.instance.xyz, 1.0);\n"
+	"#else//INSTANCED\n"
+	"    float4 pos = input.pos;\n"
+	"#endif//INSTANCED\n"
+	"\n"
+	"    output.pos = mul(pos, g_WVP);\n"
 	"\n"
 	"#ifdef LIT\n"
 	"\n"
 	"    float3 N = mul(input.normal, g_InvXposeW);\n"
 	"    N = normalize(N);\n"
 	"\n"
-	"    float3 worldPos = mul(input.pos, g_W);\n"
+	"    float3 worldPos = mul(pos, g_W);\n"
 	"\n"
 	"    output.colour = GetLightingColour(worldPos, N) * g_constantColour * input.colour;\n"
 	"\n"
@@ -312,10 +321,31 @@ const D3D11_INPUT_ELEMENT_DESC g_aVertexDesc_Pos3fColour4ubNormal3fTex2f[] = {
 
 const UINT g_vertexDescSize_Pos3fColour4ubNormal3fTex2f = sizeof g_aVertexDesc_Pos3fColour4ubNormal3fTex2f / sizeof g_aVertexDesc_Pos3fColour4ubNormal3fTex2f[0];
 
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+const D3D11_INPUT_ELEMENT_DESC g_aVertexDesc_Pos3fColour4ubNormal3f_InstancePos3fScale1f[] = {
+	{"POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(Vertex_Pos3fColour4ubNormal3f, pos), D3D11_INPUT_PER_VERTEX_DATA, 0, },
+	{"COLOUR", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, offsetof(Vertex_Pos3fColour4ubNormal3f, colour), D3D11_INPUT_PER_VERTEX_DATA, 0,},
+	{"NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, offsetof(Vertex_Pos3fColour4ubNormal3f, normal), D3D11_INPUT_PER_VERTEX_DATA, 0,},
+	{"INSTANCE", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, offsetof(Instance_Pos3fScale1f, pos), D3D11_INPUT_PER_INSTANCE_DATA, 1,},
+};
+
+const UINT g_vertexDescSize_Pos3fColour4ubNormal3f_InstancePos3fScale1f = sizeof g_aVertexDesc_Pos3fColour4ubNormal3f_InstancePos3fScale1f / sizeof g_aVertexDesc_Pos3fColour4ubNormal3f_InstancePos3fScale1f[0];
+
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
-CommonApp::CommonApp()
+CommonApp::CommonApp():
+m_pD3D11RenderBackend(NULL),
+m_pRenderBackend(NULL),
+m_queueingDraws(false),
+m_numShadersCreated(0),
+m_blendState(0),
+m_depthStencilState(0),
+m_rasterizerState(0),
+m_viewProjectionMtxValid(false),
+m_worldMtxsValid(false)
 {
 	for (int i = 0; i < NUM_BLEND_STATES; ++i)
 		m_apBlendStates[i] = NULL;
@@ -342,6 +372,9 @@ CommonApp::~CommonApp()
 
 bool CommonApp::HandleStart()
 {
+	m_pD3D11RenderBackend = new D3D11RenderBackend(m_pD3DDeviceContext);
+	m_pRenderBackend = m_pD3D11RenderBackend;
+
 	char maxNumLightsValue[100];
 	_snprintf_s(maxNumLightsValue, sizeof maxNumLightsValue, _TRUNCATE, "%d", MAX_NUM_LIGHTS);
 
@@ -391,6 +424,19 @@ bool CommonApp::HandleStart()
 			return false;
 	}
 
+	// Tex NO, Lit YES, Instanced YES
+	{
+		const D3D_SHADER_MACRO aMacros[] = {
+			{"MAX_NUM_LIGHTS", maxNumLightsValue},
+			{"LIT",NULL},
+			{"INSTANCED",NULL},
+			{NULL},
+		};
+
+		if (!this->CompileShaderFromString(&m_shaderUntexturedLitInstanced, g_aShader, aMacros, g_aVertexDesc_Pos3fColour4ubNormal3f_InstancePos3fScale1f, g_vertexDescSize_Pos3fColour4ubNormal3f_InstancePos3fScale1f))
+			return false;
+	}
+
 	// Blend state
 	for (int i = 0; i < NUM_BLEND_STATES; ++i)
 	{
@@ -498,6 +544,15 @@ bool CommonApp::HandleStart()
 
 void CommonApp::HandleStop()
 {
+	// Anything left over refers to objects that are about to go.
+	m_renderCommands.Reset();
+	m_drawQueue.Reset();
+	m_queueingDraws = false;
+
+	delete m_pD3D11RenderBackend;
+	m_pD3D11RenderBackend = NULL;
+	m_pRenderBackend = NULL;
+
 	for (int i = 0; i < NUM_BLEND_STATES; ++i)
 		Release(m_apBlendStates[i]);
 
@@ -514,6 +569,7 @@ void CommonApp::HandleStop()
 	m_shaderUntexturedLit.Reset();
 	m_shaderTextured.Reset();
 	m_shaderTexturedLit.Reset();
+	m_shaderUntexturedLitInstanced.Reset();
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -564,6 +620,7 @@ void CommonApp::GetWindowSize(float *pWidth, float *pHeight) const
 void CommonApp::SetWorldMatrix(const D3DXMATRIX &worldMtx)
 {
 	m_worldMtx = worldMtx;
+	m_worldMtxsValid = false;
 }
 
 void CommonApp::SetWorldMatrix(const XMMATRIX &worldMtx)
@@ -571,6 +628,7 @@ void CommonApp::SetWorldMatrix(const XMMATRIX &worldMtx)
 	XMFLOAT4X4 mWorld;
 	XMStoreFloat4x4(&mWorld, worldMtx);
 	m_worldMtx = *((D3DXMATRIX*)&mWorld);
+	m_worldMtxsValid = false;
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -581,11 +639,15 @@ void CommonApp::SetViewMatrix(const XMMATRIX &viewMtx)
 	XMFLOAT4X4 mView;
 	XMStoreFloat4x4(&mView, viewMtx);
 	m_viewMtx = *((D3DXMATRIX*)&mView);
+	m_viewProjectionMtxValid = false;
+	m_worldMtxsValid = false;
 }
 
 void CommonApp::SetViewMatrix(const D3DXMATRIX &viewMtx)
 {
 	m_viewMtx = viewMtx;
+	m_viewProjectionMtxValid = false;
+	m_worldMtxsValid = false;
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -596,12 +658,16 @@ void CommonApp::SetProjectionMatrix(const XMMATRIX &projectionMtx)
 	XMFLOAT4X4 mProj;
 	XMStoreFloat4x4(&mProj, projectionMtx);
 	m_projectionMtx = *((D3DXMATRIX*)&mProj);
+	m_viewProjectionMtxValid = false;
+	m_worldMtxsValid = false;
 }
 
 
 void CommonApp::SetProjectionMatrix(const D3DXMATRIX &projectionMtx)
 {
 	m_projectionMtx = projectionMtx;
+	m_viewProjectionMtxValid = false;
+	m_worldMtxsValid = false;
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -661,17 +727,124 @@ void CommonApp::DrawTexturedLit(D3D11_PRIMITIVE_TOPOLOGY topology, ID3D11Buffer
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
-void CommonApp::DrawWithShader(D3D11_PRIMITIVE_TOPOLOGY topology, ID3D11Buffer *pVertexBuffer, size_t vertexStride, ID3D11Buffer *pIndexBuffer, unsigned firstItem, unsigned numItems, ID3D11ShaderResourceView *pTextureView, ID3D11SamplerState *pTextureSampler, Shader *pShader)
+void CommonApp::DrawWithShader(D3D11_PRIMITIVE_TOPOLOGY topology, ID3D11Buffer *pVertexBuffer, size_t vertexStride, ID3D11Buffer *pIndexBuffer, unsigned firstItem, unsigned numItems, ID3D11ShaderResourceView *pTextureView, ID3D11SamplerState *pTextureSampler, Shader *pShader, DXGI_FORMAT indexFormat)
+{
+	RenderDraw draw;
+
+	draw.topology = topology;
+	draw.pVertexBuffer = pVertexBuffer;
+	draw.vertexStride = unsigned(vertexStride);
+	draw.pIndexBuffer = pIndexBuffer;
+	draw.indexFormat = indexFormat;
+	draw.firstItem = firstItem;
+	draw.numItems = numItems;
+
+	this->RecordDraw(draw, pTextureView, pTextureSampler, pShader);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void CommonApp::DrawInstancedWithShader(D3D11_PRIMITIVE_TOPOLOGY topology, ID3D11Buffer *pVertexBuffer, size_t vertexStride, ID3D11Buffer *pInstanceBuffer, size_t instanceStride, unsigned numInstances, ID3D11Buffer *pIndexBuffer, unsigned firstItem, unsigned numItems, ID3D11ShaderResourceView *pTextureView, ID3D11SamplerState *pTextureSampler, Shader *pShader, DXGI_FORMAT indexFormat)
+{
+	if (numInstances == 0)
+		return;
+
+	RenderDraw draw;
+
+	draw.topology = topology;
+	draw.pVertexBuffer = pVertexBuffer;
+	draw.vertexStride = unsigned(vertexStride);
+	draw.pInstanceBuffer = pInstanceBuffer;
+	draw.instanceStride = unsigned(instanceStride);
+	draw.numInstances = numInstances;
+	draw.pIndexBuffer = pIndexBuffer;
+	draw.indexFormat = indexFormat;
+	draw.firstItem = firstItem;
+	draw.numItems = numItems;
+
+	this->RecordDraw(draw, pTextureView, pTextureSampler, pShader);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void CommonApp::RecordDraw(const RenderDraw &draw, ID3D11ShaderResourceView *pTextureView, ID3D11SamplerState *pTextureSampler, Shader *pShader)
+{
+	// A queued draw can end up anywhere, so it takes its states with
+	// it. The queue drops the ones that turn out not to change anything.
+	if (m_queueingDraws)
+		this->RecordCurrentStates();
+
+	this->SetUpShader(pTextureView, pTextureSampler, pShader);
+
+	RenderDraw shaderDraw = draw;
+	shaderDraw.pVS = pShader->pVS;
+	shaderDraw.pPS = pShader->pPS;
+	shaderDraw.pIL = pShader->pIL;
+
+	this->GetRenderCommands()->Draw(shaderDraw);
+
+	this->ClearShaderTexture(pShader);
+
+	if (m_queueingDraws)
+		m_drawQueue.EndItem(this->GetDrawSortKey(pTextureView, pShader));
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void CommonApp::RecordCurrentStates()
+{
+	RenderCommandBuffer *pCommands = this->GetRenderCommands();
+
+	pCommands->SetBlendState(m_apBlendStates[m_blendState]);
+	pCommands->SetDepthStencilState(m_apDepthStencilStates[m_depthStencilState]);
+	pCommands->SetRasterizerState(m_apRasterizerStates[m_rasterizerState]);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+uint64_t CommonApp::GetDrawSortKey(ID3D11ShaderResourceView *pTextureView, const Shader *pShader) const
 {
+	// 1 + 2 + 2 bits, to fit RenderQueue::KEY_STATE_BITS.
+	const unsigned state = unsigned(m_rasterizerState << 3 | m_depthStencilState << 1 | m_blendState);
+
+	// View space z of the world matrix's origin.
+	const float depth = m_worldMtx._41 * m_viewMtx._13 + m_worldMtx._42 * m_viewMtx._23 + m_worldMtx._43 * m_viewMtx._33 + m_viewMtx._43;
+
+	return RenderQueue::MakeKey(pShader->sortId, state, pTextureView, depth);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void CommonApp::SetUpShader(ID3D11ShaderResourceView *pTextureView, ID3D11SamplerState *pTextureSampler, Shader *pShader)
+{
+	RenderCommandBuffer *pCommands = this->GetRenderCommands();
+
 	if (pShader->pVSCBuffer || pShader->pPSCBuffer)
 	{
-		D3D11_MAPPED_SUBRESOURCE vsMap;
-		if (!pShader->pVSCBuffer || FAILED(m_pD3DDeviceContext->Map(pShader->pVSCBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &vsMap)))
-			vsMap.pData = NULL;
+		// The constants are written into the command buffer, and copied
+		// to the cbuffers when it's replayed. Both updates are recorded
+		// before either is filled in, since recording may move the
+		// command buffer's memory.
+		size_t vsOffset = 0;
+		if (pShader->pVSCBuffer)
+			vsOffset = pCommands->UpdateBuffer(pShader->pVSCBuffer, 0, pShader->vsCBufferSizeBytes, true);
+
+		size_t psOffset = 0;
+		if (pShader->pPSCBuffer)
+			psOffset = pCommands->UpdateBuffer(pShader->pPSCBuffer, 0, pShader->psCBufferSizeBytes, true);
+
+		D3D11_MAPPED_SUBRESOURCE vsMap = {};
+		if (pShader->pVSCBuffer)
+			vsMap.pData = pCommands->GetData(vsOffset);
 
-		D3D11_MAPPED_SUBRESOURCE psMap;
-		if (!pShader->pPSCBuffer || FAILED(m_pD3DDeviceContext->Map(pShader->pPSCBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &psMap)))
-			psMap.pData = NULL;
+		D3D11_MAPPED_SUBRESOURCE psMap = {};
+		if (pShader->pPSCBuffer)
+			psMap.pData = pCommands->GetData(psOffset);
 
 		// This bit of code does all the work, every time, relying on
 		// on SetCBufferXXX to check if the given input value is
@@ -683,17 +856,12 @@ void CommonApp::DrawWithShader(D3D11_PRIMITIVE_TOPOLOGY topology, ID3D11Buffer *
 		// calculate it. Or if the shader doesn't have a numLights
 		// constant, skip all the lighting setup. And so on.
 
-		D3DXMATRIX wvp;
-		this->GetWVP(&wvp);
+		// Only recalculated if the matrices have changed since the last
+		// draw.
+		this->UpdateWorldMatrices();
 
-		D3DXMATRIX invXposeW;
-		if (D3DXMatrixInverse(&invXposeW, NULL, &m_worldMtx))
-			D3DXMatrixTranspose(&invXposeW, &invXposeW);
-		else
-		{
-			// Inversion failed... erm...
-			invXposeW = m_worldMtx;
-		}
+		const D3DXMATRIX &wvp = *reinterpret_cast<const D3DXMATRIX *>(&m_wvpMtx);
+		const D3DXMATRIX &invXposeW = *reinterpret_cast<const D3DXMATRIX *>(&m_invXposeWMtx);
 
 		SetCBufferFloat4x4(vsMap, pShader->vsGlobals.wvp, wvp);
 		SetCBufferFloat4x4(psMap, pShader->psGlobals.wvp, wvp);
@@ -779,90 +947,35 @@ void CommonApp::DrawWithShader(D3D11_PRIMITIVE_TOPOLOGY topology, ID3D11Buffer *
 		SetCBufferInt(psMap, pShader->psGlobals.numLights, numLights);
 		SetCBufferInt(vsMap, pShader->vsGlobals.numLights, numLights);
 
-		if (vsMap.pData)
-			m_pD3DDeviceContext->Unmap(pShader->pVSCBuffer, 0);
-
-		if (psMap.pData)
-			m_pD3DDeviceContext->Unmap(pShader->pPSCBuffer, 0);
-
 		if (pShader->pVSCBuffer)
-		{
-			ID3D11Buffer *apConstantBuffers[1] = {
-				pShader->pVSCBuffer,
-			};
-
-			m_pD3DDeviceContext->VSSetConstantBuffers(pShader->vsGlobals.cbuffer, 1, apConstantBuffers);
-		}
+			pCommands->SetConstantBuffer(RenderStage_VS, pShader->vsGlobals.cbuffer, pShader->pVSCBuffer);
 
 		if (pShader->pPSCBuffer)
-		{
-			ID3D11Buffer *apConstantBuffers[1] = {
-				pShader->pPSCBuffer,
-			};
-
-			m_pD3DDeviceContext->PSSetConstantBuffers(pShader->psGlobals.cbuffer, 1, apConstantBuffers);
-		}
+			pCommands->SetConstantBuffer(RenderStage_PS, pShader->psGlobals.cbuffer, pShader->pPSCBuffer);
 	}
 
-	// Set up vertex shader
-	m_pD3DDeviceContext->VSSetShader(pShader->pVS, NULL, 0);
-
-	// Set up pixel shader
-	m_pD3DDeviceContext->PSSetShader(pShader->pPS, NULL, 0);
+	// The shaders themselves are set by the draw.
 
 	if (pShader->psTexture >= 0)
-	{
-		ID3D11ShaderResourceView *apTextureViews[1] = {
-			pTextureView,
-		};
-
-		m_pD3DDeviceContext->PSSetShaderResources(pShader->psTexture, 1, apTextureViews);
-	}
+		pCommands->SetShaderResource(RenderStage_PS, pShader->psTexture, pTextureView);
 
 	if (pShader->psSampler >= 0)
-	{
-		ID3D11SamplerState *apSamplerStates[1] = {
-			pTextureSampler,
-		};
-
-		m_pD3DDeviceContext->PSSetSamplers(pShader->psSampler, 1, apSamplerStates);
-	}
-
-	// Draw
-	m_pD3DDeviceContext->IASetPrimitiveTopology(topology);
-
-	m_pD3DDeviceContext->IASetInputLayout(pShader->pIL);
-
-	ID3D11Buffer *apVertexBuffers[1] = {
-		pVertexBuffer,
-	};
-	UINT aStrides[1] = {
-		vertexStride,
-	};
-	UINT aOffsets[1] = {
-		0,
-	};
-	m_pD3DDeviceContext->IASetVertexBuffers(0, 1, apVertexBuffers, aStrides, aOffsets);
-
-	if (pIndexBuffer)
-	{
-		m_pD3DDeviceContext->IASetIndexBuffer(pIndexBuffer, DXGI_FORMAT_R16_UINT, 0);
+		pCommands->SetSampler(pShader->psSampler, pTextureSampler);
+}
 
-		m_pD3DDeviceContext->DrawIndexed(numItems, firstItem, 0);
-	}
-	else
-		m_pD3DDeviceContext->Draw(numItems, firstItem);
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
 
+void CommonApp::ClearShaderTexture(Shader *pShader)
+{
 	if (pShader->psTexture >= 0)
 	{
+		RenderCommandBuffer *pCommands = this->GetRenderCommands();
+
 		// Strictly speaking, this isn't necessary. It makes use of render
 		// targets a bit simpler though.
 
-		ID3D11ShaderResourceView *apTextureViews[1] = {
-			NULL,
-		};
-
-		m_pD3DDeviceContext->PSSetShaderResources(pShader->psTexture, 1, apTextureViews);
+		pCommands->SetShaderResource(RenderStage_PS, pShader->psTexture, NULL);
 	}
 }
 
@@ -975,7 +1088,11 @@ void CommonApp::SetBlendState(bool blendEnable)
 	if (blendEnable)
 		i |= BLEND_STATE_BLEND_ENABLE;
 
-	m_pD3DDeviceContext->OMSetBlendState(m_apBlendStates[i], NULL, 0xFFFFFFFF);
+	m_blendState = i;
+
+	// Queued draws record their states themselves.
+	if (!m_queueingDraws)
+		m_renderCommands.SetBlendState(m_apBlendStates[i]);
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -991,7 +1108,11 @@ void CommonApp::SetDepthStencilState(bool depthTest, bool depthWrite)
 	if (depthWrite)
 		i |= DEPTH_STENCIL_STATE_DEPTH_WRITE_ENABLE;
 
-	m_pD3DDeviceContext->OMSetDepthStencilState(m_apDepthStencilStates[i], 0);
+	m_depthStencilState = i;
+
+	// Queued draws record their states themselves.
+	if (!m_queueingDraws)
+		m_renderCommands.SetDepthStencilState(m_apDepthStencilStates[i]);
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -1007,7 +1128,11 @@ void CommonApp::SetRasterizerState(bool backFaceCull, bool wireframe)
 	if (wireframe)
 		i |= RASTERIZER_STATE_WIREFRAME;
 
-	m_pD3DDeviceContext->RSSetState(m_apRasterizerStates[i]);
+	m_rasterizerState = i;
+
+	// Queued draws record their states themselves.
+	if (!m_queueingDraws)
+		m_renderCommands.SetRasterizerState(m_apRasterizerStates[i]);
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -1034,9 +1159,73 @@ ID3D11SamplerState *CommonApp::GetSamplerState(bool bilinear, bool mipmap, bool
 
 void CommonApp::Clear(const XMFLOAT4 &clearColour)
 {
-	m_pD3DDeviceContext->ClearRenderTargetView(m_pD3DRenderTargetView, (float*)&clearColour);
+	m_renderCommands.Clear(m_pD3DRenderTargetView, m_pD3DDepthStencilView, clearColour);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+RenderCommandBuffer *CommonApp::GetRenderCommands()
+{
+	if (m_queueingDraws)
+		return m_drawQueue.GetCommands();
+
+	return &m_renderCommands;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void CommonApp::SubmitRenderCommands()
+{
+	assert(!m_queueingDraws);
+
+	if (m_pRenderBackend)
+		m_renderCommands.Execute(m_pRenderBackend);
 
-	m_pD3DDeviceContext->ClearDepthStencilView(m_pD3DDepthStencilView, D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.f, 0);
+	m_renderCommands.Reset();
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void CommonApp::SetRenderBackend(RenderBackend *pBackend)
+{
+	m_pRenderBackend = pBackend ? pBackend : m_pD3D11RenderBackend;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void CommonApp::BeginDrawQueue()
+{
+	assert(!m_queueingDraws);
+
+	m_queueingDraws = true;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void CommonApp::EndDrawQueue()
+{
+	assert(m_queueingDraws);
+
+	m_queueingDraws = false;
+
+	m_drawQueue.Flush(&m_renderCommands);
+
+	// The last queued draw may have left different states set from the
+	// current ones.
+	this->RecordCurrentStates();
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void CommonApp::HandleEndRender()
+{
+	this->SubmitRenderCommands();
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -1081,7 +1270,10 @@ pVS(NULL),
 pPS(NULL),
 pIL(NULL),
 pVSCBuffer(NULL),
-pPSCBuffer(NULL)
+pPSCBuffer(NULL),
+vsCBufferSizeBytes(0),
+psCBufferSizeBytes(0),
+sortId(0)
 {
 	this->Reset();
 }
@@ -1107,6 +1299,9 @@ void CommonApp::Shader::Reset()
 
 	Release(this->pPSCBuffer);
 	Release(this->pVSCBuffer);
+	this->vsCBufferSizeBytes = 0;
+	this->psCBufferSizeBytes = 0;
+	this->sortId = 0;
 	Release(this->pIL);
 	Release(this->pPS);
 	Release(this->pVS);
@@ -1176,14 +1371,19 @@ void CommonApp::CreateShaderFromCompiledShader(Shader *pShader, ID3D11VertexShad
 	pShader->pIL = pIL;
 	pShader->pPS = pPS;
 
+	pShader->sortId = ++m_numShadersCreated;
+
 	FindShaderVars(&pShader->vsGlobals, pVSDescription);
 	FindShaderVars(&pShader->psGlobals, pPSDescription);
 
 	pPSDescription->FindTexture("g_texture", &pShader->psTexture);
 	pPSDescription->FindSamplerState("g_sampler", &pShader->psSampler);
 
-	pShader->pVSCBuffer = CreateBuffer(m_pD3DDevice, pVSDescription->GetCBufferSizeBytes(pShader->vsGlobals.cbuffer), D3D11_USAGE_DYNAMIC, D3D11_BIND_CONSTANT_BUFFER, D3D11_CPU_ACCESS_WRITE, NULL);
-	pShader->pPSCBuffer = CreateBuffer(m_pD3DDevice, pPSDescription->GetCBufferSizeBytes(pShader->psGlobals.cbuffer), D3D11_USAGE_DYNAMIC, D3D11_BIND_CONSTANT_BUFFER, D3D11_CPU_ACCESS_WRITE, NULL);
+	pShader->vsCBufferSizeBytes = unsigned(pVSDescription->GetCBufferSizeBytes(pShader->vsGlobals.cbuffer));
+	pShader->psCBufferSizeBytes = unsigned(pPSDescription->GetCBufferSizeBytes(pShader->psGlobals.cbuffer));
+
+	pShader->pVSCBuffer = CreateBuffer(m_pD3DDevice, pShader->vsCBufferSizeBytes, D3D11_USAGE_DYNAMIC, D3D11_BIND_CONSTANT_BUFFER, D3D11_CPU_ACCESS_WRITE, NULL);
+	pShader->pPSCBuffer = CreateBuffer(m_pD3DDevice, pShader->psCBufferSizeBytes, D3D11_USAGE_DYNAMIC, D3D11_BIND_CONSTANT_BUFFER, D3D11_CPU_ACCESS_WRITE, NULL);
 
 	// Should perhaps handle the error case, but it makes things easier
 	// not to. The worst that will happen is that something won't get
@@ -1209,6 +1409,14 @@ CommonApp::Shader *CommonApp::GetUntexturedLitShader()
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
+CommonApp::Shader *CommonApp::GetUntexturedLitInstancedShader()
+{
+	return &m_shaderUntexturedLitInstanced;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
 CommonApp::Shader *CommonApp::GetTexturedShader()
 {
 	return &m_shaderTextured;
@@ -1233,12 +1441,107 @@ type(Type_None)
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
-void CommonApp::GetWVP(D3DXMATRIX *pWVP) const
+void CommonApp::UpdateWorldMatrices()
 {
-	D3DXMATRIX vp;
-	D3DXMatrixMultiply(&vp,&m_viewMtx,&m_projectionMtx);
+	if (m_worldMtxsValid)
+		return;
+
+	if (!m_viewProjectionMtxValid)
+	{
+		XMMATRIX view = XMLoadFloat4x4(reinterpret_cast<const XMFLOAT4X4 *>(&m_viewMtx));
+		XMMATRIX projection = XMLoadFloat4x4(reinterpret_cast<const XMFLOAT4X4 *>(&m_projectionMtx));
+
+		XMStoreFloat4x4(&m_viewProjectionMtx, XMMatrixMultiply(view, projection));
+		m_viewProjectionMtxValid = true;
+	}
 
-	D3DXMatrixMultiply(pWVP,&m_worldMtx,&vp);
+	ComputeWorldMatrices(m_viewProjectionMtx, reinterpret_cast<const XMFLOAT4X4 *>(&m_worldMtx), 1, &m_wvpMtx, &m_invXposeWMtx);
+	m_worldMtxsValid = true;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void CommonApp::ComputeWorldMatrices(const XMFLOAT4X4 &viewProjectionMtx, const XMFLOAT4X4 *pWorldMtxs, size_t numMtxs, XMFLOAT4X4 *pWVPMtxs, XMFLOAT4X4 *pInvXposeWMtxs)
+{
+	// Relative to the squared scale.
+	const float UNIFORM_SCALE_EPSILON = 1e-5f;
+
+	const XMMATRIX viewProjection = XMLoadFloat4x4(&viewProjectionMtx);
+
+	for (size_t i = 0; i < numMtxs; ++i)
+	{
+		const XMMATRIX world = XMLoadFloat4x4(&pWorldMtxs[i]);
+
+		if (pWVPMtxs)
+			XMStoreFloat4x4(&pWVPMtxs[i], XMMatrixMultiply(world, viewProjection));
+
+		if (!pInvXposeWMtxs)
+			continue;
+
+		// If the upper 3x3 is s*R, with R a rotation, its inverse
+		// transpose is just itself divided by s^2. That's the case when
+		// its rows are all the same length and at right angles to each
+		// other. The last column has to be 0, 0, 0, 1 as well.
+		//
+		// Working with the columns gets all three row lengths, and all
+		// three dot products between rows, in one go.
+		const XMMATRIX columns = XMMatrixTranspose(world);
+		const XMVECTOR c0 = columns.r[0];
+		const XMVECTOR c1 = columns.r[1];
+		const XMVECTOR c2 = columns.r[2];
+
+		// (r0.r0, r1.r1, r2.r2)
+		XMVECTOR lengthsSq = XMVectorMultiply(c0, c0);
+		lengthsSq = XMVectorMultiplyAdd(c1, c1, lengthsSq);
+		lengthsSq = XMVectorMultiplyAdd(c2, c2, lengthsSq);
+
+		// (r0.r1, r1.r2, r2.r0)
+		XMVECTOR offAxis = XMVectorMultiply(c0, XMVectorSwizzle(c0, 1, 2, 0, 3));
+		offAxis = XMVectorMultiplyAdd(c1, XMVectorSwizzle(c1, 1, 2, 0, 3), offAxis);
+		offAxis = XMVectorMultiplyAdd(c2, XMVectorSwizzle(c2, 1, 2, 0, 3), offAxis);
+
+		const XMVECTOR lengthSq = XMVectorSplatX(lengthsSq);
+		const XMVECTOR epsilon = XMVectorScale(lengthSq, UNIFORM_SCALE_EPSILON);
+
+		if (XMVectorGetX(lengthSq) > 0.f &&
+			XMVector3NearEqual(lengthsSq, lengthSq, epsilon) &&
+			XMVector3LessOrEqual(XMVectorAbs(offAxis), epsilon) &&
+			XMVector4Equal(columns.r[3], g_XMIdentityR3))
+		{
+			const XMVECTOR invLengthSq = XMVectorReciprocal(lengthSq);
+			const XMVECTOR t = world.r[3];
+
+			// (r0.t, r1.t, r2.t)
+			XMVECTOR translationDots = XMVectorMultiply(c0, XMVectorSplatX(t));
+			translationDots = XMVectorMultiplyAdd(c1, XMVectorSplatY(t), translationDots);
+			translationDots = XMVectorMultiplyAdd(c2, XMVectorSplatZ(t), translationDots);
+
+			// Row i of the result is r_i/s^2, with -(r_i.t)/s^2 in w, and
+			// the last row is 0, 0, 0, 1. Built transposed, so that it
+			// comes from the columns too.
+			XMMATRIX invW;
+			invW.r[0] = XMVectorAndInt(XMVectorMultiply(c0, invLengthSq), g_XMMask3);
+			invW.r[1] = XMVectorAndInt(XMVectorMultiply(c1, invLengthSq), g_XMMask3);
+			invW.r[2] = XMVectorAndInt(XMVectorMultiply(c2, invLengthSq), g_XMMask3);
+			invW.r[3] = XMVectorSelect(g_XMIdentityR3, XMVectorNegate(XMVectorMultiply(translationDots, invLengthSq)), g_XMSelect1110);
+
+			XMStoreFloat4x4(&pInvXposeWMtxs[i], XMMatrixTranspose(invW));
+		}
+		else
+		{
+			XMVECTOR determinant;
+			const XMMATRIX inverse = XMMatrixInverse(&determinant, world);
+
+			if (XMVectorGetX(determinant) != 0.f)
+				XMStoreFloat4x4(&pInvXposeWMtxs[i], XMMatrixTranspose(inverse));
+			else
+			{
+				// Inversion failed... erm...
+				pInvXposeWMtxs[i] = pWorldMtxs[i];
+			}
+		}
+	}
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -6,6 +6,8 @@
 
 #include "App.h"
 #include "D3DHelpers.h"
+#include "RenderCommands.h"
+#include "RenderQueue.h"
 #include <D3DX10math.h>
 
 #include <DirectXMath.h>
@@ -125,6 +127,23 @@ extern const unsigned g_vertexDescSize_Pos3fColour4ubNormal3fTex2f;
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
+// This is the per instance type to use with the UntexturedLitInstanced
+// shader. Each vertex is scaled by `scale' then moved by `pos', before
+// the world matrix is applied.
+
+struct Instance_Pos3fScale1f
+{
+	D3DXVECTOR3 pos;
+	float scale;
+};
+
+// Vertex_Pos3fColour4ubNormal3f in slot 0, Instance_Pos3fScale1f in slot 1.
+extern const D3D11_INPUT_ELEMENT_DESC g_aVertexDesc_Pos3fColour4ubNormal3f_InstancePos3fScale1f[];
+extern const unsigned g_vertexDescSize_Pos3fColour4ubNormal3f_InstancePos3fScale1f;
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
 class CommonApp:
 public App
 {
@@ -149,6 +168,17 @@ public:
 	void SetProjectionMatrix(const XMMATRIX &projectionMtx);
 	void SetProjectionMatrix(const D3DXMATRIX &projectionMtx);
 
+	// The matrices each draw needs from a world matrix: world-view-
+	// projection, and the inverse transpose of the world matrix for
+	// transforming normals. pWVPMtxs or pInvXposeWMtxs may be NULL if
+	// not wanted.
+	//
+	// Worlds that are only rotation, translation and uniform scale -
+	// which is most of them - get their inverse transpose without a
+	// general 4x4 inverse. If the world matrix can't be inverted, it's
+	// used as its own inverse transpose.
+	static void ComputeWorldMatrices(const XMFLOAT4X4 &viewProjectionMtx, const XMFLOAT4X4 *pWorldMtxs, size_t numMtxs, XMFLOAT4X4 *pWVPMtxs, XMFLOAT4X4 *pInvXposeWMtxs);
+
 	// Simplified camera setup. FOV is PI/4.
 	void SetDefaultProjectionMatrix(float aspect = 1.f);
 
@@ -216,8 +246,16 @@ public:
 	// MAX_NUM_LIGHTS. They are filled in contiguously, even if the
 	// enabled lights aren't contiguous.
 	//
+	// indexFormat is only used when pIndexBuffer is supplied.
+	//
 	class Shader;
-	void DrawWithShader(D3D11_PRIMITIVE_TOPOLOGY topology, ID3D11Buffer *pVertexBuffer, size_t vertexStride, ID3D11Buffer *pIndexBuffer, unsigned firstItem, unsigned numItems, ID3D11ShaderResourceView *pTextureView, ID3D11SamplerState *pTextureSampler, Shader *pShader);
+	void DrawWithShader(D3D11_PRIMITIVE_TOPOLOGY topology, ID3D11Buffer *pVertexBuffer, size_t vertexStride, ID3D11Buffer *pIndexBuffer, unsigned firstItem, unsigned numItems, ID3D11ShaderResourceView *pTextureView, ID3D11SamplerState *pTextureSampler, Shader *pShader, DXGI_FORMAT indexFormat = DXGI_FORMAT_R16_UINT);
+
+	// As DrawWithShader, but draws numInstances copies in one call, with
+	// pInstanceBuffer bound to vertex buffer slot 1. The constants are
+	// set up once for the whole draw, so the world matrix applies to
+	// every instance.
+	void DrawInstancedWithShader(D3D11_PRIMITIVE_TOPOLOGY topology, ID3D11Buffer *pVertexBuffer, size_t vertexStride, ID3D11Buffer *pInstanceBuffer, size_t instanceStride, unsigned numInstances, ID3D11Buffer *pIndexBuffer, unsigned firstItem, unsigned numItems, ID3D11ShaderResourceView *pTextureView, ID3D11SamplerState *pTextureSampler, Shader *pShader, DXGI_FORMAT indexFormat = DXGI_FORMAT_R16_UINT);
 
 	// Set constant colour.
 	void SetConstantColour(const D3DXVECTOR4 &constantColour);
@@ -256,6 +294,38 @@ public:
 	// Poll key state.
 	bool IsKeyPressed(int vkey) const;
 
+	// Nothing above talks to the device context directly. The draws,
+	// state changes and constant uploads are recorded into a command
+	// buffer, which is replayed through the render backend once
+	// HandleRender returns.
+	//
+	// Any D3D work of your own done while rendering should be recorded
+	// into GetRenderCommands too, so that it happens in the right
+	// order relative to the CommonApp draws.
+	RenderCommandBuffer *GetRenderCommands();
+
+	// Replays the commands recorded so far and resets the buffer. This
+	// happens automatically after HandleRender.
+	void SubmitRenderCommands();
+
+	// Replace the backend commands are submitted to. NULL restores the
+	// D3D11 one.
+	void SetRenderBackend(RenderBackend *pBackend);
+
+	// Between BeginDrawQueue and EndDrawQueue, draws go into a
+	// RenderQueue rather than straight into the command buffer. Each
+	// one takes the blend, depth/stencil and rasterizer states that
+	// were current when it was drawn, and they're sorted by shader,
+	// state, texture and then view space depth of the world matrix's
+	// origin, with repeated state changes left out.
+	//
+	// Anything recorded via GetRenderCommands in the meantime belongs
+	// to the draw that follows it. Draws that depend on their order,
+	// such as text and other overlays, should be done outside the
+	// queue.
+	void BeginDrawQueue();
+	void EndDrawQueue();
+
 	// The `Shader' struct describes a shader. It has pointers to the
 	// relevant D3D shader objects, and a list of ints, holding the
 	// pack offsets/slots (as appropriate) of each shader input value
@@ -316,6 +386,13 @@ public:
 		ID3D11Buffer *pVSCBuffer;
 		ID3D11Buffer *pPSCBuffer;
 
+		unsigned vsCBufferSizeBytes;
+		unsigned psCBufferSizeBytes;
+
+		// Draws with the same sortId are grouped together in the draw
+		// queue.
+		unsigned sortId;
+
 		Shader();
 		~Shader();
 
@@ -339,9 +416,13 @@ public:
 	Shader *GetUntexturedLitShader();
 	Shader *GetTexturedShader();
 	Shader *GetTexturedLitShader();
+
+	// UntexturedLit, with an Instance_Pos3fScale1f per instance.
+	Shader *GetUntexturedLitInstancedShader();
 protected:
 	bool HandleStart();
 	void HandleStop();
+	void HandleEndRender();
 private:
 	struct Light
 	{
@@ -400,6 +481,21 @@ private:
 	Shader m_shaderUntexturedLit;
 	Shader m_shaderTextured;
 	Shader m_shaderTexturedLit;
+	Shader m_shaderUntexturedLitInstanced;
+
+	RenderCommandBuffer m_renderCommands;
+	D3D11RenderBackend *m_pD3D11RenderBackend;
+	RenderBackend *m_pRenderBackend;
+
+	RenderQueue m_drawQueue;
+	bool m_queueingDraws;
+
+	unsigned m_numShadersCreated;
+
+	// Indexes of the current states in the arrays above.
+	int m_blendState;
+	int m_depthStencilState;
+	int m_rasterizerState;
 
 	// Current settings
 	D3DXMATRIX m_projectionMtx;
@@ -407,7 +503,22 @@ private:
 	D3DXMATRIX m_worldMtx;
 	D3DXVECTOR4 m_constantColour;
 
-	void GetWVP(D3DXMATRIX *pWVP) const;
+	// Derived from the above as needed. View-projection only changes
+	// when the view or projection does, which is usually once a frame.
+	XMFLOAT4X4 m_viewProjectionMtx;
+	XMFLOAT4X4 m_wvpMtx;
+	XMFLOAT4X4 m_invXposeWMtx;
+	bool m_viewProjectionMtxValid;
+	bool m_worldMtxsValid;
+
+	void UpdateWorldMatrices();
+
+	// Shared by DrawWithShader and DrawInstancedWithShader.
+	void RecordDraw(const RenderDraw &draw, ID3D11ShaderResourceView *pTextureView, ID3D11SamplerState *pTextureSampler, Shader *pShader);
+	void SetUpShader(ID3D11ShaderResourceView *pTextureView, ID3D11SamplerState *pTextureSampler, Shader *pShader);
+	void ClearShaderTexture(Shader *pShader);
+	void RecordCurrentStates();
+	uint64_t GetDrawSortKey(ID3D11ShaderResourceView *pTextureView, const Shader *pShader) const;
 	Light *GetLight(int light);
 };
 
@@ -382,10 +382,8 @@ static const CommonFont::Style DEFAULT_STYLE;
 
 void CommonFont::DrawString(const D3DXVECTOR3 &startPos, const Style *pStyle, const char *pStr)
 {
-	HRESULT hr;
-
 	ID3D11SamplerState *pSamplerState = m_pApp->GetSamplerState(true);
-	ID3D11DeviceContext *pContext = m_pApp->GetDeviceContext();
+	RenderCommandBuffer *pCommands = m_pApp->GetRenderCommands();
 	Vertex_Pos3fColour4ubTex2f *pVtxs = NULL;
 	int numChars = 0;
 
@@ -411,8 +409,6 @@ void CommonFont::DrawString(const D3DXVECTOR3 &startPos, const Style *pStyle, co
 		{
 			assert(numChars == NUM_CHARS);
 
-			pContext->Unmap(m_pVB, 0);
-
 			m_pApp->DrawTextured(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, m_pVB, m_pIB, numChars * 6, m_pTextureView, pSamplerState);
 
 			pVtxs = NULL;
@@ -421,15 +417,12 @@ void CommonFont::DrawString(const D3DXVECTOR3 &startPos, const Style *pStyle, co
 
 		if (!pVtxs)
 		{
-			D3D11_MAPPED_SUBRESOURCE ms;
-			hr = pContext->Map(m_pVB, 0, D3D11_MAP_WRITE_DISCARD, 0, &ms);
-			if (FAILED(hr))
-			{
-				// erm...
-				return;
-			}
-
-			pVtxs = static_cast<Vertex_Pos3fColour4ubTex2f *>(ms.pData);
+			// The vertices go into the command buffer, and replace the
+			// VB contents when it's replayed. Nothing else is recorded
+			// until they're drawn, so the pointer stays valid.
+			size_t offset = pCommands->UpdateBuffer(m_pVB, 0, NUM_VTXS * sizeof(Vertex_Pos3fColour4ubTex2f), true);
+
+			pVtxs = static_cast<Vertex_Pos3fColour4ubTex2f *>(pCommands->GetData(offset));
 			numChars = 0;
 		}
 
@@ -471,9 +464,6 @@ void CommonFont::DrawString(const D3DXVECTOR3 &startPos, const Style *pStyle, co
 		pos.x += pGlyph->size.x * pStyle->scale.x;
 	}
 
-	if (pVtxs)
-		pContext->Unmap(m_pVB, 0);
-
 	if (numChars > 0)
 		m_pApp->DrawTextured(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, m_pVB, m_pIB, numChars * 6, m_pTextureView, pSamplerState);
 }
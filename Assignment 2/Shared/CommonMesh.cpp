@@ -8,8 +8,10 @@
 
 #include "CommonApp.h"
 #include "CommonMesh.h"
+#include "MeshGenerators.h"
 
 #include <assert.h>
+#include <stddef.h>
 
 #include <algorithm>
 
@@ -192,107 +194,47 @@ done:
 
 CommonMesh *CommonMesh::NewBoxMesh(CommonApp *pApp, float width, float height, float depth)
 {
-	HRESULT hr;
-	IDirect3DDevice9 *pDevice9 = NULL;
-	ID3DXMesh *pMesh9 = NULL;
-	CommonMesh *pMesh = NULL;
-
-	pDevice9 = CreateDevice9();
-	if (!pDevice9)
-		goto done;
-
-	hr = D3DXCreateBox(pDevice9, width, height, depth, &pMesh9, NULL);
-	if (FAILED(hr))
-		goto done;
-
-	pMesh = ConvertFromD3DXMesh(pApp, pMesh9, NULL);
-
-done:
-	Release(pMesh9);
-	Release(pDevice9);
+	GeneratedMesh mesh;
+	if (!GenerateBoxMesh(&mesh, width, height, depth))
+		return NULL;
 
-	return pMesh;
+	return NewFromGeneratedMesh(pApp, mesh);
 }
 
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
-CommonMesh *CommonMesh::NewCylinderMesh(CommonApp *pApp, float radius1, float radius2, float length, unsigned slices, unsigned stacks)
+CommonMesh *CommonMesh::NewCylinderMesh(CommonApp *pApp, float radius1, float radius2, float length, unsigned slices, unsigned stacks, unsigned lod)
 {
-	HRESULT hr;
-	IDirect3DDevice9 *pDevice9 = NULL;
-	ID3DXMesh *pMesh9 = NULL;
-	CommonMesh *pMesh = NULL;
-
-	pDevice9 = CreateDevice9();
-	if (!pDevice9)
-		goto done;
-
-	hr = D3DXCreateCylinder(pDevice9, radius1, radius2, length, slices, stacks, &pMesh9, NULL);
-	if (FAILED(hr))
-		goto done;
-
-	pMesh = ConvertFromD3DXMesh(pApp, pMesh9, NULL);
-
-done:
-	Release(pMesh9);
-	Release(pDevice9);
+	GeneratedMesh mesh;
+	if (!GenerateCylinderMesh(&mesh, radius1, radius2, length, GetLodDetail(slices, lod, 3), GetLodDetail(stacks, lod, 1)))
+		return NULL;
 
-	return pMesh;
+	return NewFromGeneratedMesh(pApp, mesh);
 }
 
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
-CommonMesh *CommonMesh::NewSphereMesh(CommonApp *pApp, float radius, unsigned slices, unsigned stacks)
+CommonMesh *CommonMesh::NewSphereMesh(CommonApp *pApp, float radius, unsigned slices, unsigned stacks, unsigned lod)
 {
-	HRESULT hr;
-	IDirect3DDevice9 *pDevice9 = NULL;
-	ID3DXMesh *pMesh9 = NULL;
-	CommonMesh *pMesh = NULL;
-
-	pDevice9 = CreateDevice9();
-	if (!pDevice9)
-		goto done;
-
-	hr = D3DXCreateSphere(pDevice9, radius, slices, stacks, &pMesh9, NULL);
-	if (FAILED(hr))
-		goto done;
-
-	pMesh = ConvertFromD3DXMesh(pApp, pMesh9, NULL);
-
-done:
-	Release(pMesh9);
-	Release(pDevice9);
+	GeneratedMesh mesh;
+	if (!GenerateSphereMesh(&mesh, radius, GetLodDetail(slices, lod, 3), GetLodDetail(stacks, lod, 2)))
+		return NULL;
 
-	return pMesh;
+	return NewFromGeneratedMesh(pApp, mesh);
 }
 
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
-CommonMesh *CommonMesh::NewTorusMesh(CommonApp *pApp, float innerRadius, float outerRadius, unsigned sides, unsigned rings)
+CommonMesh *CommonMesh::NewTorusMesh(CommonApp *pApp, float innerRadius, float outerRadius, unsigned sides, unsigned rings, unsigned lod)
 {
-	HRESULT hr;
-	IDirect3DDevice9 *pDevice9 = NULL;
-	ID3DXMesh *pMesh9 = NULL;
-	CommonMesh *pMesh = NULL;
-
-	pDevice9 = CreateDevice9();
-	if (!pDevice9)
-		goto done;
-
-	hr = D3DXCreateTorus(pDevice9, innerRadius, outerRadius, sides, rings, &pMesh9, NULL);
-	if (FAILED(hr))
-		goto done;
-
-	pMesh = ConvertFromD3DXMesh(pApp, pMesh9, NULL);
-
-done:
-	Release(pMesh9);
-	Release(pDevice9);
+	GeneratedMesh mesh;
+	if (!GenerateTorusMesh(&mesh, innerRadius, outerRadius, GetLodDetail(sides, lod, 3), GetLodDetail(rings, lod, 3)))
+		return NULL;
 
-	return pMesh;
+	return NewFromGeneratedMesh(pApp, mesh);
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -396,6 +338,29 @@ void CommonMesh::DrawSubset(size_t subsetIndex)
 //////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////
 
+void CommonMesh::DrawInstanced(CommonApp::Shader *pShader, ID3D11Buffer *pInstanceBuffer, size_t instanceStride, unsigned numInstances)
+{
+	for (size_t i = 0; i < m_numSubsets; ++i)
+		this->DrawSubsetInstanced(i, pShader, pInstanceBuffer, instanceStride, numInstances);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void CommonMesh::DrawSubsetInstanced(size_t subsetIndex, CommonApp::Shader *pShader, ID3D11Buffer *pInstanceBuffer, size_t instanceStride, unsigned numInstances)
+{
+	if (subsetIndex >= m_numSubsets)
+		return;
+
+	const Subset *pSubset = &m_pSubsets[subsetIndex];
+
+	m_pApp->DrawInstancedWithShader(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST, pSubset->pVertexBuffer, pSubset->vtxStride, pInstanceBuffer, instanceStride, numInstances,
+		pSubset->pIndexBuffer, pSubset->firstItem, pSubset->numItems, pSubset->pTextureView, pSubset->pSamplerState, pShader);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
 void CommonMesh::GetSubsetLocalAABB(size_t subsetIndex, D3DXVECTOR3 *pLocalAABBMin, D3DXVECTOR3 *pLocalAABBMax) const
 {
 	assert(subsetIndex < m_numSubsets);
@@ -437,6 +402,63 @@ static void UpdateLocalAABB(D3DXVECTOR3 *pAABBMin, D3DXVECTOR3 *pAABBMax, DWORD
 	}
 }
 
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+// The generated vertices go straight into the vertex buffer.
+static_assert(sizeof(GeneratedVertex) == sizeof(Vertex_Pos3fColour4ubNormal3f), "GeneratedVertex doesn't match Vertex_Pos3fColour4ubNormal3f");
+static_assert(offsetof(GeneratedVertex, colour) == offsetof(Vertex_Pos3fColour4ubNormal3f, colour), "GeneratedVertex doesn't match Vertex_Pos3fColour4ubNormal3f");
+static_assert(offsetof(GeneratedVertex, normal) == offsetof(Vertex_Pos3fColour4ubNormal3f, normal), "GeneratedVertex doesn't match Vertex_Pos3fColour4ubNormal3f");
+
+CommonMesh *CommonMesh::NewFromGeneratedMesh(CommonApp *pApp, const GeneratedMesh &mesh)
+{
+	if (mesh.vertices.empty() || mesh.indices.empty())
+		return NULL;
+
+	ID3D11Device *pDevice = pApp->GetDevice();
+
+	ID3D11Buffer *pVertexBuffer = CreateImmutableVertexBuffer(pDevice, UINT(mesh.vertices.size() * sizeof(GeneratedVertex)), &mesh.vertices[0]);
+	ID3D11Buffer *pIndexBuffer = CreateImmutableIndexBuffer(pDevice, UINT(mesh.indices.size() * sizeof(uint16_t)), &mesh.indices[0]);
+
+	if (!pVertexBuffer || !pIndexBuffer)
+	{
+		Release(pVertexBuffer);
+		Release(pIndexBuffer);
+
+		return NULL;
+	}
+
+	CommonMesh *pResult = new CommonMesh;
+	pResult->m_pApp = pApp;
+
+	pResult->m_pSubsets = new Subset[1];
+	pResult->m_numSubsets = 1;
+
+	Subset *pSubset = &pResult->m_pSubsets[0];
+
+	pSubset->pShader = pApp->GetUntexturedLitShader();
+
+	pSubset->firstItem = 0;
+	pSubset->numItems = unsigned(mesh.indices.size());
+
+	pSubset->pVertexBuffer = pVertexBuffer;
+	pSubset->vtxStride = sizeof(GeneratedVertex);
+
+	pSubset->pIndexBuffer = pIndexBuffer;
+
+	for (size_t i = 0; i < mesh.vertices.size(); ++i)
+	{
+		const float *pPos = mesh.vertices[i].pos;
+
+		UpdateLocalAABB(&pSubset->localAABBMin, &pSubset->localAABBMax, DWORD(i), D3DXVECTOR3(pPos[0], pPos[1], pPos[2]));
+	}
+
+	return pResult;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
 CommonMesh *CommonMesh::ConvertFromD3DXMesh(CommonApp *pApp, ID3DXMesh *pMesh9, ID3DXBuffer *pMaterialsBuffer9)
 {
 	CommonMesh *pResult = new CommonMesh;
@@ -6,6 +6,7 @@
 
 struct ID3DXMesh;
 struct ID3DXBuffer;
+struct GeneratedMesh;
 
 #include "CommonApp.h"
 
@@ -17,10 +18,21 @@ class CommonMesh
 public:
 	static CommonMesh *LoadFromXFile(CommonApp *pApp, const char *pFileName);
 	static CommonMesh *NewBoxMesh(CommonApp *pApp, float width, float height, float depth);
-	static CommonMesh *NewCylinderMesh(CommonApp *pApp, float radius1, float radius2, float length, unsigned slices, unsigned stacks);
-	static CommonMesh *NewSphereMesh(CommonApp *pApp, float radius1, unsigned slices, unsigned stacks);
-	static CommonMesh *NewTorusMesh(CommonApp *pApp, float innerRadius, float outerRadius, unsigned sides, unsigned rings);
+
+	// lod 0 is the detail given; each level after that has about half
+	// as many slices, stacks, sides and rings as the one before, down
+	// to the fewest that still make a solid shape.
+	static CommonMesh *NewCylinderMesh(CommonApp *pApp, float radius1, float radius2, float length, unsigned slices, unsigned stacks, unsigned lod = 0);
+	static CommonMesh *NewSphereMesh(CommonApp *pApp, float radius1, unsigned slices, unsigned stacks, unsigned lod = 0);
+	static CommonMesh *NewTorusMesh(CommonApp *pApp, float innerRadius, float outerRadius, unsigned sides, unsigned rings, unsigned lod = 0);
+
 	static CommonMesh *NewTeapotMesh(CommonApp *pApp);
+
+	// Makes a one subset mesh, drawn with the untextured lit shader, from
+	// the output of one of the MeshGenerators functions. The box, cylinder,
+	// sphere and torus are made this way; the teapot and X files still go
+	// through D3DX.
+	static CommonMesh *NewFromGeneratedMesh(CommonApp *pApp, const GeneratedMesh &mesh);
 		
 	~CommonMesh();
 
@@ -34,6 +46,12 @@ public:
 	CommonApp::Shader *GetSubsetShader(size_t subsetIndex) const;
 	void SetSubsetShader(size_t subsetIndex, CommonApp::Shader *pShader);
 	void DrawSubset(size_t subsetIndex);
+
+	// Draw numInstances copies of each subset with one call per subset.
+	// pShader is used for every subset, so it has to take the subsets'
+	// vertex type in slot 0 and the instance data in slot 1.
+	void DrawInstanced(CommonApp::Shader *pShader, ID3D11Buffer *pInstanceBuffer, size_t instanceStride, unsigned numInstances);
+	void DrawSubsetInstanced(size_t subsetIndex, CommonApp::Shader *pShader, ID3D11Buffer *pInstanceBuffer, size_t instanceStride, unsigned numInstances);
 	void GetSubsetLocalAABB(size_t subsetIndex, D3DXVECTOR3 *pLocalAABBMin, D3DXVECTOR3 *pLocalAABBMax) const;
 
 	// Many meshes have only one subset.
@@ -0,0 +1,381 @@
+#include "MeshGenerators.h"
+
+#include <math.h>
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+static const float PI = 3.14159265358979f;
+
+static const size_t MAX_VERTICES = 65536;
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void GeneratedMesh::Clear()
+{
+	this->vertices.clear();
+	this->indices.clear();
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+static void AddVertex(GeneratedMesh *pMesh, float x, float y, float z, float nx, float ny, float nz)
+{
+	GeneratedVertex v;
+
+	v.pos[0] = x;
+	v.pos[1] = y;
+	v.pos[2] = z;
+
+	v.colour[0] = v.colour[1] = v.colour[2] = v.colour[3] = 255;
+
+	v.normal[0] = nx;
+	v.normal[1] = ny;
+	v.normal[2] = nz;
+
+	pMesh->vertices.push_back(v);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+static void AddTriangle(GeneratedMesh *pMesh, size_t i0, size_t i1, size_t i2)
+{
+	pMesh->indices.push_back(uint16_t(i0));
+	pMesh->indices.push_back(uint16_t(i1));
+	pMesh->indices.push_back(uint16_t(i2));
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+// i0, i1, i2, i3 go round the quad clockwise, seen from the front.
+static void AddQuad(GeneratedMesh *pMesh, size_t i0, size_t i1, size_t i2, size_t i3)
+{
+	AddTriangle(pMesh, i0, i1, i2);
+	AddTriangle(pMesh, i0, i2, i3);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+static void Reserve(GeneratedMesh *pMesh, size_t numVertices, size_t numTriangles)
+{
+	pMesh->Clear();
+	pMesh->vertices.reserve(numVertices);
+	pMesh->indices.reserve(numTriangles * 3);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+bool GenerateBoxMesh(GeneratedMesh *pMesh, float width, float height, float depth)
+{
+	pMesh->Clear();
+
+	if (!(width >= 0.f && height >= 0.f && depth >= 0.f))
+		return false;
+
+	Reserve(pMesh, 24, 12);
+
+	const float halfSizes[3] = {width * .5f, height * .5f, depth * .5f};
+
+	// Four vertices per face, so each face gets its own normal. Axes u
+	// and v are the other two, in the order that makes the corners
+	// below go round clockwise from outside.
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		for (int sign = -1; sign <= 1; sign += 2)
+		{
+			const int u = (axis + (sign > 0 ? 2 : 1)) % 3;
+			const int v = (axis + (sign > 0 ? 1 : 2)) % 3;
+
+			const size_t first = pMesh->vertices.size();
+
+			static const float aCorners[4][2] = {{-1.f, -1.f}, {-1.f, 1.f}, {1.f, 1.f}, {1.f, -1.f}};
+
+			for (int corner = 0; corner < 4; ++corner)
+			{
+				float pos[3], normal[3] = {0.f, 0.f, 0.f};
+
+				pos[axis] = sign * halfSizes[axis];
+				pos[u] = aCorners[corner][0] * halfSizes[u];
+				pos[v] = aCorners[corner][1] * halfSizes[v];
+
+				normal[axis] = float(sign);
+
+				AddVertex(pMesh, pos[0], pos[1], pos[2], normal[0], normal[1], normal[2]);
+			}
+
+			AddQuad(pMesh, first + 0, first + 1, first + 2, first + 3);
+		}
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+bool GenerateCylinderMesh(GeneratedMesh *pMesh, float radius1, float radius2, float length, unsigned slices, unsigned stacks)
+{
+	pMesh->Clear();
+
+	if (!(radius1 >= 0.f && radius2 >= 0.f && length >= 0.f) || slices < 2 || stacks < 1)
+		return false;
+
+	// A ring of side vertices per stack boundary, then each cap as a
+	// fan round its own centre, so the edges stay sharp.
+	const size_t numVertices = (stacks + 1) * size_t(slices) + 2 * (1 + size_t(slices));
+	if (numVertices > MAX_VERTICES)
+		return false;
+
+	Reserve(pMesh, numVertices, 2 * size_t(slices) * stacks + 2 * size_t(slices));
+
+	// Radius 1 is at -z. The side normals lean towards the narrow end.
+	const float slope = length > 0.f ? (radius1 - radius2) / length : 0.f;
+	const float normalScale = 1.f / sqrtf(1.f + slope * slope);
+
+	for (unsigned stack = 0; stack <= stacks; ++stack)
+	{
+		const float t = float(stack) / stacks;
+		const float z = (t - .5f) * length;
+		const float radius = radius1 + (radius2 - radius1) * t;
+
+		for (unsigned slice = 0; slice < slices; ++slice)
+		{
+			const float theta = 2.f * PI * slice / slices;
+			const float c = cosf(theta), s = sinf(theta);
+
+			AddVertex(pMesh, c * radius, s * radius, z, c * normalScale, s * normalScale, slope * normalScale);
+		}
+	}
+
+	for (unsigned stack = 0; stack < stacks; ++stack)
+	{
+		const size_t ring0 = stack * size_t(slices);
+		const size_t ring1 = ring0 + slices;
+
+		for (unsigned slice = 0; slice < slices; ++slice)
+		{
+			const unsigned next = (slice + 1) % slices;
+
+			AddQuad(pMesh, ring0 + slice, ring0 + next, ring1 + next, ring1 + slice);
+		}
+	}
+
+	for (int end = 0; end < 2; ++end)
+	{
+		const float z = end == 0 ? -.5f * length : .5f * length;
+		const float nz = end == 0 ? -1.f : 1.f;
+		const float radius = end == 0 ? radius1 : radius2;
+
+		const size_t centre = pMesh->vertices.size();
+		AddVertex(pMesh, 0.f, 0.f, z, 0.f, 0.f, nz);
+
+		for (unsigned slice = 0; slice < slices; ++slice)
+		{
+			const float theta = 2.f * PI * slice / slices;
+
+			AddVertex(pMesh, cosf(theta) * radius, sinf(theta) * radius, z, 0.f, 0.f, nz);
+		}
+
+		for (unsigned slice = 0; slice < slices; ++slice)
+		{
+			const size_t i0 = centre + 1 + slice;
+			const size_t i1 = centre + 1 + (slice + 1) % slices;
+
+			if (end == 0)
+				AddTriangle(pMesh, centre, i1, i0);
+			else
+				AddTriangle(pMesh, centre, i0, i1);
+		}
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+bool GenerateSphereMesh(GeneratedMesh *pMesh, float radius, unsigned slices, unsigned stacks)
+{
+	pMesh->Clear();
+
+	if (!(radius >= 0.f) || slices < 2 || stacks < 2)
+		return false;
+
+	// A vertex at each pole, and a ring per stack boundary between.
+	const size_t numRings = stacks - 1;
+	const size_t numVertices = 2 + numRings * slices;
+	if (numVertices > MAX_VERTICES)
+		return false;
+
+	Reserve(pMesh, numVertices, 2 * size_t(slices) * numRings);
+
+	AddVertex(pMesh, 0.f, 0.f, radius, 0.f, 0.f, 1.f);
+
+	for (size_t ring = 0; ring < numRings; ++ring)
+	{
+		const float phi = PI * (ring + 1) / stacks;
+		const float sinPhi = sinf(phi), cosPhi = cosf(phi);
+
+		for (unsigned slice = 0; slice < slices; ++slice)
+		{
+			const float theta = 2.f * PI * slice / slices;
+			const float nx = sinPhi * cosf(theta), ny = sinPhi * sinf(theta);
+
+			AddVertex(pMesh, nx * radius, ny * radius, cosPhi * radius, nx, ny, cosPhi);
+		}
+	}
+
+	const size_t bottom = pMesh->vertices.size();
+	AddVertex(pMesh, 0.f, 0.f, -radius, 0.f, 0.f, -1.f);
+
+	for (unsigned slice = 0; slice < slices; ++slice)
+	{
+		const unsigned next = (slice + 1) % slices;
+
+		AddTriangle(pMesh, 0, 1 + slice, 1 + next);
+
+		for (size_t ring = 0; ring + 1 < numRings; ++ring)
+		{
+			const size_t ring0 = 1 + ring * slices;
+			const size_t ring1 = ring0 + slices;
+
+			AddQuad(pMesh, ring0 + slice, ring1 + slice, ring1 + next, ring0 + next);
+		}
+
+		const size_t lastRing = 1 + (numRings - 1) * slices;
+		AddTriangle(pMesh, bottom, lastRing + next, lastRing + slice);
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+bool GenerateTorusMesh(GeneratedMesh *pMesh, float innerRadius, float outerRadius, unsigned sides, unsigned rings)
+{
+	pMesh->Clear();
+
+	// As D3DX, innerRadius is the radius of the tube and outerRadius the
+	// distance from the centre of the torus to the middle of the tube.
+	if (!(innerRadius >= 0.f && outerRadius >= 0.f) || sides < 3 || rings < 3)
+		return false;
+
+	const size_t numVertices = size_t(sides) * rings;
+	if (numVertices > MAX_VERTICES)
+		return false;
+
+	Reserve(pMesh, numVertices, 2 * numVertices);
+
+	for (unsigned ring = 0; ring < rings; ++ring)
+	{
+		const float theta = 2.f * PI * ring / rings;
+		const float cosTheta = cosf(theta), sinTheta = sinf(theta);
+
+		for (unsigned side = 0; side < sides; ++side)
+		{
+			const float phi = 2.f * PI * side / sides;
+			const float cosPhi = cosf(phi), sinPhi = sinf(phi);
+
+			const float nx = cosPhi * cosTheta, ny = cosPhi * sinTheta, nz = sinPhi;
+
+			AddVertex(pMesh, cosTheta * outerRadius + nx * innerRadius, sinTheta * outerRadius + ny * innerRadius, nz * innerRadius, nx, ny, nz);
+		}
+	}
+
+	for (unsigned ring = 0; ring < rings; ++ring)
+	{
+		const size_t ring0 = ring * size_t(sides);
+		const size_t ring1 = (ring + 1) % rings * size_t(sides);
+
+		for (unsigned side = 0; side < sides; ++side)
+		{
+			const unsigned next = (side + 1) % sides;
+
+			AddQuad(pMesh, ring0 + side, ring1 + side, ring1 + next, ring0 + next);
+		}
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+unsigned GetLodDetail(unsigned detail, unsigned lod, unsigned minDetail)
+{
+	const unsigned lodDetail = lod < 32 ? detail >> lod : 0;
+
+	return lodDetail > minDetail ? lodDetail : minDetail;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+size_t CountGeneratedMeshErrors(const GeneratedMesh &mesh, size_t numVertices, size_t numTriangles)
+{
+	const float NORMAL_LENGTH_TOLERANCE = 1.0e-3f;
+
+	size_t numErrors = 0;
+
+	if (mesh.vertices.size() != numVertices)
+		++numErrors;
+
+	if (mesh.indices.size() != numTriangles * 3)
+		++numErrors;
+
+	for (size_t i = 0; i < mesh.vertices.size(); ++i)
+	{
+		const float *pNormal = mesh.vertices[i].normal;
+		const float length = sqrtf(pNormal[0] * pNormal[0] + pNormal[1] * pNormal[1] + pNormal[2] * pNormal[2]);
+
+		if (!(fabsf(length - 1.0f) <= NORMAL_LENGTH_TOLERANCE))
+			++numErrors;
+	}
+
+	for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+	{
+		const uint16_t *pIndices = &mesh.indices[i];
+
+		if (pIndices[0] >= mesh.vertices.size() || pIndices[1] >= mesh.vertices.size() || pIndices[2] >= mesh.vertices.size())
+		{
+			++numErrors;
+			continue;
+		}
+
+		const GeneratedVertex &v0 = mesh.vertices[pIndices[0]];
+		const GeneratedVertex &v1 = mesh.vertices[pIndices[1]];
+		const GeneratedVertex &v2 = mesh.vertices[pIndices[2]];
+
+		float e1[3], e2[3], n[3];
+		for (int j = 0; j < 3; ++j)
+		{
+			e1[j] = v1.pos[j] - v0.pos[j];
+			e2[j] = v2.pos[j] - v0.pos[j];
+			n[j] = v0.normal[j] + v1.normal[j] + v2.normal[j];
+		}
+
+		// With y up and z into the screen, e1 x e2 points out of the side
+		// from which v0, v1, v2 go round clockwise.
+		const float face[3] =
+		{
+			e1[1] * e2[2] - e1[2] * e2[1],
+			e1[2] * e2[0] - e1[0] * e2[2],
+			e1[0] * e2[1] - e1[1] * e2[0],
+		};
+
+		if (!(face[0] * n[0] + face[1] * n[1] + face[2] * n[2] > 0.0f))
+			++numErrors;
+	}
+
+	return numErrors;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
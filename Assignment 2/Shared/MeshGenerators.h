@@ -0,0 +1,78 @@
+#ifndef HEADER_A35907232A7B449C9E9DBE16EFAD3801
+#define HEADER_A35907232A7B449C9E9DBE16EFAD3801
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+//
+// Procedural meshes.
+//
+// These build the same shapes as the D3DX functions of the same
+// names - centred on the origin, with the main axis along z and
+// clockwise front faces - straight into vertex and index arrays.
+// There's no device of any kind involved, and nothing here needs
+// Windows, so they can be run and timed anywhere.
+//
+// The vertices are laid out exactly like Vertex_Pos3fColour4ubNormal3f,
+// so CommonMesh::NewFromGeneratedMesh can make the D3D11 buffers from
+// the arrays as they are. Colours are white.
+//
+// Each generator returns false, leaving the mesh empty, if the
+// parameters don't make a shape or the mesh wouldn't fit 16-bit
+// indices.
+//
+// For levels of detail, generate the shape again with each detail
+// parameter passed through GetLodDetail.
+//
+// CountGeneratedMeshErrors checks a mesh without needing a device
+// either, so the generators can be tested wherever they can be built.
+// MeshGeneratorsTest builds them on their own with CMake to do that.
+//
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+struct GeneratedVertex
+{
+	float pos[3];
+	uint8_t colour[4];// r, g, b, a
+	float normal[3];
+};
+
+struct GeneratedMesh
+{
+	std::vector<GeneratedVertex> vertices;
+	std::vector<uint16_t> indices;// triangle list
+
+	void Clear();
+};
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+bool GenerateBoxMesh(GeneratedMesh *pMesh, float width, float height, float depth);
+bool GenerateCylinderMesh(GeneratedMesh *pMesh, float radius1, float radius2, float length, unsigned slices, unsigned stacks);
+bool GenerateSphereMesh(GeneratedMesh *pMesh, float radius, unsigned slices, unsigned stacks);
+bool GenerateTorusMesh(GeneratedMesh *pMesh, float innerRadius, float outerRadius, unsigned sides, unsigned rings);
+
+// Detail parameter for level lod, each level halving the one before,
+// but never less than minDetail.
+unsigned GetLodDetail(unsigned detail, unsigned lod, unsigned minDetail);
+
+// Number of things wrong with a generated mesh: a vertex or triangle
+// count other than the one expected, indices past the last vertex,
+// normals that aren't unit length, and triangles wound so that their
+// front faces away from their vertex normals (i.e., not clockwise seen
+// from outside). Each bad vertex or triangle counts once.
+size_t CountGeneratedMeshErrors(const GeneratedMesh &mesh, size_t numVertices, size_t numTriangles);
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+#endif//HEADER_A35907232A7B449C9E9DBE16EFAD3801
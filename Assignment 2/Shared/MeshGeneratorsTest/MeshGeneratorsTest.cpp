@@ -0,0 +1,157 @@
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+//
+// Checks and times the procedural meshes, with nothing but
+// MeshGenerators.cpp - no device, no Windows - so it builds and runs
+// anywhere. Every shape is generated at each level of detail, with
+// the same detail and minimums as CommonMesh uses, and checked with
+// CountGeneratedMeshErrors. Returns non-zero if anything is wrong.
+//
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+#include "MeshGenerators.h"
+
+#include <stdio.h>
+
+#include <chrono>
+#include <functional>
+#include <utility>
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+static const unsigned LOD_COUNT = 5;
+static const int GENERATE_REPEATS = 1000;
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+struct Shape
+{
+	const char *pName;
+	std::function<bool(GeneratedMesh *)> generate;
+	size_t numVertices, numTriangles;
+};
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+static size_t CheckShape(const Shape &shape, unsigned lod)
+{
+	GeneratedMesh mesh;
+	const size_t numErrors = shape.generate(&mesh) ? CountGeneratedMeshErrors(mesh, shape.numVertices, shape.numTriangles) : 1;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < GENERATE_REPEATS; ++i)
+		shape.generate(&mesh);
+	const double generateUs = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count() / GENERATE_REPEATS;
+
+	printf("%-8s lod %u: %5zu vertices, %5zu triangles, %8.2f us per generate, %zu errors\n",
+		shape.pName, lod, mesh.vertices.size(), mesh.indices.size() / 3, generateUs, numErrors);
+
+	return numErrors;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+static size_t CheckLods()
+{
+	size_t totalErrors = 0;
+
+	for (unsigned lod = 0; lod < LOD_COUNT; ++lod)
+	{
+		const unsigned cylinderSlices = GetLodDetail(16, lod, 3), cylinderStacks = GetLodDetail(4, lod, 1);
+		const unsigned sphereSlices = GetLodDetail(16, lod, 3), sphereStacks = GetLodDetail(16, lod, 2);
+		const unsigned torusSides = GetLodDetail(16, lod, 3), torusRings = GetLodDetail(32, lod, 3);
+
+		const Shape shapes[] =
+		{
+			{ "box", [](GeneratedMesh *pMesh) { return GenerateBoxMesh(pMesh, 1.0f, 2.0f, 3.0f); }, 24, 12 },
+			{ "cylinder", [=](GeneratedMesh *pMesh) { return GenerateCylinderMesh(pMesh, 1.0f, 0.5f, 2.0f, cylinderSlices, cylinderStacks); },
+				(cylinderStacks + 1) * cylinderSlices + 2 * (1 + cylinderSlices), 2 * cylinderSlices * cylinderStacks + 2 * cylinderSlices },
+			{ "sphere", [=](GeneratedMesh *pMesh) { return GenerateSphereMesh(pMesh, 1.0f, sphereSlices, sphereStacks); },
+				2 + (sphereStacks - 1) * sphereSlices, 2 * sphereSlices * (sphereStacks - 1) },
+			{ "torus", [=](GeneratedMesh *pMesh) { return GenerateTorusMesh(pMesh, 0.25f, 1.0f, torusSides, torusRings); },
+				torusSides * torusRings, 2 * torusSides * torusRings },
+		};
+
+		for (const Shape &shape : shapes)
+			totalErrors += CheckShape(shape, lod);
+	}
+
+	return totalErrors;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+// The checks that should fail do: parameters that don't make a shape,
+// flat two slice shapes, and a triangle wound the wrong way.
+static size_t CheckFailures()
+{
+	size_t numFailures = 0;
+	GeneratedMesh mesh;
+
+	if (GenerateCylinderMesh(&mesh, 1.0f, 1.0f, 1.0f, 1, 1) || !mesh.vertices.empty())
+	{
+		printf("cylinder with one slice was generated\n");
+		++numFailures;
+	}
+
+	if (GenerateSphereMesh(&mesh, 1.0f, 8, 1) || !mesh.vertices.empty())
+	{
+		printf("sphere with one stack was generated\n");
+		++numFailures;
+	}
+
+	if (GenerateTorusMesh(&mesh, 0.25f, 1.0f, 2, 8) || !mesh.vertices.empty())
+	{
+		printf("torus with two sides was generated\n");
+		++numFailures;
+	}
+
+	if (GenerateSphereMesh(&mesh, -1.0f, 8, 8) || !mesh.vertices.empty())
+	{
+		printf("sphere with negative radius was generated\n");
+		++numFailures;
+	}
+
+	if (!GenerateCylinderMesh(&mesh, 1.0f, 1.0f, 1.0f, 2, 1) || CountGeneratedMeshErrors(mesh, 3 * 2 + 2 * 3, 2 * 2 + 2 * 2) == 0)
+	{
+		printf("flat two slice cylinder passed the check\n");
+		++numFailures;
+	}
+
+	if (!GenerateSphereMesh(&mesh, 1.0f, 2, 2) || CountGeneratedMeshErrors(mesh, 2 + 2, 2 * 2) == 0)
+	{
+		printf("flat two slice sphere passed the check\n");
+		++numFailures;
+	}
+
+	if (GenerateSphereMesh(&mesh, 1.0f, 8, 8))
+	{
+		std::swap(mesh.indices[1], mesh.indices[2]);
+		if (CountGeneratedMeshErrors(mesh, 2 + 7 * 8, 2 * 8 * 7) != 1)
+		{
+			printf("triangle wound the wrong way wasn't found\n");
+			++numFailures;
+		}
+	}
+
+	return numFailures;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+int main()
+{
+	const size_t totalErrors = CheckLods();
+	const size_t numFailures = CheckFailures();
+
+	printf("%zu errors, %zu failed checks\n", totalErrors, numFailures);
+
+	return totalErrors == 0 && numFailures == 0 ? 0 : 1;
+}
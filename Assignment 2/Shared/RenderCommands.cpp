@@ -0,0 +1,805 @@
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <d3d11.h>
+
+#include "D3DHelpers.h"
+#include "RenderCommands.h"
+
+#include <assert.h>
+#include <string.h>
+
+using namespace DirectX;
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+// Every record starts on this boundary, so the payloads can hold
+// pointers and floats and be read in place.
+static const size_t RENDER_COMMAND_ALIGNMENT = 8;
+
+struct RenderCommandBuffer::Header
+{
+	uint32_t type;
+	uint32_t sizeBytes;// of the whole record, header and padding included
+};
+
+namespace
+{
+	struct StateCommand
+	{
+		ID3D11DeviceChild *pState;
+	};
+
+	struct ClearCommand
+	{
+		ID3D11RenderTargetView *pRenderTargetView;
+		ID3D11DepthStencilView *pDepthStencilView;
+		XMFLOAT4 clearColour;
+	};
+
+	// The new contents follow, starting at UPDATE_BUFFER_DATA_OFFSET
+	// from the payload.
+	struct UpdateBufferCommand
+	{
+		ID3D11Buffer *pBuffer;
+		unsigned firstByte;
+		unsigned sizeBytes;
+		bool discard;
+	};
+
+	const size_t UPDATE_BUFFER_DATA_OFFSET = (sizeof(UpdateBufferCommand) + RENDER_COMMAND_ALIGNMENT - 1) & ~(RENDER_COMMAND_ALIGNMENT - 1);
+
+	struct BindCommand
+	{
+		RenderStage stage;
+		int slot;
+		IUnknown *pObject;
+	};
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+RenderDraw::RenderDraw():
+topology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST),
+pVS(NULL),
+pPS(NULL),
+pIL(NULL),
+pVertexBuffer(NULL),
+vertexStride(0),
+pInstanceBuffer(NULL),
+instanceStride(0),
+numInstances(0),
+pIndexBuffer(NULL),
+indexFormat(DXGI_FORMAT_R16_UINT),
+firstItem(0),
+numItems(0)
+{
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+RenderBackend::~RenderBackend()
+{
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void RenderBackend::BeginExecute()
+{
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+RenderStateFilter::RenderStateFilter():
+knownMask(0),
+numSkipped(0)
+{
+	for (int i = 0; i < NUM_STATES; ++i)
+		apStates[i] = NULL;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+bool RenderStateFilter::IsRedundant(RenderCommandType type, ID3D11DeviceChild *pState)
+{
+	const int i = type - RenderCommand_SetBlendState;
+
+	if (i < 0 || i >= NUM_STATES)
+		return false;
+
+	if (knownMask & (1 << i) && apStates[i] == pState)
+	{
+		++numSkipped;
+		return true;
+	}
+
+	apStates[i] = pState;
+	knownMask |= 1 << i;
+
+	return false;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+RenderCommandBuffer::RenderCommandBuffer():
+m_numCommands(0)
+{
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+RenderCommandBuffer::~RenderCommandBuffer()
+{
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void RenderCommandBuffer::Reset()
+{
+	m_data.clear();
+	m_numCommands = 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+unsigned RenderCommandBuffer::GetNumCommands() const
+{
+	return m_numCommands;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+size_t RenderCommandBuffer::GetSizeBytes() const
+{
+	return m_data.size();
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void *RenderCommandBuffer::Append(RenderCommandType type, size_t payloadSizeBytes)
+{
+	const size_t sizeBytes = (sizeof(Header) + payloadSizeBytes + RENDER_COMMAND_ALIGNMENT - 1) & ~(RENDER_COMMAND_ALIGNMENT - 1);
+	const size_t offset = m_data.size();
+
+	// resize zeroes the new bytes.
+	m_data.resize(offset + sizeBytes);
+
+	Header *pHeader = reinterpret_cast<Header *>(&m_data[offset]);
+	pHeader->type = type;
+	pHeader->sizeBytes = uint32_t(sizeBytes);
+
+	++m_numCommands;
+
+	return pHeader + 1;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void RenderCommandBuffer::SetBlendState(ID3D11BlendState *pState)
+{
+	static_cast<StateCommand *>(this->Append(RenderCommand_SetBlendState, sizeof(StateCommand)))->pState = pState;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void RenderCommandBuffer::SetDepthStencilState(ID3D11DepthStencilState *pState)
+{
+	static_cast<StateCommand *>(this->Append(RenderCommand_SetDepthStencilState, sizeof(StateCommand)))->pState = pState;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void RenderCommandBuffer::SetRasterizerState(ID3D11RasterizerState *pState)
+{
+	static_cast<StateCommand *>(this->Append(RenderCommand_SetRasterizerState, sizeof(StateCommand)))->pState = pState;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void RenderCommandBuffer::Clear(ID3D11RenderTargetView *pRenderTargetView, ID3D11DepthStencilView *pDepthStencilView, const XMFLOAT4 &clearColour)
+{
+	ClearCommand *pCommand = static_cast<ClearCommand *>(this->Append(RenderCommand_Clear, sizeof(ClearCommand)));
+
+	pCommand->pRenderTargetView = pRenderTargetView;
+	pCommand->pDepthStencilView = pDepthStencilView;
+	pCommand->clearColour = clearColour;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+size_t RenderCommandBuffer::UpdateBuffer(ID3D11Buffer *pBuffer, unsigned firstByte, unsigned sizeBytes, bool discard)
+{
+	assert(!discard || firstByte == 0);
+
+	UpdateBufferCommand *pCommand = static_cast<UpdateBufferCommand *>(this->Append(RenderCommand_UpdateBuffer, UPDATE_BUFFER_DATA_OFFSET + sizeBytes));
+
+	pCommand->pBuffer = pBuffer;
+	pCommand->firstByte = firstByte;
+	pCommand->sizeBytes = sizeBytes;
+	pCommand->discard = discard;
+
+	return reinterpret_cast<uint8_t *>(pCommand) + UPDATE_BUFFER_DATA_OFFSET - &m_data[0];
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void *RenderCommandBuffer::GetData(size_t offset)
+{
+	assert(offset <= m_data.size());
+
+	return &m_data[0] + offset;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void RenderCommandBuffer::SetConstantBuffer(RenderStage stage, int slot, ID3D11Buffer *pBuffer)
+{
+	BindCommand *pCommand = static_cast<BindCommand *>(this->Append(RenderCommand_SetConstantBuffer, sizeof(BindCommand)));
+
+	pCommand->stage = stage;
+	pCommand->slot = slot;
+	pCommand->pObject = pBuffer;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void RenderCommandBuffer::SetShaderResource(RenderStage stage, int slot, ID3D11ShaderResourceView *pView)
+{
+	BindCommand *pCommand = static_cast<BindCommand *>(this->Append(RenderCommand_SetShaderResource, sizeof(BindCommand)));
+
+	pCommand->stage = stage;
+	pCommand->slot = slot;
+	pCommand->pObject = pView;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void RenderCommandBuffer::SetSampler(int slot, ID3D11SamplerState *pSampler)
+{
+	BindCommand *pCommand = static_cast<BindCommand *>(this->Append(RenderCommand_SetSampler, sizeof(BindCommand)));
+
+	pCommand->stage = RenderStage_PS;
+	pCommand->slot = slot;
+	pCommand->pObject = pSampler;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void RenderCommandBuffer::Draw(const RenderDraw &draw)
+{
+	*static_cast<RenderDraw *>(this->Append(RenderCommand_Draw, sizeof(RenderDraw))) = draw;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void RenderCommandBuffer::AppendCommands(const RenderCommandBuffer &source, size_t firstByte, size_t endByte, RenderStateFilter *pFilter)
+{
+	assert(firstByte <= endByte && endByte <= source.m_data.size());
+
+	if (firstByte == endByte)
+		return;
+
+	const uint8_t *pRecord = &source.m_data[0] + firstByte;
+	const uint8_t *pEnd = &source.m_data[0] + endByte;
+
+	while (pRecord < pEnd)
+	{
+		const Header *pHeader = reinterpret_cast<const Header *>(pRecord);
+
+		bool redundant = false;
+
+		if (pFilter)
+		{
+			switch (pHeader->type)
+			{
+			case RenderCommand_SetBlendState:
+			case RenderCommand_SetDepthStencilState:
+			case RenderCommand_SetRasterizerState:
+				redundant = pFilter->IsRedundant(RenderCommandType(pHeader->type), reinterpret_cast<const StateCommand *>(pHeader + 1)->pState);
+				break;
+			}
+		}
+
+		if (!redundant)
+		{
+			m_data.insert(m_data.end(), pRecord, pRecord + pHeader->sizeBytes);
+			++m_numCommands;
+		}
+
+		pRecord += pHeader->sizeBytes;
+	}
+
+	assert(pRecord == pEnd);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void RenderCommandBuffer::Execute(RenderBackend *pBackend) const
+{
+	pBackend->BeginExecute();
+
+	if (m_data.empty())
+		return;
+
+	const uint8_t *pRecord = &m_data[0];
+	const uint8_t *pEnd = pRecord + m_data.size();
+
+	while (pRecord < pEnd)
+	{
+		const Header *pHeader = reinterpret_cast<const Header *>(pRecord);
+		const void *pPayload = pHeader + 1;
+
+		switch (pHeader->type)
+		{
+		case RenderCommand_SetBlendState:
+			pBackend->SetBlendState(static_cast<ID3D11BlendState *>(static_cast<const StateCommand *>(pPayload)->pState));
+			break;
+
+		case RenderCommand_SetDepthStencilState:
+			pBackend->SetDepthStencilState(static_cast<ID3D11DepthStencilState *>(static_cast<const StateCommand *>(pPayload)->pState));
+			break;
+
+		case RenderCommand_SetRasterizerState:
+			pBackend->SetRasterizerState(static_cast<ID3D11RasterizerState *>(static_cast<const StateCommand *>(pPayload)->pState));
+			break;
+
+		case RenderCommand_Clear:
+			{
+				const ClearCommand *pCommand = static_cast<const ClearCommand *>(pPayload);
+
+				pBackend->Clear(pCommand->pRenderTargetView, pCommand->pDepthStencilView, pCommand->clearColour);
+			}
+			break;
+
+		case RenderCommand_UpdateBuffer:
+			{
+				const UpdateBufferCommand *pCommand = static_cast<const UpdateBufferCommand *>(pPayload);
+
+				pBackend->UpdateBuffer(pCommand->pBuffer, pCommand->firstByte, pCommand->sizeBytes, pCommand->discard,
+					static_cast<const uint8_t *>(pPayload) + UPDATE_BUFFER_DATA_OFFSET);
+			}
+			break;
+
+		case RenderCommand_SetConstantBuffer:
+			{
+				const BindCommand *pCommand = static_cast<const BindCommand *>(pPayload);
+
+				pBackend->SetConstantBuffer(pCommand->stage, pCommand->slot, static_cast<ID3D11Buffer *>(pCommand->pObject));
+			}
+			break;
+
+		case RenderCommand_SetShaderResource:
+			{
+				const BindCommand *pCommand = static_cast<const BindCommand *>(pPayload);
+
+				pBackend->SetShaderResource(pCommand->stage, pCommand->slot, static_cast<ID3D11ShaderResourceView *>(pCommand->pObject));
+			}
+			break;
+
+		case RenderCommand_SetSampler:
+			{
+				const BindCommand *pCommand = static_cast<const BindCommand *>(pPayload);
+
+				pBackend->SetSampler(pCommand->slot, static_cast<ID3D11SamplerState *>(pCommand->pObject));
+			}
+			break;
+
+		case RenderCommand_Draw:
+			pBackend->Draw(*static_cast<const RenderDraw *>(pPayload));
+			break;
+
+		default:
+			assert(false);
+			break;
+		}
+
+		pRecord += pHeader->sizeBytes;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+D3D11RenderBackend::D3D11RenderBackend(ID3D11DeviceContext *pDeviceContext):
+m_pDeviceContext(pDeviceContext),
+m_pVS(NULL),
+m_pPS(NULL),
+m_pIL(NULL),
+m_topology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST),
+m_shadersKnown(false)
+{
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void D3D11RenderBackend::BeginExecute()
+{
+	m_shadersKnown = false;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void D3D11RenderBackend::SetBlendState(ID3D11BlendState *pState)
+{
+	m_pDeviceContext->OMSetBlendState(pState, NULL, 0xFFFFFFFF);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void D3D11RenderBackend::SetDepthStencilState(ID3D11DepthStencilState *pState)
+{
+	m_pDeviceContext->OMSetDepthStencilState(pState, 0);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void D3D11RenderBackend::SetRasterizerState(ID3D11RasterizerState *pState)
+{
+	m_pDeviceContext->RSSetState(pState);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void D3D11RenderBackend::Clear(ID3D11RenderTargetView *pRenderTargetView, ID3D11DepthStencilView *pDepthStencilView, const XMFLOAT4 &clearColour)
+{
+	if (pRenderTargetView)
+		m_pDeviceContext->ClearRenderTargetView(pRenderTargetView, &clearColour.x);
+
+	if (pDepthStencilView)
+		m_pDeviceContext->ClearDepthStencilView(pDepthStencilView, D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.f, 0);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void D3D11RenderBackend::UpdateBuffer(ID3D11Buffer *pBuffer, unsigned firstByte, unsigned sizeBytes, bool discard, const void *pData)
+{
+	if (!pBuffer)
+		return;
+
+	if (discard)
+	{
+		D3D11_MAPPED_SUBRESOURCE map;
+		if (SUCCEEDED(m_pDeviceContext->Map(pBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &map)))
+		{
+			memcpy(map.pData, pData, sizeBytes);
+			m_pDeviceContext->Unmap(pBuffer, 0);
+		}
+	}
+	else
+	{
+		D3D11_BOX box;
+		box.left = firstByte;
+		box.right = firstByte + sizeBytes;
+		box.top = 0;
+		box.bottom = 1;
+		box.front = 0;
+		box.back = 1;
+
+		m_pDeviceContext->UpdateSubresource(pBuffer, 0, &box, pData, 0, 0);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void D3D11RenderBackend::SetConstantBuffer(RenderStage stage, int slot, ID3D11Buffer *pBuffer)
+{
+	ID3D11Buffer *apConstantBuffers[1] = {
+		pBuffer,
+	};
+
+	if (stage == RenderStage_VS)
+		m_pDeviceContext->VSSetConstantBuffers(slot, 1, apConstantBuffers);
+	else
+		m_pDeviceContext->PSSetConstantBuffers(slot, 1, apConstantBuffers);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void D3D11RenderBackend::SetShaderResource(RenderStage stage, int slot, ID3D11ShaderResourceView *pView)
+{
+	ID3D11ShaderResourceView *apViews[1] = {
+		pView,
+	};
+
+	if (stage == RenderStage_VS)
+		m_pDeviceContext->VSSetShaderResources(slot, 1, apViews);
+	else
+		m_pDeviceContext->PSSetShaderResources(slot, 1, apViews);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void D3D11RenderBackend::SetSampler(int slot, ID3D11SamplerState *pSampler)
+{
+	ID3D11SamplerState *apSamplerStates[1] = {
+		pSampler,
+	};
+
+	m_pDeviceContext->PSSetSamplers(slot, 1, apSamplerStates);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void D3D11RenderBackend::Draw(const RenderDraw &draw)
+{
+	if (!m_shadersKnown || draw.pVS != m_pVS)
+		m_pDeviceContext->VSSetShader(draw.pVS, NULL, 0);
+
+	if (!m_shadersKnown || draw.pPS != m_pPS)
+		m_pDeviceContext->PSSetShader(draw.pPS, NULL, 0);
+
+	if (!m_shadersKnown || draw.topology != m_topology)
+		m_pDeviceContext->IASetPrimitiveTopology(draw.topology);
+
+	if (!m_shadersKnown || draw.pIL != m_pIL)
+		m_pDeviceContext->IASetInputLayout(draw.pIL);
+
+	m_pVS = draw.pVS;
+	m_pPS = draw.pPS;
+	m_pIL = draw.pIL;
+	m_topology = draw.topology;
+	m_shadersKnown = true;
+
+	const UINT numVertexBuffers = draw.numInstances > 0 ? 2 : 1;
+
+	ID3D11Buffer *apVertexBuffers[2] = {
+		draw.pVertexBuffer,
+		draw.pInstanceBuffer,
+	};
+	UINT aStrides[2] = {
+		draw.vertexStride,
+		draw.instanceStride,
+	};
+	UINT aOffsets[2] = {
+		0,
+		0,
+	};
+	m_pDeviceContext->IASetVertexBuffers(0, numVertexBuffers, apVertexBuffers, aStrides, aOffsets);
+
+	if (draw.pIndexBuffer)
+		m_pDeviceContext->IASetIndexBuffer(draw.pIndexBuffer, draw.indexFormat, 0);
+
+	if (draw.numInstances > 0)
+	{
+		if (draw.pIndexBuffer)
+			m_pDeviceContext->DrawIndexedInstanced(draw.numItems, draw.numInstances, draw.firstItem, 0, 0);
+		else
+			m_pDeviceContext->DrawInstanced(draw.numItems, draw.numInstances, draw.firstItem, 0);
+
+		// Leave slot 1 empty so a later non-instanced draw doesn't pick
+		// up the instance buffer.
+		ID3D11Buffer *apNoBuffers[1] = {
+			NULL,
+		};
+		UINT aNoStrides[1] = {
+			0,
+		};
+		m_pDeviceContext->IASetVertexBuffers(1, 1, apNoBuffers, aNoStrides, aOffsets);
+	}
+	else
+	{
+		if (draw.pIndexBuffer)
+			m_pDeviceContext->DrawIndexed(draw.numItems, draw.firstItem, 0);
+		else
+			m_pDeviceContext->Draw(draw.numItems, draw.firstItem);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+RenderCommandStats::RenderCommandStats():
+numDraws(0),
+numInstancedDraws(0),
+numInstances(0),
+numItems(0),
+numUploadBytes(0),
+numRedundantStateChanges(0),
+numRedundantShaderChanges(0),
+numErrors(0)
+{
+	for (int i = 0; i < RenderCommand_Count; ++i)
+		numCommands[i] = 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+NullRenderBackend::NullRenderBackend()
+{
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+const RenderCommandStats &NullRenderBackend::GetStats() const
+{
+	return m_stats;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void NullRenderBackend::ResetStats()
+{
+	m_stats = RenderCommandStats();
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void NullRenderBackend::BeginExecute()
+{
+	m_stateFilter = RenderStateFilter();
+	m_lastDraw = RenderDraw();
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void NullRenderBackend::Check(bool ok, const char *pWhat)
+{
+	if (!ok)
+	{
+		++m_stats.numErrors;
+		dprintf("NullRenderBackend: %s\n", pWhat);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void NullRenderBackend::SetBlendState(ID3D11BlendState *pState)
+{
+	++m_stats.numCommands[RenderCommand_SetBlendState];
+	this->Check(pState != NULL, "NULL blend state");
+
+	if (m_stateFilter.IsRedundant(RenderCommand_SetBlendState, pState))
+		++m_stats.numRedundantStateChanges;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void NullRenderBackend::SetDepthStencilState(ID3D11DepthStencilState *pState)
+{
+	++m_stats.numCommands[RenderCommand_SetDepthStencilState];
+	this->Check(pState != NULL, "NULL depth/stencil state");
+
+	if (m_stateFilter.IsRedundant(RenderCommand_SetDepthStencilState, pState))
+		++m_stats.numRedundantStateChanges;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void NullRenderBackend::SetRasterizerState(ID3D11RasterizerState *pState)
+{
+	++m_stats.numCommands[RenderCommand_SetRasterizerState];
+	this->Check(pState != NULL, "NULL rasterizer state");
+
+	if (m_stateFilter.IsRedundant(RenderCommand_SetRasterizerState, pState))
+		++m_stats.numRedundantStateChanges;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void NullRenderBackend::Clear(ID3D11RenderTargetView *pRenderTargetView, ID3D11DepthStencilView *pDepthStencilView, const XMFLOAT4 &clearColour)
+{
+	++m_stats.numCommands[RenderCommand_Clear];
+	this->Check(pRenderTargetView != NULL || pDepthStencilView != NULL, "clear with nothing to clear");
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void NullRenderBackend::UpdateBuffer(ID3D11Buffer *pBuffer, unsigned firstByte, unsigned sizeBytes, bool discard, const void *pData)
+{
+	++m_stats.numCommands[RenderCommand_UpdateBuffer];
+	m_stats.numUploadBytes += sizeBytes;
+
+	this->Check(pBuffer != NULL, "update of NULL buffer");
+	this->Check(sizeBytes > 0, "empty buffer update");
+	this->Check(!discard || firstByte == 0, "discarding update doesn't start at the beginning of the buffer");
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void NullRenderBackend::SetConstantBuffer(RenderStage stage, int slot, ID3D11Buffer *pBuffer)
+{
+	++m_stats.numCommands[RenderCommand_SetConstantBuffer];
+
+	this->Check(slot >= 0 && slot < D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT, "constant buffer slot out of range");
+	this->Check(pBuffer != NULL, "NULL constant buffer");
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void NullRenderBackend::SetShaderResource(RenderStage stage, int slot, ID3D11ShaderResourceView *pView)
+{
+	++m_stats.numCommands[RenderCommand_SetShaderResource];
+
+	// NULL is fine here - it's how textures get unbound.
+	this->Check(slot >= 0 && slot < D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT, "shader resource slot out of range");
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void NullRenderBackend::SetSampler(int slot, ID3D11SamplerState *pSampler)
+{
+	++m_stats.numCommands[RenderCommand_SetSampler];
+
+	this->Check(slot >= 0 && slot < D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT, "sampler slot out of range");
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void NullRenderBackend::Draw(const RenderDraw &draw)
+{
+	++m_stats.numCommands[RenderCommand_Draw];
+	++m_stats.numDraws;
+	m_stats.numItems += draw.numItems;
+
+	this->Check(draw.pVS != NULL && draw.pPS != NULL, "draw without shaders");
+	this->Check(draw.pIL != NULL, "draw without an input layout");
+	this->Check(draw.pVertexBuffer != NULL && draw.vertexStride > 0, "draw without a vertex buffer");
+	this->Check(draw.numItems > 0, "empty draw");
+
+	if (draw.numInstances > 0)
+	{
+		++m_stats.numInstancedDraws;
+		m_stats.numInstances += draw.numInstances;
+
+		this->Check(draw.pInstanceBuffer != NULL && draw.instanceStride > 0, "instanced draw without an instance buffer");
+	}
+
+	if (draw.pIndexBuffer)
+		this->Check(draw.indexFormat == DXGI_FORMAT_R16_UINT || draw.indexFormat == DXGI_FORMAT_R32_UINT, "bad index format");
+
+	// (m_lastDraw's shaders are NULL before the first draw.)
+	if (draw.pVS == m_lastDraw.pVS && draw.pPS == m_lastDraw.pPS && draw.pIL == m_lastDraw.pIL)
+		++m_stats.numRedundantShaderChanges;
+
+	m_lastDraw = draw;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
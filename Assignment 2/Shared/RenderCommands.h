@@ -0,0 +1,296 @@
+#ifndef HEADER_89024EC9BDEE405D8CFDC2890459D42A
+#define HEADER_89024EC9BDEE405D8CFDC2890459D42A
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+//
+// Render commands.
+//
+// Rather than talking to the device context directly, CommonApp
+// records everything it does during a frame - state changes, buffer
+// uploads, resource bindings and draws - into a RenderCommandBuffer.
+// The buffer is a packed stream of variable-sized records that only
+// holds D3D object pointers and plain data, so it can be built
+// without touching the device context at all.
+//
+// Execute replays the buffer through a RenderBackend.
+// D3D11RenderBackend makes the corresponding device context calls;
+// NullRenderBackend just counts and checks the commands, which makes
+// it possible to time building a frame without a GPU.
+//
+// AppendCommands copies commands from one buffer to another, which is
+// how RenderQueue puts its sorted draws into the frame.
+//
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+#include <d3d11.h>
+#include <DirectXMath.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+enum RenderCommandType
+{
+	RenderCommand_SetBlendState,
+	RenderCommand_SetDepthStencilState,
+	RenderCommand_SetRasterizerState,
+	RenderCommand_Clear,
+	RenderCommand_UpdateBuffer,
+	RenderCommand_SetConstantBuffer,
+	RenderCommand_SetShaderResource,
+	RenderCommand_SetSampler,
+	RenderCommand_Draw,
+
+	RenderCommand_Count,
+};
+
+enum RenderStage
+{
+	RenderStage_VS,
+	RenderStage_PS,
+};
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+// Everything needed for one draw call. If numInstances is 0, it's an
+// ordinary draw and pInstanceBuffer is ignored; otherwise the
+// instance buffer is bound to vertex buffer slot 1 for the draw.
+//
+// If pIndexBuffer is NULL, the draw isn't indexed and firstItem and
+// numItems refer to vertices.
+
+struct RenderDraw
+{
+	D3D11_PRIMITIVE_TOPOLOGY topology;
+
+	ID3D11VertexShader *pVS;
+	ID3D11PixelShader *pPS;
+	ID3D11InputLayout *pIL;
+
+	ID3D11Buffer *pVertexBuffer;
+	unsigned vertexStride;
+
+	ID3D11Buffer *pInstanceBuffer;
+	unsigned instanceStride;
+	unsigned numInstances;
+
+	ID3D11Buffer *pIndexBuffer;
+	DXGI_FORMAT indexFormat;
+
+	unsigned firstItem;
+	unsigned numItems;
+
+	RenderDraw();
+};
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+class RenderBackend
+{
+public:
+	virtual ~RenderBackend();
+
+	// Called before each buffer is replayed. Anything the backend
+	// remembers about the device's state should be forgotten, since it
+	// may have been changed behind the backend's back.
+	virtual void BeginExecute();
+
+	virtual void SetBlendState(ID3D11BlendState *pState) = 0;
+	virtual void SetDepthStencilState(ID3D11DepthStencilState *pState) = 0;
+	virtual void SetRasterizerState(ID3D11RasterizerState *pState) = 0;
+	virtual void Clear(ID3D11RenderTargetView *pRenderTargetView, ID3D11DepthStencilView *pDepthStencilView, const DirectX::XMFLOAT4 &clearColour) = 0;
+
+	// If discard is set, the whole buffer is replaced (firstByte is
+	// always 0); otherwise bytes [firstByte, firstByte+sizeBytes) are
+	// updated and the rest left alone.
+	virtual void UpdateBuffer(ID3D11Buffer *pBuffer, unsigned firstByte, unsigned sizeBytes, bool discard, const void *pData) = 0;
+
+	virtual void SetConstantBuffer(RenderStage stage, int slot, ID3D11Buffer *pBuffer) = 0;
+	virtual void SetShaderResource(RenderStage stage, int slot, ID3D11ShaderResourceView *pView) = 0;
+	virtual void SetSampler(int slot, ID3D11SamplerState *pSampler) = 0;
+	virtual void Draw(const RenderDraw &draw) = 0;
+};
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+// The blend, depth/stencil and rasterizer states set by a stream of
+// commands, for spotting state changes that don't change anything.
+// Until a state is first set, it's unknown, and setting it isn't
+// redundant.
+
+struct RenderStateFilter
+{
+	static const int NUM_STATES = RenderCommand_SetRasterizerState - RenderCommand_SetBlendState + 1;
+
+	ID3D11DeviceChild *apStates[NUM_STATES];
+	unsigned knownMask;
+
+	unsigned numSkipped;
+
+	RenderStateFilter();
+
+	// True if this command is a state change that can be left out.
+	// Otherwise, records its effect.
+	bool IsRedundant(RenderCommandType type, ID3D11DeviceChild *pState);
+};
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+class RenderCommandBuffer
+{
+public:
+	RenderCommandBuffer();
+	~RenderCommandBuffer();
+
+	// Forget all the commands. The memory is kept for next time.
+	void Reset();
+
+	unsigned GetNumCommands() const;
+	size_t GetSizeBytes() const;
+
+	void SetBlendState(ID3D11BlendState *pState);
+	void SetDepthStencilState(ID3D11DepthStencilState *pState);
+	void SetRasterizerState(ID3D11RasterizerState *pState);
+	void Clear(ID3D11RenderTargetView *pRenderTargetView, ID3D11DepthStencilView *pDepthStencilView, const DirectX::XMFLOAT4 &clearColour);
+
+	// The new contents are stored in the command buffer itself. The
+	// return value is their offset; fill them in via GetData. (The
+	// pointer from GetData moves when the next command is recorded,
+	// which is why an offset is returned rather than a pointer.) They
+	// start off zeroed.
+	size_t UpdateBuffer(ID3D11Buffer *pBuffer, unsigned firstByte, unsigned sizeBytes, bool discard);
+	void *GetData(size_t offset);
+
+	void SetConstantBuffer(RenderStage stage, int slot, ID3D11Buffer *pBuffer);
+	void SetShaderResource(RenderStage stage, int slot, ID3D11ShaderResourceView *pView);
+	void SetSampler(int slot, ID3D11SamplerState *pSampler);
+	void Draw(const RenderDraw &draw);
+
+	// Copy the commands in bytes [firstByte, endByte) of another
+	// buffer onto the end of this one. The range must start and end on
+	// command boundaries, as given by GetSizeBytes at the time. If
+	// pFilter is supplied, redundant state changes are left out.
+	void AppendCommands(const RenderCommandBuffer &source, size_t firstByte, size_t endByte, RenderStateFilter *pFilter);
+
+	// Replay the commands, in the order they were recorded.
+	void Execute(RenderBackend *pBackend) const;
+protected:
+private:
+	struct Header;
+
+	std::vector<uint8_t> m_data;
+	unsigned m_numCommands;
+
+	void *Append(RenderCommandType type, size_t payloadSizeBytes);
+
+	RenderCommandBuffer(const RenderCommandBuffer &);
+	RenderCommandBuffer &operator=(const RenderCommandBuffer &);
+};
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+class D3D11RenderBackend:
+public RenderBackend
+{
+public:
+	explicit D3D11RenderBackend(ID3D11DeviceContext *pDeviceContext);
+
+	void BeginExecute();
+	void SetBlendState(ID3D11BlendState *pState);
+	void SetDepthStencilState(ID3D11DepthStencilState *pState);
+	void SetRasterizerState(ID3D11RasterizerState *pState);
+	void Clear(ID3D11RenderTargetView *pRenderTargetView, ID3D11DepthStencilView *pDepthStencilView, const DirectX::XMFLOAT4 &clearColour);
+	void UpdateBuffer(ID3D11Buffer *pBuffer, unsigned firstByte, unsigned sizeBytes, bool discard, const void *pData);
+	void SetConstantBuffer(RenderStage stage, int slot, ID3D11Buffer *pBuffer);
+	void SetShaderResource(RenderStage stage, int slot, ID3D11ShaderResourceView *pView);
+	void SetSampler(int slot, ID3D11SamplerState *pSampler);
+	void Draw(const RenderDraw &draw);
+protected:
+private:
+	ID3D11DeviceContext *m_pDeviceContext;
+
+	// What the draws last set, so that consecutive draws with the same
+	// shaders don't set them again.
+	ID3D11VertexShader *m_pVS;
+	ID3D11PixelShader *m_pPS;
+	ID3D11InputLayout *m_pIL;
+	D3D11_PRIMITIVE_TOPOLOGY m_topology;
+	bool m_shadersKnown;
+};
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+// Counts of everything a NullRenderBackend has been asked to do.
+//
+// Errors are commands that the D3D11 backend would either fail on or
+// silently ignore - NULL state objects, draws with no shaders, and
+// so on. Each one is also dprintf'd.
+//
+// Redundant state changes set a blend, depth/stencil or rasterizer
+// state that's already set; redundant shader changes are draws that
+// use the same shaders and input layout as the draw before. Neither
+// carries over from one Execute to the next.
+
+struct RenderCommandStats
+{
+	unsigned numCommands[RenderCommand_Count];
+
+	unsigned numDraws;
+	unsigned numInstancedDraws;
+	unsigned numInstances;
+	unsigned numItems;
+	size_t numUploadBytes;
+
+	unsigned numRedundantStateChanges;
+	unsigned numRedundantShaderChanges;
+
+	unsigned numErrors;
+
+	RenderCommandStats();
+};
+
+class NullRenderBackend:
+public RenderBackend
+{
+public:
+	NullRenderBackend();
+
+	const RenderCommandStats &GetStats() const;
+	void ResetStats();
+
+	void BeginExecute();
+	void SetBlendState(ID3D11BlendState *pState);
+	void SetDepthStencilState(ID3D11DepthStencilState *pState);
+	void SetRasterizerState(ID3D11RasterizerState *pState);
+	void Clear(ID3D11RenderTargetView *pRenderTargetView, ID3D11DepthStencilView *pDepthStencilView, const DirectX::XMFLOAT4 &clearColour);
+	void UpdateBuffer(ID3D11Buffer *pBuffer, unsigned firstByte, unsigned sizeBytes, bool discard, const void *pData);
+	void SetConstantBuffer(RenderStage stage, int slot, ID3D11Buffer *pBuffer);
+	void SetShaderResource(RenderStage stage, int slot, ID3D11ShaderResourceView *pView);
+	void SetSampler(int slot, ID3D11SamplerState *pSampler);
+	void Draw(const RenderDraw &draw);
+protected:
+private:
+	RenderCommandStats m_stats;
+
+	RenderStateFilter m_stateFilter;
+	RenderDraw m_lastDraw;
+
+	void Check(bool ok, const char *pWhat);
+};
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+#endif//HEADER_89024EC9BDEE405D8CFDC2890459D42A
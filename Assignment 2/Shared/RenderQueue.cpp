@@ -0,0 +1,185 @@
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <d3d11.h>
+
+#include "RenderQueue.h"
+
+#include <assert.h>
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+static const int KEY_DEPTH_SHIFT = 64 - RenderQueue::KEY_SHADER_BITS - RenderQueue::KEY_STATE_BITS - RenderQueue::KEY_TEXTURE_BITS - RenderQueue::KEY_DEPTH_BITS;
+static const int KEY_TEXTURE_SHIFT = KEY_DEPTH_SHIFT + RenderQueue::KEY_DEPTH_BITS;
+static const int KEY_STATE_SHIFT = KEY_TEXTURE_SHIFT + RenderQueue::KEY_TEXTURE_BITS;
+static const int KEY_SHADER_SHIFT = KEY_STATE_SHIFT + RenderQueue::KEY_STATE_BITS;
+
+// The sort is LSD radix, a byte per pass.
+static const int RADIX_BITS = 8;
+static const int RADIX_SIZE = 1 << RADIX_BITS;
+static const int NUM_RADIX_PASSES = 64 / RADIX_BITS;
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+uint64_t RenderQueue::MakeKey(unsigned shader, unsigned state, const void *pTexture, float depth)
+{
+	// Texture views are only compared for equality, so any mix of the
+	// pointer bits will do. The bottom few are always 0.
+	const uintptr_t texture = reinterpret_cast<uintptr_t>(pTexture);
+	const unsigned textureHash = unsigned(texture >> 4 ^ texture >> (4 + KEY_TEXTURE_BITS));
+
+	// Non-negative floats sort the same as their bit patterns, so the
+	// top bits of the pattern make a depth that keeps its precision
+	// close to the camera.
+	if (!(depth > 0.f))
+		depth = 0.f;
+
+	uint32_t depthBits;
+	memcpy(&depthBits, &depth, sizeof depthBits);
+
+	uint64_t key = 0;
+
+	key |= uint64_t(shader & ((1 << KEY_SHADER_BITS) - 1)) << KEY_SHADER_SHIFT;
+	key |= uint64_t(state & ((1 << KEY_STATE_BITS) - 1)) << KEY_STATE_SHIFT;
+	key |= uint64_t(textureHash & ((1 << KEY_TEXTURE_BITS) - 1)) << KEY_TEXTURE_SHIFT;
+	key |= uint64_t(depthBits >> (31 - KEY_DEPTH_BITS)) << KEY_DEPTH_SHIFT;
+
+	return key;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+RenderQueue::RenderQueue():
+m_itemStartByte(0)
+{
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+RenderQueue::~RenderQueue()
+{
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void RenderQueue::Reset()
+{
+	m_commands.Reset();
+	m_items.clear();
+	m_itemStartByte = 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+unsigned RenderQueue::GetNumItems() const
+{
+	return unsigned(m_items.size());
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+RenderCommandBuffer *RenderQueue::GetCommands()
+{
+	return &m_commands;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void RenderQueue::EndItem(uint64_t key)
+{
+	Item item;
+
+	item.key = key;
+	item.firstByte = uint32_t(m_itemStartByte);
+	item.endByte = uint32_t(m_commands.GetSizeBytes());
+
+	m_items.push_back(item);
+
+	m_itemStartByte = item.endByte;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void RenderQueue::Sort()
+{
+	const size_t numItems = m_items.size();
+
+	if (numItems < 2)
+		return;
+
+	// All the histograms are built in one go, rather than one per pass.
+	size_t aCounts[NUM_RADIX_PASSES][RADIX_SIZE];
+	memset(aCounts, 0, sizeof aCounts);
+
+	for (size_t i = 0; i < numItems; ++i)
+	{
+		const uint64_t key = m_items[i].key;
+
+		for (int pass = 0; pass < NUM_RADIX_PASSES; ++pass)
+			++aCounts[pass][(key >> (pass * RADIX_BITS)) & (RADIX_SIZE - 1)];
+	}
+
+	m_sortedItems.resize(numItems);
+
+	Item *pSrc = &m_items[0];
+	Item *pDest = &m_sortedItems[0];
+
+	for (int pass = 0; pass < NUM_RADIX_PASSES; ++pass)
+	{
+		const int shift = pass * RADIX_BITS;
+		size_t *pCounts = aCounts[pass];
+
+		// If every key has the same digit, the pass wouldn't move
+		// anything. Most of them are like this - the shader and state
+		// fields only take a handful of values.
+		if (pCounts[(pSrc[0].key >> shift) & (RADIX_SIZE - 1)] == numItems)
+			continue;
+
+		size_t offset = 0;
+		for (int digit = 0; digit < RADIX_SIZE; ++digit)
+		{
+			const size_t count = pCounts[digit];
+			pCounts[digit] = offset;
+			offset += count;
+		}
+
+		for (size_t i = 0; i < numItems; ++i)
+			pDest[pCounts[(pSrc[i].key >> shift) & (RADIX_SIZE - 1)]++] = pSrc[i];
+
+		Item *pTemp = pSrc;
+		pSrc = pDest;
+		pDest = pTemp;
+	}
+
+	if (pSrc != &m_items[0])
+		m_items.swap(m_sortedItems);
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+void RenderQueue::Flush(RenderCommandBuffer *pDest)
+{
+	this->Sort();
+
+	RenderStateFilter filter;
+
+	for (size_t i = 0; i < m_items.size(); ++i)
+		pDest->AppendCommands(m_commands, m_items[i].firstByte, m_items[i].endByte, &filter);
+
+	pDest->AppendCommands(m_commands, m_itemStartByte, m_commands.GetSizeBytes(), &filter);
+
+	this->Reset();
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
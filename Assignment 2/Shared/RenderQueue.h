@@ -0,0 +1,91 @@
+#ifndef HEADER_A99F1B505A524848A27EBFBE7292E4F8
+#define HEADER_A99F1B505A524848A27EBFBE7292E4F8
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+//
+// Draw queue.
+//
+// Draws are recorded into the queue's own command buffer rather than
+// straight into the frame's. Each item is the run of commands that
+// leads up to and includes one draw - its state changes, constant
+// uploads and bindings - tagged with a 64-bit sort key.
+//
+// Flush sorts the items by key and appends their commands to another
+// command buffer in that order, leaving out any state change that
+// sets the state that's already in effect. With the key ordered
+// shader, state, texture, depth, draws that share a pipeline end up
+// next to each other and most of their state changes disappear.
+//
+// The key is made by MakeKey. Only its order matters, so callers are
+// free to fill in the fields however suits them.
+//
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+#include "RenderCommands.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+class RenderQueue
+{
+public:
+	// Widths of the fields in the sort key, most significant first.
+	static const int KEY_SHADER_BITS = 8;
+	static const int KEY_STATE_BITS = 5;
+	static const int KEY_TEXTURE_BITS = 16;
+	static const int KEY_DEPTH_BITS = 24;
+
+	// Depth is a view space distance; negative values are clamped to
+	// 0. Items with equal keys keep the order they were added in.
+	static uint64_t MakeKey(unsigned shader, unsigned state, const void *pTexture, float depth);
+
+	RenderQueue();
+	~RenderQueue();
+
+	// Forget all the items. The memory is kept for next time.
+	void Reset();
+
+	unsigned GetNumItems() const;
+
+	// Commands for queued draws go here.
+	RenderCommandBuffer *GetCommands();
+
+	// Ends an item, made up of everything recorded since the previous
+	// item ended.
+	void EndItem(uint64_t key);
+
+	// Sorts the items and appends their commands to pDest, then resets
+	// the queue. Anything recorded after the last item goes on the end,
+	// unsorted.
+	void Flush(RenderCommandBuffer *pDest);
+protected:
+private:
+	struct Item
+	{
+		uint64_t key;
+		uint32_t firstByte;
+		uint32_t endByte;
+	};
+
+	RenderCommandBuffer m_commands;
+	std::vector<Item> m_items;
+	std::vector<Item> m_sortedItems;
+	size_t m_itemStartByte;
+
+	void Sort();
+
+	RenderQueue(const RenderQueue &);
+	RenderQueue &operator=(const RenderQueue &);
+};
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+#endif//HEADER_A99F1B505A524848A27EBFBE7292E4F8
@@ -0,0 +1,122 @@
+#ifndef HEADER_5C0E7B9A14F2486DB3A1E6D82F4C9B70
+#define HEADER_5C0E7B9A14F2486DB3A1E6D82F4C9B70
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+//
+// Hands data from one thread to another without either ever waiting.
+//
+// There are three copies of T. The writer fills its own with
+// GetWriteBuffer, then Publish swaps it with the middle one and marks
+// the middle as new. The reader calls Acquire, which swaps its own
+// with the middle one only if there's something new there, and reads
+// the result with GetReadBuffer until the next Acquire.
+//
+// So the reader always has the latest complete copy the writer
+// published. Copies published in between Acquires are skipped, and if
+// nothing was published the reader keeps the copy it had.
+//
+// One writer thread and one reader thread only. The buffers are
+// reused round the three, so the writer must fill in the whole of its
+// buffer each time rather than only what changed since.
+//
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+template<class T>
+class TripleBuffer
+{
+public:
+	TripleBuffer();
+
+	T &GetWriteBuffer();
+	void Publish();
+
+	// Returns the read buffer, after swapping in the newest published
+	// one, if any.
+	const T &Acquire();
+	const T &GetReadBuffer() const;
+private:
+	// The middle index is stored with this bit set when the writer has
+	// published into it and the reader hasn't taken it yet.
+	static const unsigned NEW_BIT = 4;
+	static const unsigned INDEX_MASK = 3;
+
+	T m_buffers[3];
+
+	std::atomic<unsigned> m_middle;
+
+	unsigned m_writeIndex;// only touched by the writer
+	unsigned m_readIndex;// only touched by the reader
+
+	TripleBuffer(const TripleBuffer &);
+	TripleBuffer &operator=(const TripleBuffer &);
+};
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+template<class T>
+TripleBuffer<T>::TripleBuffer():
+m_middle(1),
+m_writeIndex(0),
+m_readIndex(2)
+{
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+template<class T>
+T &TripleBuffer<T>::GetWriteBuffer()
+{
+	return m_buffers[m_writeIndex];
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+template<class T>
+void TripleBuffer<T>::Publish()
+{
+	// Release, so the reader sees everything written to the buffer;
+	// acquire, so the buffer coming back is finished with.
+	const unsigned oldMiddle = m_middle.exchange(m_writeIndex | NEW_BIT, std::memory_order_acq_rel);
+
+	m_writeIndex = oldMiddle & INDEX_MASK;
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+template<class T>
+const T &TripleBuffer<T>::Acquire()
+{
+	if (m_middle.load(std::memory_order_relaxed) & NEW_BIT)
+	{
+		const unsigned oldMiddle = m_middle.exchange(m_readIndex, std::memory_order_acq_rel);
+
+		m_readIndex = oldMiddle & INDEX_MASK;
+	}
+
+	return m_buffers[m_readIndex];
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+template<class T>
+const T &TripleBuffer<T>::GetReadBuffer() const
+{
+	return m_buffers[m_readIndex];
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
+#endif//HEADER_5C0E7B9A14F2486DB3A1E6D82F4C9B70